@@ -110,6 +110,30 @@
 #define MPTEST_USE_FUZZ 1
 #endif
 
+/* mptest */
+/* Help text */
+#if !defined(MPTEST_USE_THREADS)
+#define MPTEST_USE_THREADS 0
+#endif
+
+/* mptest */
+/* Help text */
+#if !defined(MPTEST_USE_IO)
+#define MPTEST_USE_IO 0
+#endif
+
+/* mptest */
+/* Help text */
+#if !defined(MPTEST_USE_FORK)
+#define MPTEST_USE_FORK 0
+#endif
+
+/* mptest */
+/* Help text */
+#if !defined(MPTEST_USE_COVERAGE)
+#define MPTEST_USE_COVERAGE 0
+#endif
+
 /* mptest */
 /* Help text */
 #if !defined(MPTEST_DETECT_UNCAUGHT_ASSERTS)
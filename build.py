@@ -18,7 +18,10 @@ class Project(pack_v4.Project):
         self.headers = ["mptest_internal.h"]
         self.sources = [
             "mptest_aparse.c",
+            "mptest_coverage.c",
+            "mptest_fault.c",
             "mptest_fuzz.c",
+            "mptest_io.c",
             "mptest_leakcheck.c",
             "mptest_longjmp.c",
             "mptest_state.c",
@@ -94,5 +97,43 @@ class Project(pack_v4.Project):
                     "test shuffling support."
                 ),
                 "default": 1
+            },
+            "USE_THREADS": {
+                "type": bool,
+                "help": (
+                    "Set {cfg:USE_THREADS} to 1 if code under test allocates "
+                    "from multiple threads while leak checking is enabled. "
+                    "Requires pthreads or Win32."
+                ),
+                "default": 0,
+                "requires": ["USE_LEAKCHECK"]
+            },
+            "USE_IO": {
+                "type": bool,
+                "help": (
+                    "Set {cfg:USE_IO} to 1 in order to use the stdio and POSIX "
+                    "I/O wrappers that simulate read, write, open, close and "
+                    "fsync failures."
+                ),
+                "default": 0
+            },
+            "USE_FORK": {
+                "type": bool,
+                "help": (
+                    "Set {cfg:USE_FORK} to 1 in order to run fuzz iterations "
+                    "in parallel worker processes. Requires fork()."
+                ),
+                "default": 0,
+                "requires": ["USE_FUZZ"]
+            },
+            "USE_COVERAGE": {
+                "type": bool,
+                "help": (
+                    "Set {cfg:USE_COVERAGE} to 1 in order to guide fuzzing by "
+                    "the coverage of code built with "
+                    "-fsanitize-coverage=trace-pc-guard."
+                ),
+                "default": 0,
+                "requires": ["USE_FUZZ", "USE_DYN_ALLOC"]
             }
         }
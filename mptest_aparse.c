@@ -58,6 +58,52 @@ MN_INTERNAL aparse_error mptest__aparse_opt_suite_cb(
   return APARSE_ERROR_NONE;
 }
 
+MN_INTERNAL aparse_error mptest__aparse_opt_num_cb(
+    void* user, aparse_state* state, int sub_arg_idx, const char* text,
+    mn_size text_size)
+{
+  unsigned long* out = (unsigned long*)user;
+  unsigned long num = 0;
+  unsigned long base = 10;
+  mn_size i = 0;
+  MN_ASSERT(text);
+  MN__UNUSED(state);
+  MN__UNUSED(sub_arg_idx);
+  if (text_size == 0) {
+    return APARSE_ERROR_PARSE;
+  }
+  if (text_size > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+    /* Hexadecimal */
+    base = 16;
+    i = 2;
+  }
+  for (; i < text_size; i++) {
+    unsigned long digit;
+    if (text[i] >= '0' && text[i] <= '9') {
+      digit = (unsigned long)(text[i] - '0');
+    } else if (base == 16 && text[i] >= 'a' && text[i] <= 'f') {
+      digit = (unsigned long)(text[i] - 'a' + 10);
+    } else if (base == 16 && text[i] >= 'A' && text[i] <= 'F') {
+      digit = (unsigned long)(text[i] - 'A' + 10);
+    } else {
+      return APARSE_ERROR_PARSE;
+    }
+    num = num * base + digit;
+  }
+  *out = num;
+  return APARSE_ERROR_NONE;
+}
+
+MN_INTERNAL aparse_error mptest__aparse_opt_seed_cb(
+    void* user, aparse_state* state, int sub_arg_idx, const char* text,
+    mn_size text_size)
+{
+  mptest__aparse_state* test_state = (mptest__aparse_state*)user;
+  test_state->opt_fault_seed_set = 1;
+  return mptest__aparse_opt_num_cb(
+      &test_state->opt_fault_seed, state, sub_arg_idx, text, text_size);
+}
+
 MN_INTERNAL int mptest__aparse_init(struct mptest__state* state)
 {
   aparse_error err = APARSE_ERROR_NONE;
@@ -68,6 +114,40 @@ MN_INTERNAL int mptest__aparse_init(struct mptest__state* state)
   test_state->opt_suite_name_tail = MN_NULL;
   test_state->opt_suite_name_tail = MN_NULL;
   test_state->opt_leak_check = 0;
+  test_state->opt_fault_mode = MN_NULL;
+  test_state->opt_fault_class = MN_NULL;
+  test_state->opt_fault_class_size = 0;
+  test_state->opt_fault_site_limit = 0;
+  test_state->opt_fault_pairs = 0;
+  test_state->opt_fault_sample = 0;
+  test_state->opt_fault_budget = 0;
+  test_state->opt_fault_seed = 0;
+  test_state->opt_fault_index = MN_NULL;
+#if MPTEST_USE_DYN_ALLOC
+  test_state->opt_fault_replay = MN_NULL;
+#endif
+  test_state->opt_fault_record = MN_NULL;
+  test_state->opt_fault_seed_set = 0;
+  test_state->opt_leak_check_quarantine = 0;
+#if MPTEST_USE_FORK
+  test_state->opt_fuzz_workers = 0;
+#endif
+#if MPTEST_USE_FUZZ
+  test_state->opt_fuzz_iterations = 0;
+  test_state->opt_fuzz_time = 0;
+  test_state->opt_fuzz_until_failure = 0;
+  test_state->opt_fuzz_keep_going = 0;
+#endif
+#if MPTEST_USE_FUZZ && MPTEST_USE_DYN_ALLOC
+  test_state->opt_fuzz_tape = MN_NULL;
+#endif
+#if MPTEST_USE_COVERAGE
+  test_state->opt_fuzz_guided = 0;
+  test_state->opt_fuzz_corpus = MN_NULL;
+#endif
+#if MPTEST_USE_SYM
+  test_state->opt_update_snapshots = 0;
+#endif
   if ((err = aparse_init(aparse))) {
     return err;
   }
@@ -92,6 +172,179 @@ MN_INTERNAL int mptest__aparse_init(struct mptest__state* state)
   aparse_arg_type_bool(aparse, &test_state->opt_fault_check);
   aparse_arg_help(aparse, "Instrument tests by simulating faults");
 
+  if ((err = aparse_add_opt(aparse, 0, "fault-mode"))) {
+    return err;
+  }
+  aparse_arg_type_str(
+      aparse, &test_state->opt_fault_mode, &test_state->opt_fault_mode_size);
+  aparse_arg_help(
+      aparse, "With --fault-check, fail every call after a fault (set, the "
+              "default) or only the faulted call (one)");
+  aparse_arg_metavar(aparse, "MODE");
+
+  if ((err = aparse_add_opt(aparse, 0, "fault-class"))) {
+    return err;
+  }
+  aparse_arg_type_str(
+      aparse, &test_state->opt_fault_class, &test_state->opt_fault_class_size);
+  aparse_arg_help(
+      aparse, "Only simulate faults in the comma-separated list of CLASSES");
+  aparse_arg_metavar(aparse, "CLASSES");
+
+  if ((err = aparse_add_opt(aparse, 0, "fault-site-limit"))) {
+    return err;
+  }
+  aparse_arg_type_custom(
+      aparse, mptest__aparse_opt_num_cb, &test_state->opt_fault_site_limit, 1);
+  aparse_arg_help(
+      aparse, "Simulate at most K faults per call site instead of one for "
+              "every call");
+  aparse_arg_metavar(aparse, "K");
+
+  if ((err = aparse_add_opt(aparse, 0, "fault-pairs"))) {
+    return err;
+  }
+  aparse_arg_type_bool(aparse, &test_state->opt_fault_pairs);
+  aparse_arg_help(
+      aparse, "With --fault-check, also simulate faults in pairs of calls "
+              "(implies --fault-mode one)");
+
+  if ((err = aparse_add_opt(aparse, 0, "fault-sample"))) {
+    return err;
+  }
+  aparse_arg_type_custom(
+      aparse, mptest__aparse_opt_num_cb, &test_state->opt_fault_sample, 1);
+  aparse_arg_help(
+      aparse, "Simulate faults at N randomly chosen fault points per test");
+  aparse_arg_metavar(aparse, "N");
+
+  if ((err = aparse_add_opt(aparse, 0, "fault-budget"))) {
+    return err;
+  }
+  aparse_arg_type_custom(
+      aparse, mptest__aparse_opt_num_cb, &test_state->opt_fault_budget, 1);
+  aparse_arg_help(
+      aparse, "Stop sampling fault points after SECONDS of wall time");
+  aparse_arg_metavar(aparse, "SECONDS");
+
+  if ((err = aparse_add_opt(aparse, 0, "fault-index"))) {
+    return err;
+  }
+  aparse_arg_type_str(
+      aparse, &test_state->opt_fault_index, &test_state->opt_fault_index_size);
+  aparse_arg_help(
+      aparse, "Fail only the calls in SPEC, a comma-separated list of "
+              "CLASS:INDEX or INDEX");
+  aparse_arg_metavar(aparse, "SPEC");
+
+#if MPTEST_USE_DYN_ALLOC
+  if ((err = aparse_add_opt(aparse, 0, "fault-replay"))) {
+    return err;
+  }
+  aparse_arg_type_str(
+      aparse, &test_state->opt_fault_replay,
+      &test_state->opt_fault_replay_size);
+  aparse_arg_help(aparse, "Replay the failures recorded in schedule FILE");
+  aparse_arg_metavar(aparse, "FILE");
+#endif
+
+  if ((err = aparse_add_opt(aparse, 0, "fault-record"))) {
+    return err;
+  }
+  aparse_arg_type_str(
+      aparse, &test_state->opt_fault_record,
+      &test_state->opt_fault_record_size);
+  aparse_arg_help(aparse, "Write failures found by fault sweeps to FILE");
+  aparse_arg_metavar(aparse, "FILE");
+
+  if ((err = aparse_add_opt(aparse, 0, "fault-seed"))) {
+    return err;
+  }
+  aparse_arg_type_custom(aparse, mptest__aparse_opt_seed_cb, test_state, 1);
+  aparse_arg_help(aparse, "Seed for choosing fault points to sample");
+  aparse_arg_metavar(aparse, "SEED");
+
+#if MPTEST_USE_FORK
+  if ((err = aparse_add_opt(aparse, 0, "fuzz-workers"))) {
+    return err;
+  }
+  aparse_arg_type_custom(
+      aparse, mptest__aparse_opt_num_cb, &test_state->opt_fuzz_workers, 1);
+  aparse_arg_help(aparse, "Run fuzz iterations in N worker processes");
+  aparse_arg_metavar(aparse, "N");
+#endif
+
+#if MPTEST_USE_FUZZ
+  if ((err = aparse_add_opt(aparse, 0, "fuzz-iterations"))) {
+    return err;
+  }
+  aparse_arg_type_custom(
+      aparse, mptest__aparse_opt_num_cb, &test_state->opt_fuzz_iterations, 1);
+  aparse_arg_help(aparse, "Run each fuzzed test for N iterations");
+  aparse_arg_metavar(aparse, "N");
+
+  if ((err = aparse_add_opt(aparse, 0, "fuzz-time"))) {
+    return err;
+  }
+  aparse_arg_type_custom(
+      aparse, mptest__aparse_opt_num_cb, &test_state->opt_fuzz_time, 1);
+  aparse_arg_help(
+      aparse, "Fuzz each test for SECONDS of wall time, showing "
+              "executions per second");
+  aparse_arg_metavar(aparse, "SECONDS");
+
+  if ((err = aparse_add_opt(aparse, 0, "fuzz-until-failure"))) {
+    return err;
+  }
+  aparse_arg_type_bool(aparse, &test_state->opt_fuzz_until_failure);
+  aparse_arg_help(aparse, "Fuzz each test until it fails");
+
+  if ((err = aparse_add_opt(aparse, 0, "fuzz-keep-going"))) {
+    return err;
+  }
+  aparse_arg_type_bool(aparse, &test_state->opt_fuzz_keep_going);
+  aparse_arg_help(
+      aparse, "Keep fuzzing past failures, grouping them by where they fail");
+#endif
+
+#if MPTEST_USE_FUZZ && MPTEST_USE_DYN_ALLOC
+  if ((err = aparse_add_opt(aparse, 0, "fuzz-tape"))) {
+    return err;
+  }
+  aparse_arg_type_str(
+      aparse, &test_state->opt_fuzz_tape, &test_state->opt_fuzz_tape_size);
+  aparse_arg_help(
+      aparse, "Run tests once on TAPE, comma-separated hexadecimal random "
+              "numbers, instead of fuzzing");
+  aparse_arg_metavar(aparse, "TAPE");
+#endif
+
+#if MPTEST_USE_COVERAGE
+  if ((err = aparse_add_opt(aparse, 0, "fuzz-guided"))) {
+    return err;
+  }
+  aparse_arg_type_bool(aparse, &test_state->opt_fuzz_guided);
+  aparse_arg_help(aparse, "Guide fuzzing by code coverage");
+
+  if ((err = aparse_add_opt(aparse, 0, "fuzz-corpus"))) {
+    return err;
+  }
+  aparse_arg_type_str(
+      aparse, &test_state->opt_fuzz_corpus, &test_state->opt_fuzz_corpus_size);
+  aparse_arg_help(
+      aparse, "Keep the guided fuzzing corpus in DIR between runs");
+  aparse_arg_metavar(aparse, "DIR");
+#endif
+
+#if MPTEST_USE_SYM
+  if ((err = aparse_add_opt(aparse, 0, "update-snapshots"))) {
+    return err;
+  }
+  aparse_arg_type_bool(aparse, &test_state->opt_update_snapshots);
+  aparse_arg_help(
+      aparse, "Write s-expression snapshots instead of comparing to them");
+#endif
+
 #if MPTEST_USE_LEAKCHECK
   if ((err = aparse_add_opt(aparse, 0, "leak-check"))) {
     return err;
@@ -105,6 +358,17 @@ MN_INTERNAL int mptest__aparse_init(struct mptest__state* state)
   aparse_arg_type_bool(aparse, &test_state->opt_leak_check_pass);
   aparse_arg_help(
       aparse, "Pass memory allocations without recording, useful with ASAN");
+
+  if ((err = aparse_add_opt(aparse, 0, "leak-check-quarantine"))) {
+    return err;
+  }
+  aparse_arg_type_custom(
+      aparse, mptest__aparse_opt_num_cb,
+      &test_state->opt_leak_check_quarantine, 1);
+  aparse_arg_help(
+      aparse, "Poison freed memory and hold up to BYTES of it to catch "
+              "use-after-free");
+  aparse_arg_metavar(aparse, "BYTES");
 #endif
 
   if ((err = aparse_add_opt(aparse, 'h', "help"))) {
@@ -151,6 +415,111 @@ MN_API int mptest__state_init_argv(
   if (state->aparse_state.opt_fault_check) {
     state->fault_checking = MPTEST__FAULT_MODE_SET;
   }
+  if (state->aparse_state.opt_fault_mode) {
+    const char* mode = state->aparse_state.opt_fault_mode;
+    if (!state->aparse_state.opt_fault_check) {
+      printf("--fault-mode requires --fault-check\n");
+      return APARSE_ERROR_INVALID;
+    } else if (mptest__streq(mode, "set")) {
+      state->fault_checking = MPTEST__FAULT_MODE_SET;
+    } else if (mptest__streq(mode, "one")) {
+      state->fault_checking = MPTEST__FAULT_MODE_ONE;
+    } else {
+      printf("invalid fault mode: %s\n", mode);
+      return APARSE_ERROR_INVALID;
+    }
+  }
+  if (state->aparse_state.opt_fault_class) {
+    state->fault_class_filter = state->aparse_state.opt_fault_class;
+    state->fault_class_filter_len = state->aparse_state.opt_fault_class_size;
+  }
+  if (state->aparse_state.opt_fault_site_limit) {
+    state->fault_site_limit = (int)state->aparse_state.opt_fault_site_limit;
+  }
+  if (state->aparse_state.opt_fault_pairs) {
+    if (!state->aparse_state.opt_fault_check) {
+      printf("--fault-pairs requires --fault-check\n");
+      return APARSE_ERROR_INVALID;
+    } else if (state->fault_checking == MPTEST__FAULT_MODE_SET &&
+               state->aparse_state.opt_fault_mode) {
+      /* Pairs are meaningless if every call after the first fault fails */
+      printf("--fault-pairs cannot be used with --fault-mode set\n");
+      return APARSE_ERROR_INVALID;
+    }
+    state->fault_checking = MPTEST__FAULT_MODE_ONE;
+    mptest__fault_set_pairs(state, 1);
+  }
+  if (state->aparse_state.opt_fault_sample ||
+      state->aparse_state.opt_fault_budget) {
+    mptest__fault_set_sample(
+        state, (int)state->aparse_state.opt_fault_sample,
+        (int)state->aparse_state.opt_fault_budget);
+  }
+  if (state->aparse_state.opt_fault_seed_set) {
+    mptest__fault_set_seed(state, state->aparse_state.opt_fault_seed);
+  }
+  if (state->aparse_state.opt_fault_index &&
+      mptest__fault_set_index(state, state->aparse_state.opt_fault_index)) {
+    printf("invalid fault index: %s\n", state->aparse_state.opt_fault_index);
+    return APARSE_ERROR_INVALID;
+  }
+#if MPTEST_USE_DYN_ALLOC
+  if (state->aparse_state.opt_fault_replay &&
+      mptest__fault_replay_file(state, state->aparse_state.opt_fault_replay)) {
+    printf(
+        "could not read fault schedule: %s\n",
+        state->aparse_state.opt_fault_replay);
+    return APARSE_ERROR_INVALID;
+  }
+#endif
+  if (state->aparse_state.opt_fault_record &&
+      mptest__fault_record_file(state, state->aparse_state.opt_fault_record)) {
+    printf(
+        "could not open fault schedule: %s\n",
+        state->aparse_state.opt_fault_record);
+    return APARSE_ERROR_INVALID;
+  }
+#if MPTEST_USE_FORK
+  if (state->aparse_state.opt_fuzz_workers) {
+    mptest__fuzz_set_workers(
+        state, (int)state->aparse_state.opt_fuzz_workers);
+  }
+#endif
+#if MPTEST_USE_FUZZ
+  if (state->aparse_state.opt_fuzz_iterations) {
+    mptest__fuzz_set_iterations(
+        state, (int)state->aparse_state.opt_fuzz_iterations);
+  }
+  if (state->aparse_state.opt_fuzz_time) {
+    mptest__fuzz_set_time(state, (int)state->aparse_state.opt_fuzz_time);
+  }
+  if (state->aparse_state.opt_fuzz_until_failure) {
+    mptest__fuzz_set_until_failure(state, 1);
+  }
+  if (state->aparse_state.opt_fuzz_keep_going) {
+    mptest__fuzz_set_keep_going(state, 1);
+  }
+#endif
+#if MPTEST_USE_FUZZ && MPTEST_USE_DYN_ALLOC
+  if (state->aparse_state.opt_fuzz_tape &&
+      mptest__fuzz_set_tape(state, state->aparse_state.opt_fuzz_tape)) {
+    printf("invalid fuzz tape: %s\n", state->aparse_state.opt_fuzz_tape);
+    return APARSE_ERROR_INVALID;
+  }
+#endif
+#if MPTEST_USE_COVERAGE
+  if (state->aparse_state.opt_fuzz_guided) {
+    mptest__coverage_set_guided(state, 1);
+  }
+  if (state->aparse_state.opt_fuzz_corpus) {
+    mptest__coverage_set_corpus(state, state->aparse_state.opt_fuzz_corpus);
+  }
+#endif
+#if MPTEST_USE_SYM
+  if (state->aparse_state.opt_update_snapshots) {
+    mptest__sym_set_update_snapshots(state, 1);
+  }
+#endif
 #if MPTEST_USE_LEAKCHECK
   if (state->aparse_state.opt_leak_check) {
     state->leakcheck_state.test_leak_checking = MPTEST__LEAKCHECK_MODE_ON;
@@ -158,6 +527,10 @@ MN_API int mptest__state_init_argv(
   if (state->aparse_state.opt_leak_check_pass) {
     state->leakcheck_state.fall_through = 1;
   }
+  if (state->aparse_state.opt_leak_check_quarantine) {
+    state->leakcheck_state.quarantine_limit =
+        (size_t)state->aparse_state.opt_leak_check_quarantine;
+  }
 #endif
   return stat;
 }
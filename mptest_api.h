@@ -69,6 +69,27 @@ MN_API void mptest__catch_assert_fail(
     const char* file, int line);
 
 MN_API void mptest__fault_set(struct mptest__state* state, int on);
+MN_API void
+mptest__fault_set_classes(struct mptest__state* state, const char* classes);
+MN_API void
+mptest__fault_set_site_limit(struct mptest__state* state, int limit);
+MN_API void mptest__fault_set_pairs(struct mptest__state* state, int on);
+MN_API void mptest__fault_set_sample(
+    struct mptest__state* state, int sample, int budget);
+MN_API void
+mptest__fault_set_seed(struct mptest__state* state, unsigned long seed);
+MN_API int
+mptest__fault_set_index(struct mptest__state* state, const char* spec);
+#if MPTEST_USE_DYN_ALLOC
+MN_API int
+mptest__fault_replay_file(struct mptest__state* state, const char* path);
+#endif
+MN_API int
+mptest__fault_record_file(struct mptest__state* state, const char* path);
+MN_API int mptest__fault_at(
+    struct mptest__state* state, const char* class, const char* file,
+    int line);
+MN_API int mptest_fault(const char* class);
 
 #if MPTEST_USE_LEAKCHECK
 MN_API void* mptest__leakcheck_hook_malloc(
@@ -79,13 +100,59 @@ MN_API void* mptest__leakcheck_hook_realloc(
     struct mptest__state* state, const char* file, int line, void* old_ptr,
     size_t new_size);
 MN_API void mptest__leakcheck_set(struct mptest__state* state, int on);
+MN_API void
+mptest__leakcheck_set_quarantine(struct mptest__state* state, size_t bytes);
 
 MN_API void mptest_ex_nomem(void);
 MN_API void mptest_ex_fault(void);
 MN_API void mptest_ex_oom_inject(void);
 MN_API void mptest_ex_bad_alloc(void);
 MN_API void mptest_malloc_dump(void);
-MN_API int mptest_fault(const char* class);
+#endif
+
+#if MPTEST_USE_IO
+#include <stdio.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define MPTEST__IO_POSIX 1
+#include <sys/types.h>
+#else
+#define MPTEST__IO_POSIX 0
+#endif
+
+MN_API FILE* mptest__io_fopen(
+    struct mptest__state* state, const char* file, int line, const char* path,
+    const char* mode);
+MN_API size_t mptest__io_fread(
+    struct mptest__state* state, const char* file, int line, void* ptr,
+    size_t size, size_t nmemb, FILE* stream);
+MN_API size_t mptest__io_fwrite(
+    struct mptest__state* state, const char* file, int line, const void* ptr,
+    size_t size, size_t nmemb, FILE* stream);
+MN_API int mptest__io_fflush(
+    struct mptest__state* state, const char* file, int line, FILE* stream);
+MN_API int mptest__io_fclose(
+    struct mptest__state* state, const char* file, int line, FILE* stream);
+#if MPTEST__IO_POSIX
+MN_API int mptest__io_open(
+    struct mptest__state* state, const char* file, int line, const char* path,
+    int flags, int mode);
+MN_API ssize_t mptest__io_read(
+    struct mptest__state* state, const char* file, int line, int fd,
+    void* buf, size_t count);
+MN_API ssize_t mptest__io_write(
+    struct mptest__state* state, const char* file, int line, int fd,
+    const void* buf, size_t count);
+MN_API ssize_t mptest__io_recv(
+    struct mptest__state* state, const char* file, int line, int fd,
+    void* buf, size_t len, int flags);
+MN_API ssize_t mptest__io_send(
+    struct mptest__state* state, const char* file, int line, int fd,
+    const void* buf, size_t len, int flags);
+MN_API int mptest__io_fsync(
+    struct mptest__state* state, const char* file, int line, int fd);
+MN_API int mptest__io_close(
+    struct mptest__state* state, const char* file, int line, int fd);
+#endif
 #endif
 
 #if MPTEST_USE_APARSE
@@ -99,6 +166,36 @@ MN_API int mptest__state_init_argv(
 typedef unsigned long mptest_rand;
 MN_API void mptest__fuzz_next_test(struct mptest__state* state, int iterations);
 MN_API mptest_rand mptest__fuzz_rand(struct mptest__state* state);
+MN_API mptest_rand
+mptest__fuzz_rand_bounded(struct mptest__state* state, mptest_rand bound);
+MN_API void
+mptest__fuzz_fill(struct mptest__state* state, void* buf, mn_size size);
+MN_API int mptest__fuzz_one_input(
+    struct mptest__state* state, mptest__test_func test_func,
+    const char* test_name, const unsigned char* data, mn_size size);
+MN_API void
+mptest__fuzz_set_iterations(struct mptest__state* state, int iterations);
+MN_API void mptest__fuzz_set_time(struct mptest__state* state, int seconds);
+MN_API void
+mptest__fuzz_set_until_failure(struct mptest__state* state, int until_failure);
+MN_API void
+mptest__fuzz_set_keep_going(struct mptest__state* state, int keep_going);
+#if MPTEST_USE_FORK
+MN_API void mptest__fuzz_set_workers(struct mptest__state* state, int workers);
+#endif
+#if MPTEST_USE_DYN_ALLOC
+MN_API int mptest__fuzz_set_tape(struct mptest__state* state, const char* spec);
+#endif
+#if MPTEST_USE_COVERAGE
+/* Guard type of -fsanitize-coverage=trace-pc-guard, a uint32_t */
+typedef unsigned int mptest__coverage_guard;
+void __sanitizer_cov_trace_pc_guard_init(
+    mptest__coverage_guard* start, mptest__coverage_guard* stop);
+void __sanitizer_cov_trace_pc_guard(mptest__coverage_guard* guard);
+MN_API void mptest__coverage_set_guided(struct mptest__state* state, int on);
+MN_API void
+mptest__coverage_set_corpus(struct mptest__state* state, const char* dir);
+#endif
 #endif
 
 #define _ASSERT_PASS_BEHAVIOR(expr, msg)                                       \
@@ -299,6 +396,15 @@ MN_API mptest_rand mptest__fuzz_rand(struct mptest__state* state);
 #define MPTEST_DISABLE_LEAK_CHECKING()                                         \
   mptest__leakcheck_set(&mptest__state_g, MPTEST__LEAKCHECK_MODE_OFF)
 
+/* Hold up to `bytes` of freed memory in a poisoned quarantine, so that writes
+ * after `free()` are caught when the memory leaves the quarantine or the test
+ * ends. */
+#define MPTEST_ENABLE_QUARANTINE(bytes)                                        \
+  mptest__leakcheck_set_quarantine(&mptest__state_g, (bytes))
+
+#define MPTEST_DISABLE_QUARANTINE()                                            \
+  mptest__leakcheck_set_quarantine(&mptest__state_g, 0)
+
 #else
 
 #define MPTEST_INJECT_MALLOC(size) MPTEST_MALLOC(size)
@@ -308,6 +414,63 @@ MN_API mptest_rand mptest__fuzz_rand(struct mptest__state* state);
 
 #endif
 
+/* I/O wrappers that simulate failures in the fault classes "open", "read",
+ * "write", "fsync" (fflush() and fsync()) and "close". Reads and writes of more
+ * than one unit are also "short_read" and "short_write" fault points, which
+ * transfer only half of the requested amount. */
+#if MPTEST_USE_IO
+
+#define MPTEST_INJECT_FOPEN(path, mode)                                        \
+  mptest__io_fopen(&mptest__state_g, __FILE__, __LINE__, (path), (mode))
+#define MPTEST_INJECT_FREAD(ptr, size, nmemb, stream)                          \
+  mptest__io_fread(                                                            \
+      &mptest__state_g, __FILE__, __LINE__, (ptr), (size), (nmemb), (stream))
+#define MPTEST_INJECT_FWRITE(ptr, size, nmemb, stream)                         \
+  mptest__io_fwrite(                                                           \
+      &mptest__state_g, __FILE__, __LINE__, (ptr), (size), (nmemb), (stream))
+#define MPTEST_INJECT_FFLUSH(stream)                                           \
+  mptest__io_fflush(&mptest__state_g, __FILE__, __LINE__, (stream))
+#define MPTEST_INJECT_FCLOSE(stream)                                           \
+  mptest__io_fclose(&mptest__state_g, __FILE__, __LINE__, (stream))
+
+#if MPTEST__IO_POSIX
+#define MPTEST_INJECT_OPEN(path, flags, mode)                                  \
+  mptest__io_open(&mptest__state_g, __FILE__, __LINE__, (path), (flags), (mode))
+#define MPTEST_INJECT_READ(fd, buf, count)                                     \
+  mptest__io_read(&mptest__state_g, __FILE__, __LINE__, (fd), (buf), (count))
+#define MPTEST_INJECT_WRITE(fd, buf, count)                                    \
+  mptest__io_write(&mptest__state_g, __FILE__, __LINE__, (fd), (buf), (count))
+#define MPTEST_INJECT_RECV(fd, buf, len, flags)                                \
+  mptest__io_recv(                                                             \
+      &mptest__state_g, __FILE__, __LINE__, (fd), (buf), (len), (flags))
+#define MPTEST_INJECT_SEND(fd, buf, len, flags)                                \
+  mptest__io_send(                                                             \
+      &mptest__state_g, __FILE__, __LINE__, (fd), (buf), (len), (flags))
+#define MPTEST_INJECT_FSYNC(fd)                                                \
+  mptest__io_fsync(&mptest__state_g, __FILE__, __LINE__, (fd))
+#define MPTEST_INJECT_CLOSE(fd)                                                \
+  mptest__io_close(&mptest__state_g, __FILE__, __LINE__, (fd))
+#endif
+
+#else
+
+#define MPTEST_INJECT_FOPEN(path, mode) fopen(path, mode)
+#define MPTEST_INJECT_FREAD(ptr, size, nmemb, stream)                          \
+  fread(ptr, size, nmemb, stream)
+#define MPTEST_INJECT_FWRITE(ptr, size, nmemb, stream)                         \
+  fwrite(ptr, size, nmemb, stream)
+#define MPTEST_INJECT_FFLUSH(stream) fflush(stream)
+#define MPTEST_INJECT_FCLOSE(stream) fclose(stream)
+#define MPTEST_INJECT_OPEN(path, flags, mode) open(path, flags, mode)
+#define MPTEST_INJECT_READ(fd, buf, count) read(fd, buf, count)
+#define MPTEST_INJECT_WRITE(fd, buf, count) write(fd, buf, count)
+#define MPTEST_INJECT_RECV(fd, buf, len, flags) recv(fd, buf, len, flags)
+#define MPTEST_INJECT_SEND(fd, buf, len, flags) send(fd, buf, len, flags)
+#define MPTEST_INJECT_FSYNC(fd) fsync(fd)
+#define MPTEST_INJECT_CLOSE(fd) close(fd)
+
+#endif
+
 #define MPTEST_MAIN_BEGIN() mptest__state_init(&mptest__state_g)
 
 #define MPTEST_MAIN_BEGIN_ARGS(argc, argv)                                     \
@@ -333,9 +496,134 @@ MN_API mptest_rand mptest__fuzz_rand(struct mptest__state* state);
 #define MPTEST_DISABLE_FAULT_CHECKING()                                        \
   mptest__fault_set(&mptest__state_g, MPTEST__FAULT_MODE_OFF)
 
+/* Only simulate faults in the comma-separated list of classes `classes`, for
+ * example "malloc,read". NULL selects every class. */
+#define MPTEST_SET_FAULT_CLASSES(classes)                                      \
+  mptest__fault_set_classes(&mptest__state_g, (classes))
+
+/* Simulate at most `limit` faults at each call site (class, file and line)
+ * instead of one for every call. 0 restores the default. */
+#define MPTEST_SET_FAULT_SITE_LIMIT(limit)                                     \
+  mptest__fault_set_site_limit(&mptest__state_g, (limit))
+
+/* After each single fault, also fail it together with the first later call
+ * at each call site (such as a cleanup path that allocates). */
+#define MPTEST_ENABLE_FAULT_PAIRS()                                            \
+  mptest__fault_set_pairs(&mptest__state_g, 1)
+
+#define MPTEST_DISABLE_FAULT_PAIRS()                                           \
+  mptest__fault_set_pairs(&mptest__state_g, 0)
+
+/* Instead of sweeping every fault point, try `sample` randomly chosen ones
+ * (0 for no limit), stopping after `budget` seconds (0 for no limit). Points
+ * at sites that have not been tried yet are chosen first. */
+#define MPTEST_SET_FAULT_SAMPLE(sample, budget)                                \
+  mptest__fault_set_sample(&mptest__state_g, (sample), (budget))
+
+#define MPTEST_SET_FAULT_SEED(seed)                                            \
+  mptest__fault_set_seed(&mptest__state_g, (seed))
+
+/* Instead of sweeping, fail the calls in `spec` in every test. `spec` is a
+ * comma-separated list of `CLASS:INDEX` (e.g. "malloc:3") or `INDEX` (counting
+ * calls of all classes). NULL restores sweeping. */
+#define MPTEST_SET_FAULT_INDEX(spec)                                           \
+  mptest__fault_set_index(&mptest__state_g, (spec))
+
+/* Like mptest_fault(), but records the call site for site-limited sweeps. */
+#define MPTEST_FAULT(class)                                                    \
+  mptest__fault_at(&mptest__state_g, (class), __FILE__, __LINE__)
+
 #if MPTEST_USE_FUZZ
 
-#define RAND_PARAM(mod) (mptest__fuzz_rand(&mptest__state_g) % (mod))
+/* Uniformly distributed random number in [0, `mod`). */
+#define RAND_PARAM(mod) mptest__fuzz_rand_bounded(&mptest__state_g, (mod))
+
+/* Fill `buf` with `size` random bytes. */
+#define RAND_FILL(buf, size) mptest__fuzz_fill(&mptest__state_g, (buf), (size))
+
+/* Define LLVMFuzzerTestOneInput(), the entry point of libFuzzer, AFL++ and
+ * OSS-Fuzz, to run `test` once per input. The RAND_PARAM()s and RAND_FILL()s
+ * of the test draw from the input instead of the generator, so it needs no
+ * changes. Failures are reported, then abort() so the engine keeps the input.
+ * Use at file scope instead of main(), without a semicolon. */
+#define MPTEST_FUZZ_TARGET(test) MPTEST__FUZZ_TARGET(test)
+
+/* Expands `test` first, so that it can come from a macro */
+#define MPTEST__FUZZ_TARGET(test)                                              \
+  int LLVMFuzzerInitialize(int* argc, char*** argv);                           \
+  int LLVMFuzzerTestOneInput(const unsigned char* data, mn_size size);         \
+  int LLVMFuzzerInitialize(int* argc, char*** argv)                            \
+  {                                                                            \
+    (void)argc;                                                                \
+    (void)argv;                                                                \
+    mptest__state_init(&mptest__state_g);                                      \
+    return 0;                                                                  \
+  }                                                                            \
+  int LLVMFuzzerTestOneInput(const unsigned char* data, mn_size size)          \
+  {                                                                            \
+    return mptest__fuzz_one_input(                                             \
+        &mptest__state_g, mptest__test_##test, #test, data, size);             \
+  }
+
+/* Run every FUZZ_TEST for `iterations` iterations instead of its own count,
+ * or 0 to restore it. */
+#define MPTEST_SET_FUZZ_ITERATIONS(iterations)                                 \
+  mptest__fuzz_set_iterations(&mptest__state_g, (iterations))
+
+/* Fuzz every FUZZ_TEST for `seconds` of wall time, or 0 for no limit.
+ * Unless an iteration count is also set, it runs for as many iterations as
+ * fit. Live progress is shown while it runs. */
+#define MPTEST_SET_FUZZ_TIME(seconds)                                          \
+  mptest__fuzz_set_time(&mptest__state_g, (seconds))
+
+/* Fuzz every FUZZ_TEST until it fails, or until its time runs out. */
+#define MPTEST_ENABLE_FUZZ_UNTIL_FAILURE()                                     \
+  mptest__fuzz_set_until_failure(&mptest__state_g, 1)
+
+#define MPTEST_DISABLE_FUZZ_UNTIL_FAILURE()                                    \
+  mptest__fuzz_set_until_failure(&mptest__state_g, 0)
+
+/* Keep fuzzing every FUZZ_TEST past its failures, sorting them into buckets
+ * by how and where they failed. The first bucket is reported in full, the
+ * others by their hit counts and reproducers. Ignored when fuzzing until
+ * failure. */
+#define MPTEST_ENABLE_FUZZ_KEEP_GOING()                                        \
+  mptest__fuzz_set_keep_going(&mptest__state_g, 1)
+
+#define MPTEST_DISABLE_FUZZ_KEEP_GOING()                                       \
+  mptest__fuzz_set_keep_going(&mptest__state_g, 0)
+
+#if MPTEST_USE_DYN_ALLOC
+/* Run every test once with the comma-separated hexadecimal random numbers in
+ * `spec` (as printed for shrunk failures) instead of fuzzing. Once they run
+ * out, random numbers are 0. NULL restores fuzzing. */
+#define MPTEST_SET_FUZZ_TAPE(spec)                                             \
+  mptest__fuzz_set_tape(&mptest__state_g, (spec))
+#endif
+
+#if MPTEST_USE_FORK
+/* Spread the iterations of each FUZZ_TEST over `workers` processes. The
+ * reported failing iteration and seed don't depend on the number of
+ * workers. */
+#define MPTEST_SET_FUZZ_WORKERS(workers)                                       \
+  mptest__fuzz_set_workers(&mptest__state_g, (workers))
+#endif
+
+#if MPTEST_USE_COVERAGE
+/* Guide FUZZ_TESTs by the coverage of code built with
+ * -fsanitize-coverage=trace-pc-guard. Runs whose random numbers reach new
+ * coverage are kept in a corpus and mutated to reach more. */
+#define MPTEST_ENABLE_FUZZ_GUIDED()                                            \
+  mptest__coverage_set_guided(&mptest__state_g, 1)
+
+#define MPTEST_DISABLE_FUZZ_GUIDED()                                           \
+  mptest__coverage_set_guided(&mptest__state_g, 0)
+
+/* Keep the corpus of each test in `dir`, as files named `<test>-<n>`, so that
+ * it carries over between runs. Also enables guided fuzzing. */
+#define MPTEST_SET_FUZZ_CORPUS(dir)                                            \
+  mptest__coverage_set_corpus(&mptest__state_g, (dir))
+#endif
 
 #endif
 
@@ -358,6 +646,24 @@ typedef struct mptest_sym_walk {
 typedef mptest_sym_build sym_build;
 typedef mptest_sym_walk sym_walk;
 
+/* Types of the trees added by mptest_sym_build_bulk() */
+#define MPTEST_SYM_EXPR 0
+#define MPTEST_SYM_STR 1
+#define MPTEST_SYM_NUM 2
+
+/* A tree added by mptest_sym_build_bulk(). Its first child and next sibling
+ * are indices of other trees in the same array, which must come after it, or
+ * MPTEST__SYM_NONE. Every tree but the first must be linked from exactly one
+ * other. */
+typedef struct mptest_sym_node {
+  int type;
+  mn_int32 first_child;
+  mn_int32 next_sibling;
+  mn_int32 num;
+  const char* str;
+  mn_size str_size;
+} mptest_sym_node;
+
 MN_API void mptest_sym_build_init(
     mptest_sym_build* build, mptest_sym* sym, mn_int32 parent_ref,
     mn_int32 prev_child_ref);
@@ -368,6 +674,9 @@ MN_API int mptest_sym_build_str(
 MN_API int mptest_sym_build_cstr(mptest_sym_build* build, const char* cstr);
 MN_API int mptest_sym_build_num(mptest_sym_build* build, mn_int32 num);
 MN_API int mptest_sym_build_type(mptest_sym_build* build, const char* type);
+MN_API int mptest_sym_build_reserve(mptest_sym_build* build, mn_size trees);
+MN_API int mptest_sym_build_bulk(
+    mptest_sym_build* build, const mptest_sym_node* nodes, mn_size count);
 
 MN_API void mptest_sym_walk_init(
     mptest_sym_walk* walk, const mptest_sym* sym, mn_int32 parent_ref,
@@ -392,12 +701,19 @@ MN_API int mptest__sym_make_init(
     mptest_sym_build* build_out, mptest_sym_walk* walk_out, const char* str,
     const char* file, int line, const char* msg);
 MN_API void mptest__sym_make_destroy(mptest_sym_build* build_out);
+MN_API int mptest__sym_snapshot_init(
+    mptest_sym_build* build_out, const char* file, int line, const char* msg);
+MN_API int mptest__sym_snapshot_check(
+    const char* path, const char* file, int line, const char* msg);
+MN_API void
+mptest__sym_set_update_snapshots(struct mptest__state* state, int update);
 
 #define MPTEST__SYM_NONE (-1)
 
 #define ASSERT_SYMEQm(type, in_var, chexpr, msg)                               \
   do {                                                                         \
     mptest_sym_build temp_build;                                               \
+    int temp_res;                                                              \
     if (mptest__sym_check_init(                                                \
             &temp_build, chexpr, __FILE__, __LINE__, msg)) {                   \
       return MPTEST__RESULT_ERROR;                                             \
@@ -405,8 +721,8 @@ MN_API void mptest__sym_make_destroy(mptest_sym_build* build_out);
     if (type##_to_sym(&temp_build, in_var)) {                                  \
       return MPTEST__RESULT_ERROR;                                             \
     }                                                                          \
-    if (mptest__sym_check(__FILE__, __LINE__, msg)) {                          \
-      return MPTEST__RESULT_FAIL;                                              \
+    if ((temp_res = mptest__sym_check(__FILE__, __LINE__, msg))) {             \
+      return temp_res < 0 ? MPTEST__RESULT_ERROR : MPTEST__RESULT_FAIL;        \
     }                                                                          \
     mptest__sym_check_destroy();                                               \
   } while (0);
@@ -414,6 +730,34 @@ MN_API void mptest__sym_make_destroy(mptest_sym_build* build_out);
 #define ASSERT_SYMEQ(type, var, chexpr)                                        \
   ASSERT_SYMEQm(type, var, chexpr, #chexpr)
 
+/* Compare the sym of `in_var` against the snapshot file at `path`, which is
+ * written instead when updating snapshots. A readable dump of the sym goes
+ * alongside it in `path`.txt. */
+#define ASSERT_SYM_SNAPSHOTm(type, in_var, path, msg)                          \
+  do {                                                                         \
+    mptest_sym_build temp_build;                                               \
+    int temp_res;                                                              \
+    if (mptest__sym_snapshot_init(&temp_build, __FILE__, __LINE__, msg)) {     \
+      return MPTEST__RESULT_ERROR;                                             \
+    }                                                                          \
+    if (type##_to_sym(&temp_build, in_var)) {                                  \
+      return MPTEST__RESULT_ERROR;                                             \
+    }                                                                          \
+    if ((temp_res = mptest__sym_snapshot_check(                                \
+             path, __FILE__, __LINE__, msg))) {                                \
+      return temp_res < 0 ? MPTEST__RESULT_ERROR : MPTEST__RESULT_FAIL;        \
+    }                                                                          \
+  } while (0);
+
+#define ASSERT_SYM_SNAPSHOT(type, var, path)                                   \
+  ASSERT_SYM_SNAPSHOTm(type, var, path, path)
+
+#define MPTEST_ENABLE_UPDATE_SNAPSHOTS()                                       \
+  mptest__sym_set_update_snapshots(&mptest__state_g, 1)
+
+#define MPTEST_DISABLE_UPDATE_SNAPSHOTS()                                      \
+  mptest__sym_set_update_snapshots(&mptest__state_g, 0)
+
 #define SYM_PUT_TYPE(build, type)                                              \
   do {                                                                         \
     int _sym_err;                                                              \
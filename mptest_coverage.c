@@ -0,0 +1,464 @@
+#include "mptest_internal.h"
+
+#if MPTEST_USE_COVERAGE
+
+/* Number of guards numbered by __sanitizer_cov_trace_pc_guard_init(). Guards
+ * are numbered from 1, a guard of 0 is disabled. Guards are set up by
+ * constructors before main(), so this can't live in the state. */
+static mptest__coverage_guard mptest__coverage_guards = 0;
+/* Per-guard hit counts of the current run, or NULL when not fuzzing */
+static unsigned char* mptest__coverage_counters = NULL;
+static mptest__coverage_guard mptest__coverage_counters_size = 0;
+
+void __sanitizer_cov_trace_pc_guard_init(
+    mptest__coverage_guard* start, mptest__coverage_guard* stop)
+{
+  if (start == stop || *start) {
+    /* Already numbered */
+    return;
+  }
+  for (; start < stop; start++) {
+    *start = ++mptest__coverage_guards;
+  }
+}
+
+void __sanitizer_cov_trace_pc_guard(mptest__coverage_guard* guard)
+{
+  if (*guard < mptest__coverage_counters_size) {
+    mptest__coverage_counters[*guard]++;
+  }
+}
+
+MN_INTERNAL void mptest__coverage_init(struct mptest__state* state)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  cov->guided = 0;
+  cov->corpus_dir = NULL;
+  cov->corpus = NULL;
+  cov->corpus_size = 0;
+  cov->corpus_alloc = 0;
+  cov->corpus_next = 0;
+  cov->corpus_loaded = 0;
+  cov->virgin = NULL;
+  cov->edges = 0;
+  cov->corpus_found = 0;
+  cov->ran = 0;
+  cov->fail_path = NULL;
+}
+
+/* Free everything belonging to the current test. */
+MN_INTERNAL void mptest__coverage_end(struct mptest__state* state)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  int i;
+  for (i = 0; i < cov->corpus_size; i++) {
+    mptest__fuzz_tape_destroy(&cov->corpus[i]);
+  }
+  if (cov->corpus) {
+    MN_FREE(cov->corpus);
+  }
+  cov->corpus = NULL;
+  cov->corpus_size = 0;
+  cov->corpus_alloc = 0;
+  if (cov->virgin) {
+    MN_FREE(cov->virgin);
+  }
+  cov->virgin = NULL;
+  if (mptest__coverage_counters) {
+    MN_FREE(mptest__coverage_counters);
+  }
+  mptest__coverage_counters = NULL;
+  mptest__coverage_counters_size = 0;
+}
+
+MN_INTERNAL void mptest__coverage_destroy(struct mptest__state* state)
+{
+  mptest__coverage_end(state);
+  if (state->coverage_state.fail_path) {
+    MN_FREE(state->coverage_state.fail_path);
+    state->coverage_state.fail_path = NULL;
+  }
+}
+
+/* Build the path of corpus file `n` of the current test. Returns NULL if out
+ * of memory. */
+MN_INTERNAL char* mptest__coverage_path(struct mptest__state* state, int n)
+{
+  const char* dir = state->coverage_state.corpus_dir;
+  const char* name = state->current_test;
+  mn_size dir_len = 0, name_len = 0;
+  char* path;
+  while (dir[dir_len]) {
+    dir_len++;
+  }
+  while (name[name_len]) {
+    name_len++;
+  }
+  /* '/' + '-' + digits + NUL */
+  path = (char*)MN_MALLOC(dir_len + name_len + 24);
+  if (path == NULL) {
+    return NULL;
+  }
+  sprintf(path, "%s/%s-%i", dir, name, n);
+  return path;
+}
+
+/* Add a copy of `tape` to the in-memory corpus. Returns 1 if out of
+ * memory. */
+MN_INTERNAL int mptest__coverage_corpus_add(
+    struct mptest__state* state, const mptest__fuzz_tape* tape)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  if (cov->corpus_size == cov->corpus_alloc) {
+    int new_alloc = cov->corpus_alloc ? cov->corpus_alloc * 2 : 16;
+    mptest__fuzz_tape* new_corpus = (mptest__fuzz_tape*)MN_REALLOC(
+        cov->corpus, sizeof(mptest__fuzz_tape) * (mn_size)new_alloc);
+    if (new_corpus == NULL) {
+      return 1;
+    }
+    cov->corpus = new_corpus;
+    cov->corpus_alloc = new_alloc;
+  }
+  mptest__fuzz_tape_init(&cov->corpus[cov->corpus_size]);
+  if (mptest__fuzz_tape_copy(&cov->corpus[cov->corpus_size], tape)) {
+    mptest__fuzz_tape_destroy(&cov->corpus[cov->corpus_size]);
+    return 1;
+  }
+  cov->corpus_size++;
+  return 0;
+}
+
+/* Load `<dir>/<test>-0`, `<dir>/<test>-1`, ... until one is missing. Each
+ * file holds a tape of hexadecimal words, one per line. Returns 1 if out of
+ * memory. */
+MN_INTERNAL int mptest__coverage_corpus_load(struct mptest__state* state)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  mptest__fuzz_tape tape;
+  int err = 0;
+  mptest__fuzz_tape_init(&tape);
+  while (!err) {
+    unsigned long word;
+    FILE* f;
+    char* path = mptest__coverage_path(state, cov->corpus_next);
+    if (path == NULL) {
+      err = 1;
+      break;
+    }
+    f = fopen(path, "r");
+    MN_FREE(path);
+    if (f == NULL) {
+      break;
+    }
+    tape.size = 0;
+    while (!err && fscanf(f, "%lx", &word) == 1) {
+      err = mptest__fuzz_tape_push(&tape, word & 0xFFFFFFFFUL);
+    }
+    fclose(f);
+    err = err || mptest__coverage_corpus_add(state, &tape);
+    cov->corpus_next++;
+    cov->corpus_loaded++;
+  }
+  mptest__fuzz_tape_destroy(&tape);
+  return err;
+}
+
+/* Write `tape` to the next free corpus file, returning its path (owned by the
+ * caller), or NULL if it couldn't be written. */
+MN_INTERNAL char* mptest__coverage_corpus_save(
+    struct mptest__state* state, const mptest__fuzz_tape* tape)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  FILE* f;
+  int i;
+  char* path;
+  if (cov->corpus_dir == NULL ||
+      (path = mptest__coverage_path(state, cov->corpus_next)) == NULL) {
+    return NULL;
+  }
+  if ((f = fopen(path, "w")) == NULL) {
+    MN_FREE(path);
+    return NULL;
+  }
+  for (i = 0; i < tape->size; i++) {
+    fprintf(f, "%08lX\n", tape->words[i]);
+  }
+  if (fclose(f)) {
+    MN_FREE(path);
+    return NULL;
+  }
+  cov->corpus_next++;
+  return path;
+}
+
+/* Map a hit count to its AFL-style bucket bit, so that loops running a few
+ * more times count as new behavior but don't flood the corpus. */
+MN_INTERNAL unsigned char mptest__coverage_bucket(unsigned char hits)
+{
+  if (hits <= 3) {
+    return (unsigned char)(1 << (hits - 1));
+  } else if (hits <= 7) {
+    return 8;
+  } else if (hits <= 15) {
+    return 16;
+  } else if (hits <= 31) {
+    return 32;
+  } else if (hits <= 127) {
+    return 64;
+  }
+  return 128;
+}
+
+/* Fold the counters of the last run into the map of seen behavior, clearing
+ * them. Returns 1 if the run did something new. */
+MN_INTERNAL int mptest__coverage_update(struct mptest__state* state)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  mptest__coverage_guard g;
+  int is_new = 0;
+  /* Guard 0 is shared by disabled guards */
+  for (g = 1; g < mptest__coverage_counters_size; g++) {
+    unsigned char hits = mptest__coverage_counters[g];
+    unsigned char bucket;
+    if (!hits) {
+      continue;
+    }
+    mptest__coverage_counters[g] = 0;
+    bucket = mptest__coverage_bucket(hits);
+    if (!(cov->virgin[g] & bucket)) {
+      if (!cov->virgin[g]) {
+        cov->edges++;
+      }
+      cov->virgin[g] |= bucket;
+      is_new = 1;
+    }
+  }
+  return is_new;
+}
+
+/* Apply a few random mutations to the current tape. Returns 1 if out of
+ * memory. */
+MN_INTERNAL int mptest__coverage_mutate(struct mptest__state* state)
+{
+  static const mptest_rand interesting[] = {
+      0, 1, 2, 0x7F, 0x80, 0xFF, 0x7FFFFFFFUL, 0x80000000UL, 0xFFFFFFFFUL};
+  mptest__coverage_state* cov = &state->coverage_state;
+  mptest__fuzz_tape* tape = &state->fuzz_state.tape;
+  mptest_rand* ms = cov->mutate_state;
+  int count = 1 + (int)(mptest__fuzz_next(ms) % 4);
+  while (count--) {
+    int op = (int)(mptest__fuzz_next(ms) % 7);
+    int at = tape->size ? (int)(mptest__fuzz_next(ms) % (mptest_rand)tape->size)
+                        : 0;
+    if (tape->size == 0 && op < 5) {
+      /* Nothing to change, later random numbers will be fresh anyway */
+      continue;
+    }
+    if (op == 0) {
+      /* Replace a word */
+      tape->words[at] = mptest__fuzz_next(ms);
+    } else if (op == 1) {
+      /* Flip a bit */
+      tape->words[at] ^= 1UL << (mptest__fuzz_next(ms) % 32);
+    } else if (op == 2) {
+      /* Nudge a word up or down */
+      mptest_rand delta = 1 + mptest__fuzz_next(ms) % 16;
+      tape->words[at] = (mptest__fuzz_next(ms) & 1 ? tape->words[at] + delta
+                                                   : tape->words[at] - delta) &
+                        0xFFFFFFFFUL;
+    } else if (op == 3) {
+      /* Use an edge-case value */
+      tape->words[at] =
+          interesting[mptest__fuzz_next(ms) %
+                      (sizeof(interesting) / sizeof(interesting[0]))];
+    } else if (op == 4) {
+      /* Truncate, so the rest of the run uses fresh numbers */
+      tape->size = at;
+    } else if (op == 5) {
+      /* Splice in the tail of another input */
+      const mptest__fuzz_tape* other =
+          &cov->corpus[mptest__fuzz_next(ms) % (mptest_rand)cov->corpus_size];
+      int i;
+      tape->size = at;
+      for (i = at; i < other->size; i++) {
+        if (mptest__fuzz_tape_push(tape, other->words[i])) {
+          return 1;
+        }
+      }
+    } else {
+      /* Insert a word */
+      int i;
+      if (mptest__fuzz_tape_push(tape, 0)) {
+        return 1;
+      }
+      for (i = tape->size - 1; i > at; i--) {
+        tape->words[i] = tape->words[i - 1];
+      }
+      tape->words[at] = mptest__fuzz_next(ms);
+    }
+  }
+  return 0;
+}
+
+/* Run `test_func` once on the current tape, returning whether it reached new
+ * coverage in `is_new`. */
+MN_INTERNAL mptest__result mptest__coverage_run_tape(
+    struct mptest__state* state, mptest__test_func test_func, int iteration,
+    int* is_new)
+{
+  mptest__result res = mptest__fuzz_run_tape(
+      state, test_func, iteration, MPTEST__FUZZ_TAPE_RECORD);
+  *is_new = mptest__coverage_update(state);
+  return res;
+}
+
+/* Allocate the counters and the map of seen behavior for a test. Returns 1 if
+ * out of memory. */
+MN_INTERNAL int mptest__coverage_begin(struct mptest__state* state)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  mn_size size = (mn_size)mptest__coverage_guards + 1;
+  mn_size i;
+  cov->edges = 0;
+  cov->corpus_found = 0;
+  cov->corpus_next = 0;
+  cov->corpus_loaded = 0;
+  cov->ran = 1;
+  if (cov->fail_path) {
+    MN_FREE(cov->fail_path);
+    cov->fail_path = NULL;
+  }
+  mptest__fuzz_seed_words(cov->mutate_state, state->fuzz_state.test_seed);
+  if ((cov->virgin = (unsigned char*)MN_MALLOC(size)) == NULL ||
+      (mptest__coverage_counters = (unsigned char*)MN_MALLOC(size)) == NULL) {
+    return 1;
+  }
+  for (i = 0; i < size; i++) {
+    cov->virgin[i] = 0;
+    mptest__coverage_counters[i] = 0;
+  }
+  mptest__coverage_counters_size = (mptest__coverage_guard)size;
+  return 0;
+}
+
+/* Pick a corpus input and mutate a copy of it into the current tape. Returns
+ * 1 if out of memory. */
+MN_INTERNAL int mptest__coverage_next_input(struct mptest__state* state)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  mptest__fuzz_tape* tape = &state->fuzz_state.tape;
+  if (!cov->corpus_size) {
+    tape->size = 0;
+    return 0;
+  }
+  return mptest__fuzz_tape_copy(
+             tape, &cov->corpus
+                        [mptest__fuzz_next(cov->mutate_state) %
+                         (mptest_rand)cov->corpus_size]) ||
+         mptest__coverage_mutate(state);
+}
+
+/* Coverage-guided replacement for the fuzz loop. The corpus is replayed
+ * first, then each iteration mutates a corpus input and keeps the result if it
+ * reached new coverage. */
+MN_INTERNAL mptest__result mptest__coverage_run_test(
+    struct mptest__state* state, mptest__test_func test_func, int iters)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  mptest__fuzz_tape* tape = &fuzz_state->tape;
+  mptest__result res = MPTEST__RESULT_PASS;
+  int run = 0, is_new, nomem, replayed;
+  nomem = mptest__coverage_begin(state) ||
+          (cov->corpus_dir && mptest__coverage_corpus_load(state));
+  replayed = cov->corpus_size;
+  while (!nomem && run - replayed < iters) {
+    if (run < replayed) {
+      /* Replay the corpus, to learn its coverage and catch regressions */
+      nomem = mptest__fuzz_tape_copy(tape, &cov->corpus[run]);
+    } else {
+      nomem = mptest__coverage_next_input(state);
+    }
+    if (nomem) {
+      break;
+    }
+    res = mptest__coverage_run_tape(state, test_func, run, &is_new);
+    if (res != MPTEST__RESULT_PASS) {
+      break;
+    }
+    if (run >= replayed && (is_new || !cov->corpus_size)) {
+      char* path;
+      nomem = mptest__coverage_corpus_add(state, tape);
+      if ((path = mptest__coverage_corpus_save(state, tape))) {
+        MN_FREE(path);
+      }
+      cov->corpus_found++;
+    }
+    run++;
+    if (mptest__fuzz_tick(state, 1)) {
+      break;
+    }
+  }
+  if (nomem) {
+    state->fail_reason = MPTEST__FAIL_REASON_NOMEM;
+    state->fail_msg = "coverage-guided fuzzing";
+    res = MPTEST__RESULT_ERROR;
+  } else if (res != MPTEST__RESULT_PASS) {
+    fuzz_state->fuzz_fail_iteration = run;
+    fuzz_state->fuzz_fail_seed = mptest__fuzz_iteration_seed(state, run);
+    fuzz_state->fuzz_failed = 1;
+    res = mptest__fuzz_shrink(state, test_func, run, res);
+    if (run >= replayed) {
+      /* A new failure, keep it so that the next run replays it first */
+      cov->fail_path = mptest__coverage_corpus_save(state, tape);
+    }
+  }
+  mptest__coverage_end(state);
+  return res;
+}
+
+MN_INTERNAL void
+mptest__coverage_report_test(struct mptest__state* state, mptest__result res)
+{
+  mptest__coverage_state* cov = &state->coverage_state;
+  if (!cov->ran) {
+    return;
+  }
+  cov->ran = 0;
+  if (res == MPTEST__RESULT_SKIPPED) {
+    return;
+  }
+  if (cov->fail_path) {
+    mptest__state_print_indent(state);
+    printf(
+        "    ...input saved to " MPTEST__COLOR_EMPHASIS "%s" MPTEST__COLOR_RESET
+        "\n",
+        cov->fail_path);
+    MN_FREE(cov->fail_path);
+    cov->fail_path = NULL;
+  }
+  mptest__state_print_indent(state);
+  printf(
+      "    ...covered " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+      " of %u edges, loaded " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+      " corpus inputs and found " MPTEST__COLOR_EMPHASIS
+      "%i" MPTEST__COLOR_RESET "\n",
+      cov->edges, mptest__coverage_guards, cov->corpus_loaded,
+      cov->corpus_found);
+}
+
+MN_API void mptest__coverage_set_guided(struct mptest__state* state, int on)
+{
+  state->coverage_state.guided = on;
+}
+
+MN_API void
+mptest__coverage_set_corpus(struct mptest__state* state, const char* dir)
+{
+  state->coverage_state.corpus_dir = dir;
+  if (dir) {
+    state->coverage_state.guided = 1;
+  }
+}
+
+#endif
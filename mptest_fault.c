@@ -0,0 +1,993 @@
+#include "mptest_internal.h"
+
+#include <time.h>
+
+/* Initialize fault checking state. */
+MN_INTERNAL void mptest__fault_init(struct mptest__state* state)
+{
+  state->fault_checking = MPTEST__FAULT_MODE_OFF;
+  state->fault_class_filter = NULL;
+  state->fault_class_filter_len = 0;
+  state->fault_site_limit = 0;
+  state->fault_site_count = 0;
+  state->fault_points = 0;
+  state->fault_points_swept = 0;
+  state->fault_pairs = 0;
+  state->fault_pairs_swept = 0;
+  state->fault_sample = 0;
+  state->fault_budget = 0;
+  state->fault_seed = (unsigned long)time(NULL) & 0xFFFFFFFF;
+  state->fault_rand_state = 0;
+  state->fault_tried_count = 0;
+  state->fault_swept = 0;
+  state->fault_active = 0;
+  state->fault_index_count = 0;
+#if MPTEST_USE_DYN_ALLOC
+  state->fault_replay = NULL;
+  state->fault_replay_buf = NULL;
+#endif
+  state->fault_record = NULL;
+  mptest__fault_reset(state);
+}
+
+#if MPTEST_USE_DYN_ALLOC
+MN_INTERNAL void mptest__fault_replay_destroy(struct mptest__state* state)
+{
+  while (state->fault_replay) {
+    mptest__fault_entry* next = state->fault_replay->next;
+    MN_FREE(state->fault_replay);
+    state->fault_replay = next;
+  }
+  if (state->fault_replay_buf) {
+    MN_FREE(state->fault_replay_buf);
+    state->fault_replay_buf = NULL;
+  }
+}
+#endif
+
+/* Destroy fault checking state. */
+MN_INTERNAL void mptest__fault_destroy(struct mptest__state* state)
+{
+#if MPTEST_USE_DYN_ALLOC
+  mptest__fault_replay_destroy(state);
+#endif
+  if (state->fault_record) {
+    fclose(state->fault_record);
+    state->fault_record = NULL;
+  }
+}
+
+/* Reset the fault counters before a test run. */
+MN_INTERNAL void mptest__fault_reset(struct mptest__state* state)
+{
+  int i;
+  state->fault_calls = 0;
+  state->fault_failed = 0;
+  state->fault_target_count = 0;
+  state->fault_class_count = 0;
+  state->fault_site_last = 0;
+  /* Sites are kept for the whole test, only their counters are reset */
+  for (i = 0; i < state->fault_site_count; i++) {
+    state->fault_sites[i].calls = 0;
+    state->fault_sites[i].first_after = -1;
+  }
+}
+
+/* Forget the call sites of the previous test. */
+MN_INTERNAL void mptest__fault_reset_sites(struct mptest__state* state)
+{
+  state->fault_site_count = 0;
+  state->fault_points = 0;
+  state->fault_points_swept = 0;
+  state->fault_pairs_swept = 0;
+  state->fault_tried_count = 0;
+  state->fault_swept = 0;
+}
+
+/* Determine if fault points are sampled instead of swept exhaustively. */
+MN_INTERNAL int mptest__fault_sampling(struct mptest__state* state)
+{
+  return state->fault_sample || state->fault_budget;
+}
+
+/* Determine if fault points are tracked by call site. */
+MN_INTERNAL int mptest__fault_by_site(struct mptest__state* state)
+{
+  return state->fault_site_limit || state->fault_pairs ||
+         mptest__fault_sampling(state);
+}
+
+/* Generate a random number for sampled sweeps (xorshift32). */
+MN_INTERNAL unsigned long mptest__fault_rand(struct mptest__state* state)
+{
+  unsigned long x = state->fault_rand_state;
+  x ^= (x << 13) & 0xFFFFFFFF;
+  x ^= x >> 17;
+  x ^= (x << 5) & 0xFFFFFFFF;
+  return (state->fault_rand_state = x);
+}
+
+/* Generate a random number in [0, n). */
+MN_INTERNAL int mptest__fault_rand_below(struct mptest__state* state, int n)
+{
+  return (int)(mptest__fault_rand(state) % (unsigned long)n);
+}
+
+/* Compare two class names, which are usually the same string literal. */
+MN_INTERNAL int mptest__fault_class_eq(const char* a, const char* b)
+{
+  return a == b || mptest__streq(a, b);
+}
+
+/* Determine if faults should be injected into calls of class `class`. The
+ * filter is a comma-separated list of class names. */
+MN_INTERNAL int
+mptest__fault_class_selected(struct mptest__state* state, const char* class)
+{
+  const char* filter = state->fault_class_filter;
+  mn_size i = 0;
+  if (filter == NULL) {
+    return 1;
+  }
+  while (i < state->fault_class_filter_len) {
+    /* Match one entry of the list against `class` */
+    const char* name = class;
+    while (i < state->fault_class_filter_len && filter[i] != ',' &&
+           *name != '\0' && filter[i] == *name) {
+      i++;
+      name++;
+    }
+    if (*name == '\0' &&
+        (i == state->fault_class_filter_len || filter[i] == ',')) {
+      return 1;
+    }
+    /* Skip to the next entry */
+    while (i < state->fault_class_filter_len && filter[i] != ',') {
+      i++;
+    }
+    i++;
+  }
+  return 0;
+}
+
+/* Find the counter for `class`, adding it if this is its first call. Returns
+ * NULL if too many classes are in use, in which case faults are not injected
+ * into the class. */
+MN_INTERNAL mptest__fault_class*
+mptest__fault_class_get(struct mptest__state* state, const char* class)
+{
+  int i;
+  for (i = 0; i < state->fault_class_count; i++) {
+    if (mptest__fault_class_eq(state->fault_classes[i].name, class)) {
+      return &state->fault_classes[i];
+    }
+  }
+  if (state->fault_class_count == MPTEST__FAULT_CLASS_MAX) {
+    return NULL;
+  }
+  state->fault_classes[i].name = class;
+  state->fault_classes[i].calls = 0;
+  state->fault_class_count++;
+  return &state->fault_classes[i];
+}
+
+/* Determine if `site` is at `class`, `file` and `line`. */
+MN_INTERNAL int mptest__fault_site_eq(
+    mptest__fault_site* site, const char* class, const char* file, int line)
+{
+  if (site->line != line || !mptest__fault_class_eq(site->class, class)) {
+    return 0;
+  }
+  if (site->file == NULL || file == NULL) {
+    return site->file == file;
+  }
+  return mptest__fault_class_eq(site->file, file);
+}
+
+/* Find the call site at `file` and `line`, adding it if this is its first
+ * call. Returns NULL if too many sites are in use. */
+MN_INTERNAL mptest__fault_site* mptest__fault_site_get(
+    struct mptest__state* state, const char* class, const char* file,
+    int line)
+{
+  mptest__fault_site* site;
+  int i;
+  /* Calls from loops hit the same site repeatedly, so try that first */
+  if (state->fault_site_last < state->fault_site_count) {
+    site = &state->fault_sites[state->fault_site_last];
+    if (mptest__fault_site_eq(site, class, file, line)) {
+      return site;
+    }
+  }
+  for (i = 0; i < state->fault_site_count; i++) {
+    if (mptest__fault_site_eq(&state->fault_sites[i], class, file, line)) {
+      state->fault_site_last = i;
+      return &state->fault_sites[i];
+    }
+  }
+  if (state->fault_site_count == MPTEST__FAULT_SITE_MAX) {
+    return NULL;
+  }
+  site = &state->fault_sites[i];
+  site->class = class;
+  site->file = file;
+  site->line = line;
+  site->calls = 0;
+  site->total = 0;
+  site->first_after = -1;
+  state->fault_site_count++;
+  state->fault_site_last = i;
+  return site;
+}
+
+MN_INTERNAL void mptest__fault_target_init(
+    mptest__fault_target* target, const char* class, int site, int idx)
+{
+  target->class = class;
+  target->site = site;
+  target->idx = idx;
+  target->hit_class = NULL;
+  target->hit_idx = -1;
+}
+
+/* Find the target matching the next call of `fault_class` at `site`. */
+MN_INTERNAL mptest__fault_target* mptest__fault_target_find(
+    struct mptest__state* state, mptest__fault_class* fault_class,
+    mptest__fault_site* site)
+{
+  int i;
+  for (i = 0; i < state->fault_target_count; i++) {
+    mptest__fault_target* target = &state->fault_targets[i];
+    if (target->class == NULL) {
+      if (state->fault_calls == target->idx) {
+        return target;
+      }
+    } else if (target->site != -1) {
+      if (site == &state->fault_sites[target->site] &&
+          site->calls == target->idx) {
+        return target;
+      }
+    } else if (
+        fault_class->calls == target->idx &&
+        mptest__fault_class_eq(target->class, fault_class->name)) {
+      return target;
+    }
+  }
+  return NULL;
+}
+
+/* Determine if a fault was simulated earlier in the current run. */
+MN_INTERNAL int mptest__fault_hit(struct mptest__state* state)
+{
+  int i;
+  for (i = 0; i < state->fault_target_count; i++) {
+    if (state->fault_targets[i].hit_idx != -1) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Determine if a call of `fault_class` was failed earlier in the current run.
+ */
+MN_INTERNAL int mptest__fault_class_hit(
+    struct mptest__state* state, mptest__fault_class* fault_class)
+{
+  int i;
+  for (i = 0; i < state->fault_target_count; i++) {
+    mptest__fault_target* target = &state->fault_targets[i];
+    if (target->hit_idx != -1 &&
+        mptest__fault_class_eq(target->hit_class, fault_class->name)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Count a call at `file` and `line` that may fail, returning 1 if a fault
+ * should be simulated. `file` may be NULL if the location is unknown, in which
+ * case all such calls of a class share one site. */
+MN_API int mptest__fault_at(
+    struct mptest__state* state, const char* class, const char* file,
+    int line)
+{
+  mptest__fault_class* fault_class;
+  mptest__fault_site* site = NULL;
+  mptest__fault_target* target = NULL;
+  if (!mptest__fault_class_selected(state, class) ||
+      (fault_class = mptest__fault_class_get(state, class)) == NULL) {
+    return 0;
+  }
+  if (mptest__fault_by_site(state) &&
+      (site = mptest__fault_site_get(state, class, file, line)) == NULL) {
+    return 0;
+  }
+  if (state->fault_checking != MPTEST__FAULT_MODE_OFF) {
+    target = mptest__fault_target_find(state, fault_class, site);
+  }
+  if (site && site->first_after == -1 && mptest__fault_hit(state)) {
+    /* Possibly part of the error path, remember it for pairwise sweeps */
+    site->first_after = site->calls;
+  }
+  if (target && target->hit_idx == -1) {
+    target->hit_class = fault_class->name;
+    target->hit_idx = fault_class->calls;
+  }
+  if (state->fault_checking == MPTEST__FAULT_MODE_SET &&
+      (target || mptest__fault_class_hit(state, fault_class))) {
+    /* Fail this call and all subsequent ones of its class, at any site, so
+     * that the recorded `class:index` replays the same run */
+    return 1;
+  }
+  fault_class->calls++;
+  state->fault_calls++;
+  if (site) {
+    site->calls++;
+  }
+  return target != NULL;
+}
+
+/* Count a call that may fail, returning 1 if a fault should be simulated. */
+MN_INTERNAL int mptest__fault(struct mptest__state* state, const char* class)
+{
+  return mptest__fault_at(state, class, NULL, 0);
+}
+
+MN_API int mptest_fault(const char* class)
+{
+  return mptest__fault(&mptest__state_g, class);
+}
+
+/* Run `test_func` once, failing the calls in `targets`. */
+MN_INTERNAL mptest__result mptest__fault_run_targets(
+    struct mptest__state* state, mptest__test_func test_func,
+    const mptest__fault_target* targets, int num_targets)
+{
+  int i;
+  mptest__fault_reset(state);
+  for (i = 0; i < num_targets; i++) {
+    state->fault_targets[i] = targets[i];
+    state->fault_targets[i].hit_class = NULL;
+    state->fault_targets[i].hit_idx = -1;
+  }
+  state->fault_target_count = num_targets;
+  return mptest__state_do_run_test(state, test_func);
+}
+
+/* After a run that failed a single call, fail that call again together with
+ * the first call made afterwards at each site. Those calls are likely part of
+ * the error path (e.g. cleanup) of the first failure. */
+MN_INTERNAL mptest__result mptest__fault_sweep_pairs(
+    struct mptest__state* state, mptest__test_func test_func)
+{
+  mptest__fault_target targets[2];
+  int after[MPTEST__FAULT_SITE_MAX];
+  int num_sites = state->fault_site_count;
+  int i;
+  mptest__result res = MPTEST__RESULT_PASS;
+  if (!state->fault_pairs || state->fault_targets[0].hit_idx == -1) {
+    return res;
+  }
+  targets[0] = state->fault_targets[0];
+  /* Counters are reset for each run, so keep the ones from this run */
+  for (i = 0; i < num_sites; i++) {
+    after[i] = state->fault_sites[i].first_after;
+  }
+  for (i = 0; i < num_sites; i++) {
+    if (after[i] == -1) {
+      continue;
+    }
+    mptest__fault_target_init(
+        &targets[1], state->fault_sites[i].class, i, after[i]);
+    state->fault_pairs_swept++;
+    res = mptest__fault_run_targets(state, test_func, targets, 2);
+    if (res != MPTEST__RESULT_PASS) {
+      return res;
+    }
+  }
+  return res;
+}
+
+/* Fail the runs of `test_func` one fault point at a time, with points
+ * grouped by class. */
+MN_INTERNAL mptest__result mptest__fault_sweep_classes(
+    struct mptest__state* state, mptest__test_func test_func)
+{
+  mptest__fault_class classes[MPTEST__FAULT_CLASS_MAX];
+  mptest__fault_target target;
+  int num_classes;
+  int i, j;
+  mptest__result res = MPTEST__RESULT_PASS;
+  /* Counters are reset for each run, so keep the ones found initially */
+  num_classes = state->fault_class_count;
+  for (i = 0; i < num_classes; i++) {
+    classes[i] = state->fault_classes[i];
+    state->fault_points += classes[i].calls;
+  }
+  for (i = 0; i < num_classes; i++) {
+    for (j = 0; j < classes[i].calls; j++) {
+      mptest__fault_target_init(&target, classes[i].name, -1, j);
+      state->fault_points_swept++;
+      res = mptest__fault_run_targets(state, test_func, &target, 1);
+      if (res != MPTEST__RESULT_PASS ||
+          (res = mptest__fault_sweep_pairs(state, test_func))) {
+        return res;
+      }
+    }
+  }
+  return res;
+}
+
+/* Fail the runs of `test_func` at no more than `fault_site_limit` points of
+ * each call site. */
+MN_INTERNAL mptest__result mptest__fault_sweep_sites(
+    struct mptest__state* state, mptest__test_func test_func)
+{
+  /* Only sweep sites reached by the initial run */
+  int num_sites = state->fault_site_count;
+  mptest__fault_target target;
+  int i, j;
+  mptest__result res = MPTEST__RESULT_PASS;
+  for (i = 0; i < num_sites; i++) {
+    state->fault_sites[i].total = state->fault_sites[i].calls;
+    state->fault_points += state->fault_sites[i].calls;
+  }
+  for (i = 0; i < num_sites; i++) {
+    mptest__fault_site* site = &state->fault_sites[i];
+    for (j = 0; j < site->total && j < state->fault_site_limit; j++) {
+      mptest__fault_target_init(&target, site->class, i, j);
+      state->fault_points_swept++;
+      res = mptest__fault_run_targets(state, test_func, &target, 1);
+      if (res != MPTEST__RESULT_PASS ||
+          (res = mptest__fault_sweep_pairs(state, test_func))) {
+        return res;
+      }
+    }
+  }
+  return res;
+}
+
+/* Number of fault points at `site` that may be tried. */
+MN_INTERNAL int
+mptest__fault_site_points(struct mptest__state* state, mptest__fault_site* site)
+{
+  if (state->fault_site_limit && state->fault_site_limit < site->total) {
+    return state->fault_site_limit;
+  }
+  return site->total;
+}
+
+MN_INTERNAL int mptest__fault_gcd(int a, int b)
+{
+  while (b) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* Fail the runs of `test_func` at randomly chosen fault points. Sites are
+ * visited in rounds, in a new random order each round, trying one untried
+ * point per site. Points within a site are visited in a random permutation,
+ * stepping by a stride coprime with the number of calls at the site. */
+MN_INTERNAL mptest__result mptest__fault_sweep_sample(
+    struct mptest__state* state, mptest__test_func test_func)
+{
+  int order[MPTEST__FAULT_SITE_MAX];
+  mptest__fault_target target;
+  /* Only sweep sites reached by the initial run */
+  int num_sites = state->fault_site_count;
+  int i;
+  int left = 1;
+  double start = mptest__time_wall();
+  mptest__result res = MPTEST__RESULT_PASS;
+  state->fault_rand_state = state->fault_seed ? state->fault_seed : 1;
+  for (i = 0; i < num_sites; i++) {
+    mptest__fault_site* site = &state->fault_sites[i];
+    site->total = site->calls;
+    site->sample_tried = 0;
+    site->sample_next = mptest__fault_rand_below(state, site->total);
+    site->sample_stride = 1 + mptest__fault_rand_below(state, site->total);
+    while (mptest__fault_gcd(site->sample_stride, site->total) != 1) {
+      site->sample_stride = site->sample_stride % site->total + 1;
+    }
+    state->fault_points += mptest__fault_site_points(state, site);
+    order[i] = i;
+  }
+  while (left) {
+    left = 0;
+    /* Shuffle the sites (Fisher-Yates) */
+    for (i = num_sites - 1; i > 0; i--) {
+      int j = mptest__fault_rand_below(state, i + 1);
+      int tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+    for (i = 0; i < num_sites; i++) {
+      mptest__fault_site* site = &state->fault_sites[order[i]];
+      if (site->sample_tried == mptest__fault_site_points(state, site)) {
+        continue;
+      }
+      if ((state->fault_sample &&
+           state->fault_points_swept == state->fault_sample) ||
+          (state->fault_budget &&
+           mptest__time_wall() - start >= (double)state->fault_budget)) {
+        return res;
+      }
+      left = 1;
+      mptest__fault_target_init(
+          &target, site->class, order[i], site->sample_next);
+      site->sample_next = (site->sample_next + site->sample_stride) %
+                          site->total;
+      site->sample_tried++;
+      state->fault_points_swept++;
+      res = mptest__fault_run_targets(state, test_func, &target, 1);
+      if (state->fault_tried_count < MPTEST__FAULT_TRIED_MAX) {
+        mptest__fault_point* point =
+            &state->fault_tried[state->fault_tried_count++];
+        point->class = site->class;
+        point->idx = state->fault_targets[0].hit_idx;
+      }
+      if (res != MPTEST__RESULT_PASS ||
+          (res = mptest__fault_sweep_pairs(state, test_func))) {
+        return res;
+      }
+    }
+  }
+  return res;
+}
+
+/* Write the calls failed in the current run, in the format read by
+ * mptest__fault_parse_spec(). */
+MN_INTERNAL void mptest__fault_print_spec(struct mptest__state* state, FILE* f)
+{
+  int i;
+  int first = 1;
+  for (i = 0; i < state->fault_target_count; i++) {
+    mptest__fault_target* target = &state->fault_targets[i];
+    if (target->hit_idx == -1 && target->site != -1) {
+      /* Never reached, so it has no index among the calls of its class */
+      continue;
+    }
+    if (!first) {
+      fputc(',', f);
+    }
+    first = 0;
+    if (target->hit_idx != -1) {
+      fprintf(f, "%s:%i", target->hit_class, target->hit_idx);
+    } else if (target->class) {
+      fprintf(f, "%s:%i", target->class, target->idx);
+    } else {
+      fprintf(f, "%i", target->idx);
+    }
+  }
+}
+
+/* Append the failure found in the current run to the schedule file. */
+MN_INTERNAL void mptest__fault_record(struct mptest__state* state)
+{
+  if (state->fault_record == NULL) {
+    return;
+  }
+  fprintf(
+      state->fault_record, "%s %s ", state->current_test,
+      state->fault_checking == MPTEST__FAULT_MODE_SET ? "set" : "one");
+  mptest__fault_print_spec(state, state->fault_record);
+  fputc('\n', state->fault_record);
+  fflush(state->fault_record);
+}
+
+/* Run `test_func` once with fault checking mode `mode`, failing the calls in
+ * `targets`. */
+MN_INTERNAL mptest__result mptest__fault_run_scheduled(
+    struct mptest__state* state, mptest__test_func test_func,
+    const mptest__fault_target* targets, int num_targets, int mode)
+{
+  mptest__result res;
+  int fault_prev = state->fault_checking;
+  state->fault_checking = mode;
+  mptest__fault_reset_sites(state);
+  res = mptest__fault_run_targets(state, test_func, targets, num_targets);
+  state->fault_checking = fault_prev;
+  if (res != MPTEST__RESULT_PASS) {
+    state->fault_failed = 1;
+  }
+  return res;
+}
+
+#if MPTEST_USE_DYN_ALLOC
+/* Run every failure recorded for the current test. Tests without any are
+ * skipped. */
+MN_INTERNAL mptest__result mptest__fault_run_replay(
+    struct mptest__state* state, mptest__test_func test_func)
+{
+  mptest__fault_entry* entry;
+  mptest__result res = MPTEST__RESULT_SKIPPED;
+  for (entry = state->fault_replay; entry; entry = entry->next) {
+    if (!mptest__streq(entry->test_name, state->current_test)) {
+      continue;
+    }
+    res = mptest__fault_run_scheduled(
+        state, test_func, entry->targets, entry->target_count, entry->mode);
+    if (res != MPTEST__RESULT_PASS) {
+      break;
+    }
+  }
+  return res;
+}
+#endif
+
+/* Determine if tests should run fixed fault schedules instead of sweeps. */
+MN_INTERNAL int mptest__fault_scheduled(struct mptest__state* state)
+{
+#if MPTEST_USE_DYN_ALLOC
+  if (state->fault_replay) {
+    return 1;
+  }
+#endif
+  return state->fault_index_count != 0;
+}
+
+/* Run a test once to find its fault points, then once more for each of them,
+ * failing it. If a fault schedule was given, only run that instead. */
+MN_INTERNAL mptest__result
+mptest__fault_run_test(struct mptest__state* state, mptest__test_func test_func)
+{
+  mptest__result res = MPTEST__RESULT_PASS;
+  /* Suspend fault checking */
+  int fault_prev = state->fault_checking;
+#if MPTEST_USE_DYN_ALLOC
+  if (state->fault_replay) {
+    return mptest__fault_run_replay(state, test_func);
+  }
+#endif
+  if (state->fault_index_count) {
+    return mptest__fault_run_scheduled(
+        state, test_func, state->fault_index, state->fault_index_count,
+        fault_prev == MPTEST__FAULT_MODE_OFF ? MPTEST__FAULT_MODE_ONE
+                                             : fault_prev);
+  }
+  state->fault_checking = MPTEST__FAULT_MODE_OFF;
+  mptest__fault_reset(state);
+  mptest__fault_reset_sites(state);
+  res = mptest__state_do_run_test(state, test_func);
+  /* Reinstate fault checking */
+  state->fault_checking = fault_prev;
+  if (res != MPTEST__RESULT_PASS) {
+    /* Initial test failed. */
+    return res;
+  }
+  state->fault_swept = 1;
+  if (mptest__fault_sampling(state)) {
+    res = mptest__fault_sweep_sample(state, test_func);
+  } else if (state->fault_site_limit) {
+    res = mptest__fault_sweep_sites(state, test_func);
+  } else {
+    res = mptest__fault_sweep_classes(state, test_func);
+  }
+  if (res != MPTEST__RESULT_PASS) {
+    /* Save fail context */
+    state->fault_failed = 1;
+    mptest__fault_record(state);
+  }
+  return res;
+}
+
+/* Parse a comma-separated list of calls to fail into `targets`, each either
+ * `CLASS:INDEX` (the INDEXth call of class CLASS) or `INDEX` (the INDEXth call
+ * of any class). `text` is modified to terminate the class names. Returns 0 on
+ * success and 1 on a syntax error. */
+MN_INTERNAL int mptest__fault_parse_spec(
+    char* text, mptest__fault_target* targets, int* num_targets)
+{
+  *num_targets = 0;
+  while (1) {
+    const char* class = NULL;
+    char* token = text;
+    int idx = 0;
+    int digits = 0;
+    /* Find the end of the class name, if any */
+    while (*text && *text != ':' && *text != ',') {
+      text++;
+    }
+    if (*text == ':') {
+      *text++ = '\0';
+      class = token;
+    } else {
+      text = token;
+    }
+    for (; *text >= '0' && *text <= '9'; text++, digits++) {
+      idx = idx * 10 + (*text - '0');
+    }
+    if (!digits || (class && !*class) ||
+        *num_targets == MPTEST__FAULT_TARGET_MAX) {
+      return 1;
+    }
+    mptest__fault_target_init(&targets[(*num_targets)++], class, -1, idx);
+    if (*text == '\0') {
+      return 0;
+    } else if (*text != ',') {
+      return 1;
+    }
+    *text++ = '\0';
+  }
+}
+
+MN_API void mptest__fault_set(struct mptest__state* state, int on)
+{
+  state->fault_checking = on;
+}
+
+MN_API void
+mptest__fault_set_classes(struct mptest__state* state, const char* classes)
+{
+  mn_size len = 0;
+  state->fault_class_filter = classes;
+  if (classes) {
+    while (classes[len]) {
+      len++;
+    }
+  }
+  state->fault_class_filter_len = len;
+}
+
+MN_API void
+mptest__fault_set_site_limit(struct mptest__state* state, int limit)
+{
+  state->fault_site_limit = limit;
+}
+
+MN_API void mptest__fault_set_pairs(struct mptest__state* state, int on)
+{
+  state->fault_pairs = on;
+}
+
+MN_API void mptest__fault_set_sample(
+    struct mptest__state* state, int sample, int budget)
+{
+  state->fault_sample = sample;
+  state->fault_budget = budget;
+}
+
+MN_API void
+mptest__fault_set_seed(struct mptest__state* state, unsigned long seed)
+{
+  state->fault_seed = seed & 0xFFFFFFFF;
+}
+
+MN_API int
+mptest__fault_set_index(struct mptest__state* state, const char* spec)
+{
+  mn_size i;
+  state->fault_index_count = 0;
+  if (spec == NULL) {
+    return 0;
+  }
+  for (i = 0; spec[i]; i++) {
+    if (i == MPTEST__FAULT_SPEC_MAX - 1) {
+      return 1;
+    }
+    state->fault_index_spec[i] = spec[i];
+  }
+  state->fault_index_spec[i] = '\0';
+  if (mptest__fault_parse_spec(
+          state->fault_index_spec, state->fault_index,
+          &state->fault_index_count)) {
+    state->fault_index_count = 0;
+    return 1;
+  }
+  return 0;
+}
+
+#if MPTEST_USE_DYN_ALLOC
+/* Parse one line of a schedule file, `TEST MODE SPEC`, appending it to the
+ * failures to replay. Returns 0 on success, 1 on a syntax error and 2 if out
+ * of memory. */
+MN_INTERNAL int
+mptest__fault_parse_entry(char* line, mptest__fault_entry*** tail)
+{
+  char* fields[3];
+  int i;
+  mptest__fault_entry* entry;
+  for (i = 0; i < 3; i++) {
+    while (*line == ' ' || *line == '\t') {
+      line++;
+    }
+    fields[i] = line;
+    while (*line && *line != ' ' && *line != '\t') {
+      line++;
+    }
+    if (line == fields[i]) {
+      return 1;
+    }
+    if (*line) {
+      *line++ = '\0';
+    }
+  }
+  entry = (mptest__fault_entry*)MN_MALLOC(sizeof(mptest__fault_entry));
+  if (entry == NULL) {
+    return 2;
+  }
+  entry->test_name = fields[0];
+  entry->mode = mptest__streq(fields[1], "set") ? MPTEST__FAULT_MODE_SET
+                                                : MPTEST__FAULT_MODE_ONE;
+  entry->next = NULL;
+  **tail = entry;
+  *tail = &entry->next;
+  return mptest__fault_parse_spec(
+      fields[2], entry->targets, &entry->target_count);
+}
+
+MN_API int
+mptest__fault_replay_file(struct mptest__state* state, const char* path)
+{
+  FILE* file;
+  mptest__fault_entry** tail = &state->fault_replay;
+  mn_size size = 0;
+  mn_size capacity = 256;
+  char* line;
+  int err = 0;
+  mptest__fault_replay_destroy(state);
+  if (path == NULL) {
+    /* Stop replaying */
+    return 0;
+  }
+  if ((file = fopen(path, "rb")) == NULL) {
+    return 1;
+  }
+  if ((state->fault_replay_buf = (char*)MN_MALLOC(capacity)) == NULL) {
+    fclose(file);
+    return 2;
+  }
+  while (1) {
+    mn_size read;
+    if (size + 1 == capacity) {
+      char* buf = (char*)MN_REALLOC(state->fault_replay_buf, capacity * 2);
+      if (buf == NULL) {
+        fclose(file);
+        return 2;
+      }
+      state->fault_replay_buf = buf;
+      capacity *= 2;
+    }
+    read = fread(state->fault_replay_buf + size, 1, capacity - size - 1, file);
+    if (read == 0) {
+      break;
+    }
+    size += read;
+  }
+  fclose(file);
+  state->fault_replay_buf[size] = '\0';
+  line = state->fault_replay_buf;
+  while (*line && !err) {
+    char* end = line;
+    while (*end && *end != '\n') {
+      end++;
+    }
+    if (*end) {
+      *end++ = '\0';
+    }
+    if (end - line > 1 && end[-2] == '\r') {
+      end[-2] = '\0';
+    }
+    /* Skip blank lines and comments */
+    if (*line && *line != '#' && *line != '\r') {
+      err = mptest__fault_parse_entry(line, &tail);
+    }
+    line = end;
+  }
+  return err;
+}
+#endif
+
+MN_API int
+mptest__fault_record_file(struct mptest__state* state, const char* path)
+{
+  if (state->fault_record) {
+    fclose(state->fault_record);
+    state->fault_record = NULL;
+  }
+  if (path == NULL) {
+    /* Stop recording */
+    return 0;
+  }
+  state->fault_record = fopen(path, "w");
+  return state->fault_record == NULL;
+}
+
+/* Print the seed and the fault points tried by a sampled sweep. */
+MN_INTERNAL void mptest__fault_report_sample(struct mptest__state* state)
+{
+  int i;
+  mptest__state_print_indent(state);
+  printf(
+      "    ...sampled " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+      " of " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+      " fault points at " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+      " sites with seed " MPTEST__COLOR_EMPHASIS "%lu" MPTEST__COLOR_RESET
+      "\n",
+      state->fault_points_swept, state->fault_points, state->fault_site_count,
+      state->fault_seed);
+  if (!state->fault_tried_count) {
+    return;
+  }
+  mptest__state_print_indent(state);
+  printf("    ...tried");
+  for (i = 0; i < state->fault_tried_count; i++) {
+    if (state->fault_tried[i].idx == -1) {
+      printf(" %s:unreached", state->fault_tried[i].class);
+    } else {
+      printf(
+          " %s:%i", state->fault_tried[i].class, state->fault_tried[i].idx);
+    }
+  }
+  if (state->fault_points_swept > state->fault_tried_count) {
+    printf(
+        " (and %i more)",
+        state->fault_points_swept - state->fault_tried_count);
+  }
+  printf("\n");
+}
+
+/* Print the fault that was simulated when a test failed, and how many fault
+ * points were swept or sampled. */
+MN_INTERNAL void
+mptest__fault_report_test(struct mptest__state* state, mptest__result res)
+{
+  int swept =
+      state->fault_swept && (res == MPTEST__RESULT_PASS || state->fault_failed);
+  if (res == MPTEST__RESULT_SKIPPED) {
+    return;
+  }
+  if (res == MPTEST__RESULT_FAIL || res == MPTEST__RESULT_ERROR) {
+    int i;
+    for (i = 0; i < state->fault_target_count; i++) {
+      mptest__fault_target* target = &state->fault_targets[i];
+      if (target->hit_idx != -1) {
+        printf(
+            "    ...%s fault iteration " MPTEST__COLOR_EMPHASIS
+            "%i" MPTEST__COLOR_RESET " of class " MPTEST__COLOR_EMPHASIS
+            "%s" MPTEST__COLOR_RESET "\n",
+            i ? "and" : "at", target->hit_idx, target->hit_class);
+      } else {
+        printf(
+            "    ...%s fault iteration " MPTEST__COLOR_EMPHASIS
+            "%i" MPTEST__COLOR_RESET " (never reached)\n",
+            i ? "and" : "at", target->idx);
+      }
+      if (target->site != -1 && state->fault_sites[target->site].file) {
+        mptest__fault_site* site = &state->fault_sites[target->site];
+        printf("      ...from call site ");
+        mptest__print_source_location(site->file, site->line);
+        printf("\n");
+      }
+    }
+  }
+  if (state->fault_failed && state->fault_target_count &&
+      res != MPTEST__RESULT_PASS) {
+    mptest__state_print_indent(state);
+    printf("    ...replay with --fault-index " MPTEST__COLOR_EMPHASIS);
+    mptest__fault_print_spec(state, stdout);
+    printf(MPTEST__COLOR_RESET "\n");
+  }
+  if (swept && state->fault_pairs) {
+    mptest__state_print_indent(state);
+    printf(
+        "    ...swept " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+        " fault pairs\n",
+        state->fault_pairs_swept);
+  }
+  if (swept && mptest__fault_sampling(state)) {
+    mptest__fault_report_sample(state);
+  } else if (swept && state->fault_site_limit) {
+    mptest__state_print_indent(state);
+    printf(
+        "    ...swept " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+        " of " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+        " fault points at " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+        " sites\n",
+        state->fault_points_swept, state->fault_points,
+        state->fault_site_count);
+  }
+}
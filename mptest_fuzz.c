@@ -2,27 +2,505 @@
 
 #if MPTEST_USE_FUZZ
 
+#if MPTEST_USE_FORK
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define MPTEST__FUZZ_MASK 0xFFFFFFFFUL
+
+/* Rotate the 32-bit word `x` left by `k`. */
+#define MPTEST__FUZZ_ROTL(x, k)                                                \
+  ((((x) << (k)) | ((x) >> (32 - (k)))) & MPTEST__FUZZ_MASK)
+
 MN_INTERNAL void mptest__fuzz_init(struct mptest__state* state)
 {
   mptest__fuzz_state* fuzz_state = &state->fuzz_state;
-  fuzz_state->rand_state = 0xDEADBEEF;
+  fuzz_state->base_seed = 0xDEADBEEF;
+  fuzz_state->test_seed = 0;
+#if MPTEST_USE_FORK
+  fuzz_state->workers = 1;
+#endif
   fuzz_state->fuzz_active = 0;
   fuzz_state->fuzz_iterations = 1;
   fuzz_state->fuzz_fail_iteration = 0;
   fuzz_state->fuzz_fail_seed = 0;
+  fuzz_state->iterations_override = 0;
+  fuzz_state->time_budget = 0;
+  fuzz_state->until_failure = 0;
+  fuzz_state->last_time = 0;
+  fuzz_state->status_time = 0;
+  fuzz_state->execs = 0;
+  fuzz_state->exec_seconds = 0;
+  fuzz_state->status_len = 0;
+  fuzz_state->keep_going = 0;
+  fuzz_state->bucket_count = 0;
+  fuzz_state->failures = 0;
+  fuzz_state->draws = 0;
+  fuzz_state->input = NULL;
+  fuzz_state->input_size = 0;
+  fuzz_state->input_pos = 0;
+  fuzz_state->input_active = 0;
+  mptest__fuzz_seed(state, fuzz_state->base_seed);
+#if MPTEST_USE_DYN_ALLOC
+  mptest__fuzz_tape_init(&fuzz_state->tape);
+  fuzz_state->tape_pos = 0;
+  fuzz_state->tape_mode = MPTEST__FUZZ_TAPE_OFF;
+  fuzz_state->tape_shrunk = 0;
+  mptest__fuzz_tape_init(&fuzz_state->replay);
+  fuzz_state->replay_set = 0;
+#endif
 }
 
-MN_API mptest_rand mptest__fuzz_rand(struct mptest__state* state)
+MN_INTERNAL void mptest__fuzz_destroy(struct mptest__state* state)
+{
+#if MPTEST_USE_DYN_ALLOC
+  mptest__fuzz_tape_destroy(&state->fuzz_state.tape);
+  mptest__fuzz_tape_destroy(&state->fuzz_state.replay);
+#else
+  MN__UNUSED(state);
+#endif
+}
+
+/* Advance the splitmix32 sequence `x`, returning its next output. */
+MN_INTERNAL mptest_rand mptest__fuzz_splitmix(mptest_rand* x)
+{
+  mptest_rand z = (*x = (*x + 0x9E3779B9UL) & MPTEST__FUZZ_MASK);
+  z = ((z ^ (z >> 16)) * 0x21F0AAADUL) & MPTEST__FUZZ_MASK;
+  z = ((z ^ (z >> 15)) * 0x735A2D97UL) & MPTEST__FUZZ_MASK;
+  return z ^ (z >> 15);
+}
+
+/* Seed the xoshiro128** state `s` from `seed`. Generators seeded with
+ * different values produce independent streams. */
+MN_INTERNAL void mptest__fuzz_seed_words(mptest_rand* s, mptest_rand seed)
+{
+  mptest_rand x = seed & MPTEST__FUZZ_MASK;
+  int i;
+  for (i = 0; i < 4; i++) {
+    s[i] = mptest__fuzz_splitmix(&x);
+  }
+  if (!(s[0] | s[1] | s[2] | s[3])) {
+    /* The all-zero state is a fixed point */
+    s[0] = 1;
+  }
+}
+
+/* Restart the generator from `seed`. */
+MN_INTERNAL void
+mptest__fuzz_seed(struct mptest__state* state, mptest_rand seed)
+{
+  mptest__fuzz_seed_words(state->fuzz_state.rand_state, seed);
+  state->fuzz_state.draws = 0;
+}
+
+/* Derive the seed of the current test from its name, so that it doesn't
+ * depend on which tests ran before it. */
+MN_INTERNAL mptest_rand mptest__fuzz_test_seed(struct mptest__state* state)
+{
+  /* FNV-1a */
+  mptest_rand x = 0x811C9DC5UL;
+  const char* name = state->current_test ? state->current_test : "";
+  while (*name) {
+    x = ((x ^ (mptest_rand)(unsigned char)*(name++)) * 0x01000193UL) &
+        MPTEST__FUZZ_MASK;
+  }
+  x ^= state->fuzz_state.base_seed;
+  return mptest__fuzz_splitmix(&x);
+}
+
+/* Derive the seed of fuzz iteration `iteration` from the test seed alone, so
+ * iterations can run in any order or in parallel. */
+MN_INTERNAL mptest_rand
+mptest__fuzz_iteration_seed(struct mptest__state* state, int iteration)
+{
+  mptest_rand x = (state->fuzz_state.test_seed ^
+                   ((mptest_rand)iteration * 0x85EBCA6BUL)) &
+                  MPTEST__FUZZ_MASK;
+  return mptest__fuzz_splitmix(&x);
+}
+
+/* Advance the xoshiro128** (Blackman and Vigna) state `s`, returning its next
+ * output. Runs on 32-bit words since C89 lacks a 64-bit type. */
+MN_INTERNAL mptest_rand mptest__fuzz_next(mptest_rand* s)
+{
+  mptest_rand out = (MPTEST__FUZZ_ROTL((s[1] * 5) & MPTEST__FUZZ_MASK, 7) * 9) &
+                    MPTEST__FUZZ_MASK;
+  mptest_rand t = (s[1] << 9) & MPTEST__FUZZ_MASK;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = MPTEST__FUZZ_ROTL(s[3], 11);
+  return out;
+}
+
+#if MPTEST_USE_DYN_ALLOC
+MN_INTERNAL void mptest__fuzz_tape_init(mptest__fuzz_tape* tape)
+{
+  tape->words = NULL;
+  tape->size = 0;
+  tape->alloc = 0;
+}
+
+MN_INTERNAL void mptest__fuzz_tape_destroy(mptest__fuzz_tape* tape)
+{
+  if (tape->words) {
+    MN_FREE(tape->words);
+  }
+  mptest__fuzz_tape_init(tape);
+}
+
+/* Append `word` to `tape`. Returns 1 if out of memory. */
+MN_INTERNAL int
+mptest__fuzz_tape_push(mptest__fuzz_tape* tape, mptest_rand word)
+{
+  if (tape->size == tape->alloc) {
+    int new_alloc = tape->alloc ? tape->alloc * 2 : 16;
+    mptest_rand* new_words = (mptest_rand*)MN_REALLOC(
+        tape->words, sizeof(mptest_rand) * (mn_size)new_alloc);
+    if (new_words == NULL) {
+      return 1;
+    }
+    tape->words = new_words;
+    tape->alloc = new_alloc;
+  }
+  tape->words[tape->size++] = word;
+  return 0;
+}
+
+/* Make `dst` a copy of `src`. Returns 1 if out of memory. */
+MN_INTERNAL int
+mptest__fuzz_tape_copy(mptest__fuzz_tape* dst, const mptest__fuzz_tape* src)
+{
+  int i;
+  dst->size = 0;
+  for (i = 0; i < src->size; i++) {
+    if (mptest__fuzz_tape_push(dst, src->words[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Supply the next random number of a run from the tape. Past its end, a
+ * recorded tape is extended with fresh numbers and a replayed tape yields 0,
+ * the simplest choice. */
+MN_INTERNAL mptest_rand mptest__fuzz_tape_rand(struct mptest__state* state)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  mptest_rand word;
+  if (fuzz_state->tape_pos < fuzz_state->tape.size) {
+    return fuzz_state->tape.words[fuzz_state->tape_pos++];
+  } else if (fuzz_state->tape_mode == MPTEST__FUZZ_TAPE_REPLAY) {
+    return 0;
+  }
+  word = mptest__fuzz_next(fuzz_state->rand_state);
+  if (!mptest__fuzz_tape_push(&fuzz_state->tape, word)) {
+    fuzz_state->tape_pos++;
+  }
+  return word;
+}
+
+/* Run `test_func` once on the tape, in iteration `iteration`'s stream. The
+ * tape is cut down to the numbers the run used. */
+MN_INTERNAL mptest__result mptest__fuzz_run_tape(
+    struct mptest__state* state, mptest__test_func test_func, int iteration,
+    int mode)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  mptest__result res;
+  mptest__fuzz_seed(state, mptest__fuzz_iteration_seed(state, iteration));
+  fuzz_state->tape_pos = 0;
+  fuzz_state->tape_mode = mode;
+  res = mptest__state_do_run_test(state, test_func);
+  fuzz_state->tape_mode = MPTEST__FUZZ_TAPE_OFF;
+  if (fuzz_state->tape_pos < fuzz_state->tape.size) {
+    fuzz_state->tape.size = fuzz_state->tape_pos;
+  }
+  return res;
+}
+#endif
+
+#if MPTEST_USE_DYN_ALLOC
+/* Run the tape, returning 1 if it fails in the same way as the failure being
+ * shrunk: with result `res` at `file` and `line`. */
+MN_INTERNAL int mptest__fuzz_shrink_try(
+    struct mptest__state* state, mptest__test_func test_func, int iteration,
+    mptest__result res, const char* file, int line)
+{
+  return mptest__fuzz_run_tape(
+             state, test_func, iteration, MPTEST__FUZZ_TAPE_REPLAY) == res &&
+         state->fail_line == line &&
+         (state->fail_file == file ||
+          (file && state->fail_file && mptest__streq(state->fail_file, file)));
+}
+
+/* Shrink the failing tape of iteration `iteration`, which failed with `res`,
+ * by deleting spans of numbers and lowering the rest while the test keeps
+ * failing the same way. The test is left in the state of a run of the
+ * smallest tape. */
+MN_INTERNAL mptest__result mptest__fuzz_shrink(
+    struct mptest__state* state, mptest__test_func test_func, int iteration,
+    mptest__result res)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  mptest__fuzz_tape* tape = &fuzz_state->tape;
+  mptest__fuzz_tape best;
+  const char* file = state->fail_file;
+  int line = state->fail_line;
+  int runs = 0, progress = 1, last_failed = 1;
+  int i, j, span;
+  mptest__fuzz_tape_init(&best);
+  if (mptest__fuzz_tape_copy(&best, tape)) {
+    return res;
+  }
+  while (progress && runs < MPTEST__FUZZ_SHRINK_RUNS) {
+    progress = 0;
+    /* Delete spans of numbers, largest first */
+    for (span = 8; span; span /= 2) {
+      for (i = 0; i + span <= best.size && runs < MPTEST__FUZZ_SHRINK_RUNS;) {
+        if (mptest__fuzz_tape_copy(tape, &best)) {
+          break;
+        }
+        for (j = i; j + span < tape->size; j++) {
+          tape->words[j] = tape->words[j + span];
+        }
+        tape->size -= span;
+        runs++;
+        if ((last_failed = mptest__fuzz_shrink_try(
+                 state, test_func, iteration, res, file, line)) &&
+            !mptest__fuzz_tape_copy(&best, tape)) {
+          progress = 1;
+        } else {
+          i++;
+        }
+      }
+    }
+    for (i = 0; i < best.size && runs < MPTEST__FUZZ_SHRINK_RUNS; i++) {
+      mptest_rand lo = 0, hi, mask;
+      /* Keep only the low bits first, which preserves the result of a
+       * power-of-two bound that a smaller number wouldn't */
+      for (mask = 0xF; mask < best.words[i] && mask < MPTEST__FUZZ_MASK;
+           mask = (mask << 4) | 0xF) {
+        if (mptest__fuzz_tape_copy(tape, &best)) {
+          break;
+        }
+        tape->words[i] &= mask;
+        runs++;
+        if ((last_failed = mptest__fuzz_shrink_try(
+                 state, test_func, iteration, res, file, line))) {
+          best.words[i] = tape->words[i];
+          progress = 1;
+          break;
+        }
+      }
+      /* Then lower it by binary search, keeping the lowest failing number */
+      hi = best.words[i];
+      while (lo < hi && runs < MPTEST__FUZZ_SHRINK_RUNS) {
+        mptest_rand mid = lo + (hi - lo) / 2;
+        if (mptest__fuzz_tape_copy(tape, &best)) {
+          break;
+        }
+        tape->words[i] = mid;
+        runs++;
+        if ((last_failed = mptest__fuzz_shrink_try(
+                 state, test_func, iteration, res, file, line))) {
+          hi = mid;
+        } else {
+          lo = mid + 1;
+        }
+      }
+      if (hi != best.words[i]) {
+        best.words[i] = hi;
+        progress = 1;
+      }
+    }
+  }
+  /* Leave the tape and the test state as of a run of the smallest tape */
+  if (!mptest__fuzz_tape_copy(tape, &best) && !last_failed) {
+    res = mptest__fuzz_run_tape(
+        state, test_func, iteration, MPTEST__FUZZ_TAPE_REPLAY);
+  }
+  fuzz_state->tape_shrunk = 1;
+  mptest__fuzz_tape_destroy(&best);
+  return res;
+}
+#endif
+
+/* Take the next `bytes` bytes of the fuzzer-supplied input as a little-endian
+ * number. Past its end, the bytes are 0. */
+MN_INTERNAL mptest_rand
+mptest__fuzz_input_take(struct mptest__state* state, int bytes)
 {
-  /* ANSI C LCG (wikipedia) */
-  static const mptest_rand a = 1103515245;
-  static const mptest_rand m = ((mptest_rand)1) << 31;
-  static const mptest_rand c = 12345;
   mptest__fuzz_state* fuzz_state = &state->fuzz_state;
-  return (
-      fuzz_state->rand_state =
-          ((a * fuzz_state->rand_state + c) % m) & 0xFFFFFFFF);
+  mptest_rand r = 0;
+  int i;
+  for (i = 0; i < bytes; i++) {
+    if (fuzz_state->input_pos < fuzz_state->input_size) {
+      r |= (mptest_rand)fuzz_state->input[fuzz_state->input_pos++] << (8 * i);
+    }
+  }
+  return r;
+}
+
+MN_API mptest_rand mptest__fuzz_rand(struct mptest__state* state)
+{
+  state->fuzz_state.draws++;
+  if (state->fuzz_state.input_active) {
+    return mptest__fuzz_input_take(state, 4);
+  }
+#if MPTEST_USE_DYN_ALLOC
+  if (state->fuzz_state.tape_mode != MPTEST__FUZZ_TAPE_OFF) {
+    return mptest__fuzz_tape_rand(state);
+  }
+#endif
+  return mptest__fuzz_next(state->fuzz_state.rand_state);
+}
+
+/* Return a uniformly distributed number in [0, `bound`), rejecting the high
+ * outputs that would bias a plain modulo. Small outputs are never rejected, so
+ * lowering numbers on a tape lowers the results. A `bound` of 0 means no
+ * bound. Bounds above 2^32 (where unsigned long is 64 bits wide) combine two
+ * draws, high half first. */
+MN_API mptest_rand
+mptest__fuzz_rand_bounded(struct mptest__state* state, mptest_rand bound)
+{
+  mptest_rand max = MPTEST__FUZZ_MASK, limit, r;
+  int wide = bound - 1 > MPTEST__FUZZ_MASK;
+  if (bound == 0) {
+    return mptest__fuzz_rand(state);
+  } else if (state->fuzz_state.input_active) {
+    /* Take only as many bytes as the bound needs, so the engine's mutations
+     * of one byte map to one number */
+    int bytes = 1;
+    while (bytes < (int)sizeof(mptest_rand) && ((bound - 1) >> (8 * bytes))) {
+      bytes++;
+    }
+    return mptest__fuzz_input_take(state, bytes) % bound;
+  }
+  if (wide) {
+    max = ~(mptest_rand)0;
+  }
+  /* Last output before the final, partial run of `bound` outputs:
+   * max - ((max + 1) % bound) */
+  limit = max - ((max - bound) + 1) % bound;
+  do {
+    r = mptest__fuzz_rand(state);
+    if (wide) {
+      /* Shift in two steps, as a single shift by 32 is undefined where
+       * unsigned long is 32 bits (though this branch is unreachable there) */
+      r = (r << 16 << 16) | mptest__fuzz_rand(state);
+    }
+  } while (r > limit);
+  return r % bound;
+}
+
+/* Fill `buf` with `size` random bytes. The generator state is kept in locals
+ * so the loop runs out of registers, emitting four bytes per step. */
+MN_API void
+mptest__fuzz_fill(struct mptest__state* state, void* buf, mn_size size)
+{
+  mptest_rand* st = state->fuzz_state.rand_state;
+  mptest_rand s0 = st[0], s1 = st[1], s2 = st[2], s3 = st[3];
+  unsigned char* out = (unsigned char*)buf;
+  state->fuzz_state.draws += (int)((size + 3) / 4);
+  if (state->fuzz_state.input_active) {
+    mn_size i;
+    for (i = 0; i < size; i++) {
+      out[i] = (unsigned char)mptest__fuzz_input_take(state, 1);
+    }
+    return;
+  }
+#if MPTEST_USE_DYN_ALLOC
+  if (state->fuzz_state.tape_mode != MPTEST__FUZZ_TAPE_OFF) {
+    /* Bytes must come from the tape, so they can be mutated and replayed */
+    mn_size i;
+    mptest_rand r = 0;
+    for (i = 0; i < size; i++, r >>= 8) {
+      if (i % 4 == 0) {
+        r = mptest__fuzz_tape_rand(state);
+      }
+      out[i] = (unsigned char)(r & 0xFF);
+    }
+    return;
+  }
+#endif
+  while (size) {
+    mptest_rand r = (MPTEST__FUZZ_ROTL((s1 * 5) & MPTEST__FUZZ_MASK, 7) * 9) &
+                    MPTEST__FUZZ_MASK;
+    mptest_rand t = (s1 << 9) & MPTEST__FUZZ_MASK;
+    s2 ^= s0;
+    s3 ^= s1;
+    s1 ^= s2;
+    s0 ^= s3;
+    s2 ^= t;
+    s3 = MPTEST__FUZZ_ROTL(s3, 11);
+    if (size >= 4) {
+      out[0] = (unsigned char)(r & 0xFF);
+      out[1] = (unsigned char)((r >> 8) & 0xFF);
+      out[2] = (unsigned char)((r >> 16) & 0xFF);
+      out[3] = (unsigned char)((r >> 24) & 0xFF);
+      out += 4;
+      size -= 4;
+    } else {
+      for (; size; size--, r >>= 8) {
+        *(out++) = (unsigned char)(r & 0xFF);
+      }
+    }
+  }
+  st[0] = s0;
+  st[1] = s1;
+  st[2] = s2;
+  st[3] = s3;
+}
+
+#if MPTEST_USE_DYN_ALLOC
+MN_API int mptest__fuzz_set_tape(struct mptest__state* state, const char* spec)
+{
+  mptest__fuzz_tape* replay = &state->fuzz_state.replay;
+  mptest_rand word = 0;
+  int digits = 0;
+  state->fuzz_state.replay_set = 0;
+  replay->size = 0;
+  if (spec == NULL) {
+    return 0;
+  }
+  for (;; spec++) {
+    char c = *spec;
+    if (c == ',' || c == '\0') {
+      if (!digits || mptest__fuzz_tape_push(replay, word)) {
+        replay->size = 0;
+        return 1;
+      }
+      if (c == '\0') {
+        break;
+      }
+      word = 0;
+      digits = 0;
+      continue;
+    } else if (c >= '0' && c <= '9') {
+      word = word * 16 + (mptest_rand)(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      word = word * 16 + (mptest_rand)(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      word = word * 16 + (mptest_rand)(c - 'A' + 10);
+    } else {
+      replay->size = 0;
+      return 1;
+    }
+    if (++digits > 8) {
+      replay->size = 0;
+      return 1;
+    }
+  }
+  state->fuzz_state.replay_set = 1;
+  return 0;
 }
+#endif
 
 MN_API void mptest__fuzz_next_test(struct mptest__state* state, int iterations)
 {
@@ -31,6 +509,456 @@ MN_API void mptest__fuzz_next_test(struct mptest__state* state, int iterations)
   fuzz_state->fuzz_active = 1;
 }
 
+MN_API int mptest__fuzz_one_input(
+    struct mptest__state* state, mptest__test_func test_func,
+    const char* test_name, const unsigned char* data, mn_size size)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  mptest__result res;
+  state->current_test = test_name;
+  fuzz_state->input = data;
+  fuzz_state->input_size = size;
+  fuzz_state->input_pos = 0;
+  fuzz_state->input_active = 1;
+  res = mptest__state_do_run_test(state, test_func);
+  fuzz_state->input_active = 0;
+  if (res != MPTEST__RESULT_PASS && res != MPTEST__RESULT_SKIPPED) {
+    /* Report the failure, then crash so that the engine keeps the input */
+    mptest__state_print_test(state);
+    mptest__state_after_test(state, res);
+    fflush(stdout);
+    abort();
+  }
+  return 0;
+}
+
+MN_API void
+mptest__fuzz_set_iterations(struct mptest__state* state, int iterations)
+{
+  state->fuzz_state.iterations_override = iterations < 0 ? 0 : iterations;
+}
+
+MN_API void mptest__fuzz_set_time(struct mptest__state* state, int seconds)
+{
+  state->fuzz_state.time_budget = seconds < 0 ? 0 : seconds;
+}
+
+MN_API void
+mptest__fuzz_set_until_failure(struct mptest__state* state, int until_failure)
+{
+  state->fuzz_state.until_failure = until_failure;
+}
+
+MN_API void
+mptest__fuzz_set_keep_going(struct mptest__state* state, int keep_going)
+{
+  state->fuzz_state.keep_going = keep_going;
+}
+
+/* Whether failing iterations of the current test are sorted into buckets
+ * instead of ending it. */
+MN_INTERNAL int mptest__fuzz_keeps_going(struct mptest__state* state)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  return fuzz_state->keep_going && !fuzz_state->until_failure &&
+         fuzz_state->fuzz_active;
+}
+
+/* Add `bucket` to the buckets of the current test, merging it with the one
+ * that has the same signature. */
+MN_INTERNAL void mptest__fuzz_bucket_merge(
+    struct mptest__state* state, const mptest__fuzz_bucket* bucket)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  int i;
+  for (i = 0; i < fuzz_state->bucket_count; i++) {
+    mptest__fuzz_bucket* into = &fuzz_state->buckets[i];
+    if (into->hash != bucket->hash || into->res != bucket->res ||
+        into->reason != bucket->reason || into->line != bucket->line ||
+        (into->file != bucket->file &&
+         (!into->file || !bucket->file ||
+          !mptest__streq(into->file, bucket->file)))) {
+      continue;
+    }
+    into->hits += bucket->hits;
+    if (bucket->first_iteration < into->first_iteration) {
+      into->first_iteration = bucket->first_iteration;
+    }
+    if (bucket->smallest_draws < into->smallest_draws ||
+        (bucket->smallest_draws == into->smallest_draws &&
+         bucket->smallest_iteration < into->smallest_iteration)) {
+      into->smallest_iteration = bucket->smallest_iteration;
+      into->smallest_draws = bucket->smallest_draws;
+    }
+    return;
+  }
+  if (fuzz_state->bucket_count < MPTEST__FUZZ_BUCKETS_MAX) {
+    fuzz_state->buckets[fuzz_state->bucket_count++] = *bucket;
+  }
+}
+
+/* Order the buckets of the current test by their first failing iteration. */
+MN_INTERNAL void mptest__fuzz_bucket_sort(struct mptest__state* state)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  int i, j;
+  for (i = 1; i < fuzz_state->bucket_count; i++) {
+    mptest__fuzz_bucket bucket = fuzz_state->buckets[i];
+    for (j = i; j > 0 && fuzz_state->buckets[j - 1].first_iteration >
+                             bucket.first_iteration;
+         j--) {
+      fuzz_state->buckets[j] = fuzz_state->buckets[j - 1];
+    }
+    fuzz_state->buckets[j] = bucket;
+  }
+}
+
+/* Sort the failure of iteration `iteration`, which ended with `res`, into its
+ * bucket, then forget it. */
+MN_INTERNAL void mptest__fuzz_bucket_add(
+    struct mptest__state* state, mptest__result res, int iteration)
+{
+  mptest__fuzz_bucket bucket;
+  /* FNV-1a of the signature */
+  mptest_rand x = 0x811C9DC5UL;
+  const char* file = state->fail_file;
+  x = ((x ^ (mptest_rand)(unsigned int)res) * 0x01000193UL) &
+      MPTEST__FUZZ_MASK;
+  x = ((x ^ (mptest_rand)state->fail_reason) * 0x01000193UL) &
+      MPTEST__FUZZ_MASK;
+  x = ((x ^ (mptest_rand)(unsigned int)state->fail_line) * 0x01000193UL) &
+      MPTEST__FUZZ_MASK;
+  while (file && *file) {
+    x = ((x ^ (mptest_rand)(unsigned char)*(file++)) * 0x01000193UL) &
+        MPTEST__FUZZ_MASK;
+  }
+  bucket.hash = x;
+  bucket.res = res;
+  bucket.reason = (int)state->fail_reason;
+  bucket.file = state->fail_file;
+  bucket.line = state->fail_line;
+  bucket.hits = 1;
+  bucket.first_iteration = bucket.smallest_iteration = iteration;
+  bucket.smallest_draws = state->fuzz_state.draws;
+  mptest__fuzz_bucket_merge(state, &bucket);
+  state->fuzz_state.failures++;
+  mptest__state_discard_failure(state);
+}
+
+/* Describe how the failures in `bucket` failed. */
+MN_INTERNAL const char*
+mptest__fuzz_bucket_reason(const mptest__fuzz_bucket* bucket)
+{
+  switch (bucket->reason) {
+  case MPTEST__FAIL_REASON_ASSERT_FAILURE:
+    return "assertion failure";
+  case MPTEST__FAIL_REASON_FAIL_EXPR:
+    return "FAIL()";
+#if MPTEST_USE_LONGJMP
+  case MPTEST__FAIL_REASON_UNCAUGHT_PROGRAM_ASSERT:
+    return "uncaught assertion failure";
+#endif
+#if MPTEST_USE_DYN_ALLOC
+  case MPTEST__FAIL_REASON_NOMEM:
+    return "out of memory";
+#endif
+#if MPTEST_USE_SYM
+  case MPTEST__FAIL_REASON_SYM_INEQUALITY:
+    return "s-expression inequality";
+  case MPTEST__FAIL_REASON_SYM_SYNTAX:
+    return "s-expression syntax error";
+  case MPTEST__FAIL_REASON_SYM_DESERIALIZE:
+    return "s-expression deserialization error";
+#endif
+  default:
+    return bucket->res == MPTEST__RESULT_ERROR ? "error" : "failure";
+  }
+}
+
+/* Whether fuzzed tests run until their time runs out or they fail, rather
+ * than for a number of iterations, and so show how fast they run. */
+MN_INTERNAL int mptest__fuzz_open_ended(struct mptest__state* state)
+{
+  return state->fuzz_state.time_budget || state->fuzz_state.until_failure;
+}
+
+/* Number of iterations to fuzz the current test for. */
+MN_INTERNAL int mptest__fuzz_iteration_limit(struct mptest__state* state)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  if (fuzz_state->until_failure ||
+      (fuzz_state->time_budget && !fuzz_state->iterations_override)) {
+    return MPTEST__FUZZ_ITERATIONS_MAX;
+  } else if (fuzz_state->iterations_override) {
+    return fuzz_state->iterations_override;
+  }
+  return fuzz_state->fuzz_iterations;
+}
+
+/* Start counting the iterations of the current test and the time they take. */
+MN_INTERNAL void mptest__fuzz_start(struct mptest__state* state)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  fuzz_state->last_time = fuzz_state->status_time = mptest__time_wall();
+  fuzz_state->execs = 0;
+  fuzz_state->exec_seconds = 0;
+}
+
+/* Redraw the current test's line with `status` after its name, padded to
+ * cover the last one. An empty `status` clears it. */
+MN_INTERNAL void
+mptest__fuzz_print_status(struct mptest__state* state, const char* status)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  int len;
+  if (!*status && !fuzz_state->status_len) {
+    return;
+  }
+  printf("\r");
+  mptest__state_print_test(state);
+  len = printf("%s", status);
+  if (len < fuzz_state->status_len) {
+    printf("%*s", fuzz_state->status_len - len, "");
+    if (!len) {
+      printf("\r");
+      mptest__state_print_test(state);
+    }
+  }
+  fuzz_state->status_len = len;
+  fflush(stdout);
+}
+
+/* Count an iteration of the current test, updating the live status about
+ * once a second if `live`. Returns 1 once the time budget has run out. */
+MN_INTERNAL int mptest__fuzz_tick(struct mptest__state* state, int live)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  double now = mptest__time_wall();
+  fuzz_state->execs++;
+  fuzz_state->exec_seconds += now - fuzz_state->last_time;
+  fuzz_state->last_time = now;
+  if (live && mptest__fuzz_open_ended(state) &&
+      now - fuzz_state->status_time >= 1) {
+    char status[64];
+    fuzz_state->status_time = now;
+    sprintf(
+        status, "%i execs, %.0f/s", fuzz_state->execs,
+        fuzz_state->execs / fuzz_state->exec_seconds);
+    mptest__fuzz_print_status(state, status);
+  }
+  return fuzz_state->time_budget &&
+         fuzz_state->exec_seconds >= fuzz_state->time_budget;
+}
+
+#if MPTEST_USE_FORK
+MN_API void mptest__fuzz_set_workers(struct mptest__state* state, int workers)
+{
+  if (workers < 1) {
+    workers = 1;
+  } else if (workers > MPTEST__FUZZ_WORKERS_MAX) {
+    workers = MPTEST__FUZZ_WORKERS_MAX;
+  }
+  state->fuzz_state.workers = workers;
+}
+
+/* What a fuzz worker reports to the parent when it finishes */
+typedef struct mptest__fuzz_worker_msg {
+  /* First failing iteration, or -1 */
+  int fail_iteration;
+  /* Assertions made in total, counting those made before the fork */
+  int assertions;
+  /* Iterations that passed, and the seconds they took */
+  int execs;
+  double exec_seconds;
+  /* Failures sorted into buckets, when keeping going past them */
+  int failures;
+  int bucket_count;
+  mptest__fuzz_bucket buckets[MPTEST__FUZZ_BUCKETS_MAX];
+} mptest__fuzz_worker_msg;
+
+/* Run iterations `worker`, `worker` + `stride`, ... of `test_func` in a child
+ * process, writing a mptest__fuzz_worker_msg to `fd`. Unless `stop_fd` is -1,
+ * the parent writes the failing iterations found by other workers to it, and
+ * the worker stops once its iterations pass the lowest of them. Iterations
+ * below it still run, so the first failure does not depend on the number of
+ * workers. Never returns. */
+MN_INTERNAL void mptest__fuzz_worker(
+    struct mptest__state* state, mptest__test_func test_func, int worker,
+    int stride, int iters, int fd, int stop_fd)
+{
+  struct pollfd stop;
+  mptest__fuzz_worker_msg msg;
+  int i;
+  msg.fail_iteration = -1;
+  /* Count the child's iterations and time from zero */
+  mptest__fuzz_start(state);
+  stop.fd = stop_fd;
+  stop.events = POLLIN;
+  for (i = worker; i < iters; i += stride) {
+    mptest__result res;
+    int fail_iteration;
+    if (stop_fd != -1 && poll(&stop, 1, 0) > 0 &&
+        read(stop_fd, &fail_iteration, sizeof(fail_iteration)) ==
+            (ssize_t)sizeof(fail_iteration) &&
+        fail_iteration < iters) {
+      iters = fail_iteration;
+    }
+    if (i >= iters) {
+      break;
+    }
+    mptest__fuzz_seed(state, mptest__fuzz_iteration_seed(state, i));
+    res = mptest__state_do_run_test(state, test_func);
+    if ((res == MPTEST__RESULT_FAIL || res == MPTEST__RESULT_ERROR) &&
+        mptest__fuzz_keeps_going(state)) {
+      mptest__fuzz_bucket_add(state, res, i);
+    } else if (res != MPTEST__RESULT_PASS) {
+      /* This iteration is counted when the parent reruns it */
+      msg.fail_iteration = i;
+      break;
+    }
+    if (mptest__fuzz_tick(state, 0) || iters - i <= stride) {
+      break;
+    }
+  }
+  msg.assertions = state->assertions;
+  msg.execs = state->fuzz_state.execs;
+  msg.exec_seconds = state->fuzz_state.exec_seconds;
+  msg.failures = state->fuzz_state.failures;
+  msg.bucket_count = state->fuzz_state.bucket_count;
+  for (i = 0; i < msg.bucket_count; i++) {
+    msg.buckets[i] = state->fuzz_state.buckets[i];
+  }
+  fflush(stdout);
+  if (write(fd, &msg, sizeof(msg)) != (ssize_t)sizeof(msg)) {
+    _exit(1);
+  }
+  _exit(0);
+}
+
+/* Spread the `iters` iterations of `test_func` over the worker processes.
+ * Returns the first failing iteration, `iters` if they all passed, or 0 if a
+ * worker died, so that the caller reruns everything in-process. When keeping
+ * going past failures, the workers' buckets are merged instead. In open-ended
+ * runs, each failure is sent to the other workers, which stop once their
+ * iterations pass it. */
+MN_INTERNAL int mptest__fuzz_run_workers(
+    struct mptest__state* state, mptest__test_func test_func, int iters)
+{
+  mptest__fuzz_state* fuzz_state = &state->fuzz_state;
+  struct pollfd fds[MPTEST__FUZZ_WORKERS_MAX];
+  pid_t pids[MPTEST__FUZZ_WORKERS_MAX];
+  /* Pipes sending failures to each worker. The parent keeps both ends open,
+   * so that writing to a worker that has already exited cannot fail. */
+  int stop_fds[MPTEST__FUZZ_WORKERS_MAX][2];
+  int workers = fuzz_state->workers;
+  int stops = mptest__fuzz_open_ended(state);
+  int first = iters, crashed = 0, assertions = 0;
+  int left, w, i;
+  /* Don't let the children inherit and repeat buffered output */
+  fflush(stdout);
+  fflush(stderr);
+  for (w = 0; w < workers; w++) {
+    int pipe_fds[2];
+    stop_fds[w][0] = stop_fds[w][1] = -1;
+    if (stops && pipe(stop_fds[w])) {
+      break;
+    }
+    if (pipe(pipe_fds)) {
+      break;
+    }
+    if ((pids[w] = fork()) == 0) {
+      close(pipe_fds[0]);
+      if (stop_fds[w][1] != -1) {
+        close(stop_fds[w][1]);
+      }
+      mptest__fuzz_worker(
+          state, test_func, w, workers, iters, pipe_fds[1], stop_fds[w][0]);
+    }
+    close(pipe_fds[1]);
+    if (pids[w] < 0) {
+      close(pipe_fds[0]);
+      break;
+    }
+    fds[w].fd = pipe_fds[0];
+    fds[w].events = POLLIN;
+  }
+  if (w != workers) {
+    /* Couldn't start every worker */
+    for (i = 0; i < 2; i++) {
+      if (stop_fds[w][i] != -1) {
+        close(stop_fds[w][i]);
+      }
+    }
+    crashed = 1;
+    workers = w;
+  }
+  left = workers;
+  while (left && !crashed) {
+    if (poll(fds, (nfds_t)workers, -1) < 0) {
+      crashed = 1;
+      break;
+    }
+    for (w = 0; w < workers; w++) {
+      mptest__fuzz_worker_msg msg;
+      if (fds[w].fd < 0 || !fds[w].revents) {
+        continue;
+      }
+      if (read(fds[w].fd, &msg, sizeof(msg)) != (ssize_t)sizeof(msg)) {
+        crashed = 1;
+      } else {
+        if (msg.fail_iteration != -1 && msg.fail_iteration < first) {
+          first = msg.fail_iteration;
+          for (i = 0; stops && i < workers; i++) {
+            /* Short, so the write is atomic and the pipe never fills */
+            if (fds[i].fd >= 0 && i != w &&
+                write(stop_fds[i][1], &first, sizeof(first)) !=
+                    (ssize_t)sizeof(first)) {
+              crashed = 1;
+            }
+          }
+        }
+        /* Count the assertions made in the worker */
+        assertions += msg.assertions - state->assertions;
+        fuzz_state->execs += msg.execs;
+        /* The workers ran side by side, so the slowest one took longest */
+        if (msg.exec_seconds > fuzz_state->exec_seconds) {
+          fuzz_state->exec_seconds = msg.exec_seconds;
+        }
+        fuzz_state->failures += msg.failures;
+        for (i = 0; i < msg.bucket_count; i++) {
+          mptest__fuzz_bucket_merge(state, &msg.buckets[i]);
+        }
+      }
+      /* Negative descriptors are ignored by poll() */
+      close(fds[w].fd);
+      fds[w].fd = -1;
+      left--;
+    }
+  }
+  for (w = 0; w < workers; w++) {
+    int status;
+    if (fds[w].fd >= 0) {
+      close(fds[w].fd);
+    }
+    if (stops) {
+      close(stop_fds[w][0]);
+      close(stop_fds[w][1]);
+    }
+    waitpid(pids[w], &status, 0);
+  }
+  state->assertions += assertions;
+  fuzz_state->last_time = mptest__time_wall();
+  if (crashed) {
+    mptest__fuzz_start(state);
+    fuzz_state->bucket_count = 0;
+    fuzz_state->failures = 0;
+    return 0;
+  }
+  /* Failures were sorted into buckets, which are reported from there */
+  return mptest__fuzz_keeps_going(state) ? iters : first;
+}
+#endif
+
 MN_INTERNAL mptest__result
 mptest__fuzz_run_test(struct mptest__state* state, mptest__test_func test_func)
 {
@@ -41,27 +969,97 @@ mptest__fuzz_run_test(struct mptest__state* state, mptest__test_func test_func)
   /* Reset fail variables */
   fuzz_state->fuzz_fail_iteration = 0;
   fuzz_state->fuzz_fail_seed = 0;
+  fuzz_state->test_seed = mptest__fuzz_test_seed(state);
+  fuzz_state->execs = 0;
+  fuzz_state->bucket_count = 0;
+  fuzz_state->failures = 0;
   if (fuzz_state->fuzz_active) {
-    iters = fuzz_state->fuzz_iterations;
+    iters = mptest__fuzz_iteration_limit(state);
+    mptest__fuzz_start(state);
+  }
+#if MPTEST_USE_DYN_ALLOC
+  fuzz_state->tape_shrunk = 0;
+  fuzz_state->replaying = 0;
+  if (fuzz_state->replay_set) {
+    /* Run the tape given instead of fuzzing */
+    fuzz_state->fuzz_active = 0;
+    if (mptest__fuzz_tape_copy(&fuzz_state->tape, &fuzz_state->replay)) {
+      state->fail_reason = MPTEST__FAIL_REASON_NOMEM;
+      state->fail_msg = "fuzz tape";
+      return MPTEST__RESULT_ERROR;
+    }
+    res = mptest__fuzz_run_tape(
+        state, test_func, 0, MPTEST__FUZZ_TAPE_REPLAY);
+    fuzz_state->replaying = 1;
+    fuzz_state->fuzz_failed = res != MPTEST__RESULT_PASS;
+    return res;
+  }
+#endif
+#if MPTEST_USE_COVERAGE
+  if (fuzz_state->fuzz_active && state->coverage_state.guided) {
+    /* Guided runs depend on each other, so they aren't spread over workers */
+    res = mptest__coverage_run_test(state, test_func, iters);
+    mptest__fuzz_print_status(state, "");
+    fuzz_state->fuzz_active = 0;
+    return res;
+  }
+#endif
+#if MPTEST_USE_FORK
+  if (fuzz_state->workers > 1 && iters > 1) {
+    /* Only the first failing iteration is rerun here, to report it */
+    i = mptest__fuzz_run_workers(state, test_func, iters);
   }
-  for (i = 0; i < iters; i++) {
-    /* Save the start state */
-    mptest_rand start_state = fuzz_state->rand_state;
-    int should_finish = 0;
+#endif
+  for (; i < iters; i++) {
+    /* Each iteration gets its own stream, so it can be reproduced from its
+     * seed alone */
+    mptest_rand seed = mptest__fuzz_iteration_seed(state, i);
+    int should_finish = 0, timed_out;
+    mptest__fuzz_seed(state, seed);
     res = mptest__state_do_run_test(state, test_func);
+    timed_out = fuzz_state->fuzz_active && mptest__fuzz_tick(state, 1);
     /* Note: we don't handle MPTEST__RESULT_SKIPPED because it is handled in
      * the calling function. */
-    if (res != MPTEST__RESULT_PASS) {
+    if ((res == MPTEST__RESULT_FAIL || res == MPTEST__RESULT_ERROR) &&
+        mptest__fuzz_keeps_going(state)) {
+      mptest__fuzz_bucket_add(state, res, i);
+      res = MPTEST__RESULT_PASS;
+    } else if (res != MPTEST__RESULT_PASS) {
       should_finish = 1;
     }
     if (should_finish) {
       /* Save fail context */
       fuzz_state->fuzz_fail_iteration = i;
-      fuzz_state->fuzz_fail_seed = start_state;
+      fuzz_state->fuzz_fail_seed = seed;
       fuzz_state->fuzz_failed = 1;
       break;
     }
+    if (timed_out) {
+      break;
+    }
+  }
+  mptest__fuzz_print_status(state, "");
+  if (fuzz_state->bucket_count) {
+    /* Report the first bucket in full, from its smallest reproducer */
+    mptest__fuzz_bucket_sort(state);
+    i = fuzz_state->buckets[0].smallest_iteration;
+    fuzz_state->fuzz_fail_iteration = i;
+    fuzz_state->fuzz_fail_seed = mptest__fuzz_iteration_seed(state, i);
+    fuzz_state->fuzz_failed = 1;
+    mptest__fuzz_seed(state, fuzz_state->fuzz_fail_seed);
+    res = mptest__state_do_run_test(state, test_func);
   }
+#if MPTEST_USE_DYN_ALLOC
+  if (res != MPTEST__RESULT_PASS && fuzz_state->fuzz_active) {
+    /* Rerun the failing iteration to record its random numbers, then shrink
+     * them */
+    fuzz_state->tape.size = 0;
+    if (mptest__fuzz_run_tape(
+            state, test_func, i, MPTEST__FUZZ_TAPE_RECORD) == res) {
+      res = mptest__fuzz_shrink(state, test_func, i, res);
+    }
+  }
+#endif
   fuzz_state->fuzz_active = 0;
   return res;
 }
@@ -70,8 +1068,14 @@ MN_INTERNAL void
 mptest__fuzz_report_test(struct mptest__state* state, mptest__result res)
 {
   mptest__fuzz_state* fuzz_state = &state->fuzz_state;
-  MN__UNUSED(res);
-  if (fuzz_state->fuzz_failed) {
+  int replaying = 0;
+#if MPTEST_USE_DYN_ALLOC
+  replaying = fuzz_state->replaying;
+#endif
+  if (fuzz_state->fuzz_failed && replaying) {
+    mptest__state_print_indent(state);
+    printf("    ...on the replayed fuzz tape\n");
+  } else if (fuzz_state->fuzz_failed) {
     mptest__state_print_indent(state);
     printf(
         "    ...on fuzz iteration " MPTEST__COLOR_EMPHASIS
@@ -79,6 +1083,71 @@ mptest__fuzz_report_test(struct mptest__state* state, mptest__result res)
         "%lX" MPTEST__COLOR_RESET "\n",
         fuzz_state->fuzz_fail_iteration, fuzz_state->fuzz_fail_seed);
   }
+#if MPTEST_USE_DYN_ALLOC
+  if (fuzz_state->fuzz_failed && fuzz_state->tape_shrunk &&
+      res != MPTEST__RESULT_PASS) {
+    int i;
+    mptest__state_print_indent(state);
+    printf(
+        "    ...shrunk to " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+        " random numbers, replay with --fuzz-tape " MPTEST__COLOR_EMPHASIS,
+        fuzz_state->tape.size);
+    for (i = 0; i < fuzz_state->tape.size; i++) {
+      printf("%s%lX", i ? "," : "", fuzz_state->tape.words[i]);
+    }
+    /* The empty tape is the same as all zeroes */
+    printf("%s" MPTEST__COLOR_RESET "\n", fuzz_state->tape.size ? "" : "0");
+  }
+  fuzz_state->tape_shrunk = 0;
+  fuzz_state->replaying = 0;
+#endif
+  if (fuzz_state->bucket_count && res != MPTEST__RESULT_SKIPPED) {
+    int i, kept = 0;
+    for (i = 0; i < fuzz_state->bucket_count; i++) {
+      kept += fuzz_state->buckets[i].hits;
+    }
+    mptest__state_print_indent(state);
+    printf(
+        "    ...sorted " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+        " failing iterations into " MPTEST__COLOR_EMPHASIS
+        "%i" MPTEST__COLOR_RESET " buckets",
+        fuzz_state->failures, fuzz_state->bucket_count);
+    if (kept != fuzz_state->failures) {
+      printf(", %i more didn't fit", fuzz_state->failures - kept);
+    }
+    printf(":\n");
+    for (i = 0; i < fuzz_state->bucket_count; i++) {
+      const mptest__fuzz_bucket* bucket = &fuzz_state->buckets[i];
+      mptest__state_print_indent(state);
+      printf("      %s", mptest__fuzz_bucket_reason(bucket));
+      if (bucket->file) {
+        printf(" at ");
+        mptest__print_source_location(bucket->file, bucket->line);
+      }
+      printf(
+          ": hit " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+          " times, first on iteration %i, smallest on iteration %i with "
+          "seed " MPTEST__COLOR_EMPHASIS "%lX" MPTEST__COLOR_RESET "\n",
+          bucket->hits, bucket->first_iteration, bucket->smallest_iteration,
+          mptest__fuzz_iteration_seed(state, bucket->smallest_iteration));
+    }
+  }
+  fuzz_state->bucket_count = 0;
+  fuzz_state->failures = 0;
+  if (fuzz_state->execs && mptest__fuzz_open_ended(state) &&
+      res != MPTEST__RESULT_SKIPPED) {
+    mptest__state_print_indent(state);
+    printf(
+        "    ...ran " MPTEST__COLOR_EMPHASIS "%i" MPTEST__COLOR_RESET
+        " fuzz iterations in %.2f seconds",
+        fuzz_state->execs, fuzz_state->exec_seconds);
+    if (fuzz_state->exec_seconds > 0) {
+      printf(
+          ", " MPTEST__COLOR_EMPHASIS "%.0f" MPTEST__COLOR_RESET "/s",
+          fuzz_state->execs / fuzz_state->exec_seconds);
+    }
+    printf("\n");
+  }
   fuzz_state->fuzz_failed = 0;
   /* Reset fuzz iterations, needs to be done after every fuzzed test */
   fuzz_state->fuzz_iterations = 1;
@@ -13,6 +13,8 @@
  * 4. mptest recognizes this jump back and passes the test.
  * 5. If the jump back doesn't happen, mptest recognizes this too and fails the
  *    test, expecting an assertion failure. */
+#include <stdio.h>
+
 #if MPTEST_USE_TIME
 #include <time.h>
 #endif
@@ -42,6 +44,8 @@ typedef enum mptest__fail_reason {
   MPTEST__FAIL_REASON_SYM_SYNTAX,
   /* Couldn't parse a sym into an object. */
   MPTEST__FAIL_REASON_SYM_DESERIALIZE,
+  /* Couldn't read or write a snapshot file. */
+  MPTEST__FAIL_REASON_SYM_SNAPSHOT,
 #endif
   MPTEST__FAIL_REASON_LAST
 } mptest__fail_reason;
@@ -95,8 +99,68 @@ typedef struct mptest__aparse_state {
   mptest__aparse_name* opt_suite_name_tail;
   /*     --fault-check : whether to enable fault checking */
   int opt_fault_check;
+  /*     --fault-mode : "set" or "one", how many calls to fail per fault */
+  const char* opt_fault_mode;
+  mn_size opt_fault_mode_size;
+  /*     --fault-class : comma-separated classes to simulate faults in */
+  const char* opt_fault_class;
+  mn_size opt_fault_class_size;
+  /*     --fault-site-limit : max faults to simulate per call site */
+  unsigned long opt_fault_site_limit;
+  /*     --fault-sample : number of fault points to sample per test */
+  unsigned long opt_fault_sample;
+  /*     --fault-budget : seconds a sampled sweep may take */
+  unsigned long opt_fault_budget;
+  /*     --fault-pairs : whether to also fail pairs of calls */
+  int opt_fault_pairs;
+  /*     --fault-index : calls to fail instead of sweeping */
+  const char* opt_fault_index;
+  mn_size opt_fault_index_size;
+#if MPTEST_USE_DYN_ALLOC
+  /*     --fault-replay : schedule file of failures to replay */
+  const char* opt_fault_replay;
+  mn_size opt_fault_replay_size;
+#endif
+  /*     --fault-record : schedule file to write failures to */
+  const char* opt_fault_record;
+  mn_size opt_fault_record_size;
+  /*     --fault-seed : seed for sampled sweeps */
+  unsigned long opt_fault_seed;
+  int opt_fault_seed_set;
+#if MPTEST_USE_FORK
+  /*     --fuzz-workers : processes to run fuzz iterations in */
+  unsigned long opt_fuzz_workers;
+#endif
+#if MPTEST_USE_FUZZ
+  /*     --fuzz-iterations : iterations to run each fuzzed test for */
+  unsigned long opt_fuzz_iterations;
+  /*     --fuzz-time : seconds to fuzz each test for */
+  unsigned long opt_fuzz_time;
+  /*     --fuzz-until-failure : whether to fuzz each test until it fails */
+  int opt_fuzz_until_failure;
+  /*     --fuzz-keep-going : whether to keep fuzzing past failures */
+  int opt_fuzz_keep_going;
+#endif
+#if MPTEST_USE_FUZZ && MPTEST_USE_DYN_ALLOC
+  /*     --fuzz-tape : tape of random numbers to run instead of fuzzing */
+  const char* opt_fuzz_tape;
+  mn_size opt_fuzz_tape_size;
+#endif
+#if MPTEST_USE_COVERAGE
+  /*     --fuzz-guided : whether to guide fuzzing by coverage */
+  int opt_fuzz_guided;
+  /*     --fuzz-corpus : directory to keep the fuzzing corpus in */
+  const char* opt_fuzz_corpus;
+  mn_size opt_fuzz_corpus_size;
+#endif
+#if MPTEST_USE_SYM
+  /*     --update-snapshots : whether to write snapshots instead of checking */
+  int opt_update_snapshots;
+#endif
   /*     --leak-check-pass : whether to enable leak check malloc passthrough */
   int opt_leak_check_pass;
+  /*     --leak-check-quarantine : bytes of freed memory to hold and poison */
+  unsigned long opt_leak_check_quarantine;
 } mptest__aparse_state;
 #endif
 
@@ -137,19 +201,80 @@ typedef enum mptest__leakcheck_fail_reason {
   /* Program tried to call free() on an already reallocated pointer. */
   MPTEST__LEAKCHECK_FREE_OF_REALLOCED,
   /* End-of-test memory check found unfreed blocks. */
-  MPTEST__LEAKCHECK_LEAKED
+  MPTEST__LEAKCHECK_LEAKED,
+  /* A quarantined block was written to after it was freed. */
+  MPTEST__LEAKCHECK_USE_AFTER_FREE
 } mptest__leakcheck_fail_reason;
 
-typedef struct mptest__leakcheck_state {
-  /* 1 if current test should be audited for leaks, 0 otherwise. */
-  mptest__leakcheck_mode test_leak_checking;
+#if MPTEST_USE_THREADS
+#if defined(_WIN32)
+#include <windows.h>
+typedef CRITICAL_SECTION mptest__mutex;
+typedef DWORD mptest__tls_key;
+typedef DWORD mptest__thread_id;
+#else
+#include <pthread.h>
+typedef pthread_mutex_t mptest__mutex;
+typedef pthread_key_t mptest__tls_key;
+typedef pthread_t mptest__thread_id;
+#endif
+
+/* Number of independently locked shards of the live pointer set. */
+#define MPTEST__LEAKCHECK_SHARD_COUNT 16
+#else
+#define MPTEST__LEAKCHECK_SHARD_COUNT 1
+#endif
+
+/* Open-addressed (linear probing) hash set of user pointers. Used to validate
+ * pointers passed to free() and realloc() before anything is read from their
+ * headers. */
+typedef struct mptest__leakcheck_ptrset {
+  /* Slot array, NULL slots are empty. Capacity is always a power of two. */
+  void** slots;
+  size_t capacity;
+  /* Number of occupied slots */
+  size_t size;
+} mptest__leakcheck_ptrset;
+
+/* One shard of the live pointer set. */
+typedef struct mptest__leakcheck_shard {
+  mptest__leakcheck_ptrset set;
+#if MPTEST_USE_THREADS
+  mptest__mutex lock;
+#endif
+} mptest__leakcheck_shard;
+
+/* Record of the blocks allocated by one thread. Only the owning thread appends
+ * to a log, so no locking is needed on the allocation path. */
+/* Number of block records carved out of each chunk */
+#define MPTEST__LEAKCHECK_CHUNK_BLOCKS 64
+
+typedef struct mptest__leakcheck_chunk mptest__leakcheck_chunk;
+
+typedef struct mptest__leakcheck_log {
   /* First and most recent blocks allocated. */
   struct mptest__leakcheck_block* first_block;
   struct mptest__leakcheck_block* top_block;
+  /* Chunks holding this log's block records, most recent first */
+  mptest__leakcheck_chunk* chunks;
   /* Total number of allocations in use. */
   int total_allocations;
   /* Total number of calls to malloc() or realloc(). */
   int total_calls;
+#if MPTEST_USE_THREADS
+  /* Next log in `mptest__leakcheck_state::thread_logs` */
+  struct mptest__leakcheck_log* next;
+#endif
+} mptest__leakcheck_log;
+
+typedef struct mptest__leakcheck_state {
+  /* 1 if current test should be audited for leaks, 0 otherwise. */
+  mptest__leakcheck_mode test_leak_checking;
+  /* Blocks allocated by the testing thread, plus the blocks of every other
+   * thread once they have been merged in after the test. */
+  mptest__leakcheck_log log;
+  /* User pointers of all blocks that are currently allocated. */
+  mptest__leakcheck_shard live_shards[MPTEST__LEAKCHECK_SHARD_COUNT];
   /* Whether or not to let allocations fall through */
   int fall_through;
   /* Whether or not the test failed leakchecking */
@@ -159,6 +284,28 @@ typedef struct mptest__leakcheck_state {
   int fail_line;
   /* The offending allocation parameter, if any */
   void* fail_ptr;
+  /* The offending block record, if any (use-after-free reports) */
+  struct mptest__leakcheck_block* fail_block;
+  /* Offset of the first overwritten byte in `fail_block` */
+  size_t fail_offset;
+  /* Maximum number of freed bytes held in quarantine, 0 to disable */
+  size_t quarantine_limit;
+  /* Number of freed bytes currently held in quarantine */
+  size_t quarantine_bytes;
+  /* Oldest and newest quarantined blocks (FIFO order) */
+  struct mptest__leakcheck_block* quarantine_head;
+  struct mptest__leakcheck_block* quarantine_tail;
+#if MPTEST_USE_THREADS
+  /* Thread that runs the tests. Failures on other threads are recorded
+   * instead of jumping out of the test. */
+  mptest__thread_id main_thread;
+  /* Key of each other thread's `mptest__leakcheck_log` */
+  mptest__tls_key log_key;
+  /* Logs of all other threads that have allocated so far */
+  mptest__leakcheck_log* thread_logs;
+  /* Protects `thread_logs`, the quarantine and the failure fields */
+  mptest__mutex lock;
+#endif
 } mptest__leakcheck_state;
 #endif
 
@@ -172,9 +319,62 @@ typedef struct mptest__time_state {
 #endif
 
 #if MPTEST_USE_FUZZ
+/* Maximum number of fuzz worker processes */
+#define MPTEST__FUZZ_WORKERS_MAX 64
+
+/* Maximum number of runs spent shrinking a failing tape */
+#define MPTEST__FUZZ_SHRINK_RUNS 2000
+
+/* Iteration count of runs limited only by time or by failing */
+#define MPTEST__FUZZ_ITERATIONS_MAX 0x7FFFFFFF
+
+/* Maximum number of distinct failures kept per test when fuzzing past them */
+#define MPTEST__FUZZ_BUCKETS_MAX 32
+
+/* Failures of a test that fail in the same way, at the same place */
+typedef struct mptest__fuzz_bucket {
+  /* Hash of the signature below, to tell buckets apart quickly */
+  mptest_rand hash;
+  mptest__result res;
+  int reason;
+  const char* file;
+  int line;
+  /* Number of failing iterations in the bucket */
+  int hits;
+  /* First failing iteration */
+  int first_iteration;
+  /* Failing iteration that drew the fewest random numbers, and how many */
+  int smallest_iteration;
+  int smallest_draws;
+} mptest__fuzz_bucket;
+
+#define MPTEST__FUZZ_TAPE_OFF 0
+/* Record random numbers on the tape, extending it with fresh ones */
+#define MPTEST__FUZZ_TAPE_RECORD 1
+/* Replay the tape, then supply zeroes */
+#define MPTEST__FUZZ_TAPE_REPLAY 2
+
+#if MPTEST_USE_DYN_ALLOC
+/* Sequence of random numbers consumed by one fuzz run. Replaying a tape
+ * replays the run, and changing it explores nearby runs. */
+typedef struct mptest__fuzz_tape {
+  mptest_rand* words;
+  int size;
+  int alloc;
+} mptest__fuzz_tape;
+#endif
+
 typedef struct mptest__fuzz_state {
-  /* State of the random number generator */
-  mptest_rand rand_state;
+  /* State of the xoshiro128** generator, four 32-bit words */
+  mptest_rand rand_state[4];
+  /* Seed that all per-test seeds are derived from */
+  mptest_rand base_seed;
+  /* Seed of the current test, derived from its name */
+  mptest_rand test_seed;
+#if MPTEST_USE_FORK
+  /* Number of processes to spread fuzz iterations over */
+  int workers;
+#endif
   /* Whether or not the current test should be fuzzed */
   int fuzz_active;
   /* Whether or not the current test failed on a fuzz */
@@ -184,9 +384,186 @@ typedef struct mptest__fuzz_state {
   /* Fuzz failure context */
   int fuzz_fail_iteration;
   mptest_rand fuzz_fail_seed;
+  /* Iterations to run every fuzzed test for instead, 0 for its own count */
+  int iterations_override;
+  /* Seconds of wall time to fuzz each test for, 0 for no limit */
+  int time_budget;
+  /* Whether to fuzz each test until it fails */
+  int until_failure;
+  /* Time of the last iteration counted, and of the last live status */
+  double last_time;
+  double status_time;
+  /* Iterations run by the current test, and the seconds they took */
+  int execs;
+  double exec_seconds;
+  /* Length of the live status printed after the test name */
+  int status_len;
+  /* Whether to keep fuzzing past failures, sorting them into buckets */
+  int keep_going;
+  /* Buckets of the current test's failures, and the number of failing
+   * iterations, including those that didn't fit in a bucket */
+  mptest__fuzz_bucket buckets[MPTEST__FUZZ_BUCKETS_MAX];
+  int bucket_count;
+  int failures;
+  /* Random numbers drawn since the generator was last seeded */
+  int draws;
+  /* Fuzzer-supplied input that random numbers are drawn from instead, if
+   * `input_active` */
+  const unsigned char* input;
+  mn_size input_size;
+  mn_size input_pos;
+  int input_active;
+#if MPTEST_USE_DYN_ALLOC
+  /* Tape of the current run, and how much of it was consumed */
+  mptest__fuzz_tape tape;
+  int tape_pos;
+  /* Whether random numbers come from the tape (MPTEST__FUZZ_TAPE_XXX) */
+  int tape_mode;
+  /* Whether or not `tape` holds a shrunk failing tape */
+  int tape_shrunk;
+  /* Tape to run instead of fuzzing, if `replay_set` */
+  mptest__fuzz_tape replay;
+  int replay_set;
+  /* Whether or not the current test ran the replay tape */
+  int replaying;
+#endif
 } mptest__fuzz_state;
 #endif
 
+#if MPTEST_USE_COVERAGE
+typedef struct mptest__coverage_state {
+  /* Whether or not FUZZ_TESTs are coverage-guided */
+  int guided;
+  /* Directory the corpus is kept in between runs, or NULL */
+  const char* corpus_dir;
+  /* Inputs that reached new coverage */
+  mptest__fuzz_tape* corpus;
+  int corpus_size;
+  int corpus_alloc;
+  /* Number of the next corpus file of the current test */
+  int corpus_next;
+  /* Inputs loaded from `corpus_dir` and found by the current test */
+  int corpus_loaded;
+  int corpus_found;
+  /* Per-guard bitmask of hit count buckets seen so far */
+  unsigned char* virgin;
+  /* Number of guards hit so far */
+  int edges;
+  /* Generator state for choosing mutations */
+  mptest_rand mutate_state[4];
+  /* Whether or not the current test was coverage-guided */
+  int ran;
+  /* Where the failing input of the current test was saved, or NULL */
+  char* fail_path;
+} mptest__coverage_state;
+#endif
+
+#if MPTEST_USE_SYM
+/* An expected s-expression, parsed once and kept for the rest of the run. */
+typedef struct mptest__sym_cache_entry {
+  /* Address of the string it was parsed from */
+  const char* str;
+  /* Copy of that string, in case the address is reused for another */
+  char* text;
+  mptest_sym* sym;
+} mptest__sym_cache_entry;
+
+typedef struct mptest__sym_state {
+  /* Tree built by the current assertion, cleared and reused by the next */
+  mptest_sym* actual;
+  /* Open-addressed table of parsed expected trees, keyed by address; a power
+   * of two in size and never more than half full */
+  mptest__sym_cache_entry* cache;
+  mn_size cache_size;
+  mn_size cache_count;
+  /* Snapshot loaded to show how a tree differs from it */
+  mptest_sym* snapshot;
+  /* Syms handed out by SYM(), emptied and reused by each run of a test */
+  mptest_sym** pool;
+  mn_size pool_size;
+  mn_size pool_used;
+  /* Write snapshots instead of comparing against them */
+  int update_snapshots;
+} mptest__sym_state;
+#endif
+
+/* Maximum number of distinct fault classes tracked during a test. */
+#define MPTEST__FAULT_CLASS_MAX 32
+
+/* Number of possible fault calls of one class (e.g. "malloc"). */
+typedef struct mptest__fault_class {
+  const char* name;
+  int calls;
+} mptest__fault_class;
+
+/* Maximum number of distinct fault sites tracked during a test. */
+#define MPTEST__FAULT_SITE_MAX 256
+
+/* A source location that makes possible fault calls of one class. */
+typedef struct mptest__fault_site {
+  const char* class;
+  /* NULL for calls made without a source location */
+  const char* file;
+  int line;
+  /* Number of calls made at this site during the current run */
+  int calls;
+  /* Number of calls made at this site during the initial, fault-free run */
+  int total;
+  /* Index of the first call made after a simulated fault during the current
+   * run, or -1 */
+  int first_after;
+  /* Sampled sweeps: number of calls tried so far, the next call to try and
+   * the step between tried calls (coprime with `total`) */
+  int sample_tried;
+  int sample_next;
+  int sample_stride;
+} mptest__fault_site;
+
+/* Maximum number of tried fault points remembered for the report. */
+#define MPTEST__FAULT_TRIED_MAX 64
+
+/* A fault point, identified by its index among the calls of its class. */
+typedef struct mptest__fault_point {
+  const char* class;
+  /* -1 if the run never reached the point */
+  int idx;
+} mptest__fault_point;
+
+/* Maximum number of calls failed in a single run. */
+#define MPTEST__FAULT_TARGET_MAX 2
+
+/* A call to fail. */
+typedef struct mptest__fault_target {
+  /* NULL to count calls of all classes */
+  const char* class;
+  /* Index of the site in `fault_sites`, or -1 to count all calls of the
+   * class */
+  int site;
+  /* Index of the call among the calls of the site or class */
+  int idx;
+  /* Class and index among the calls of that class of the failed call. The
+   * index is -1 if the run never reached it. */
+  const char* hit_class;
+  int hit_idx;
+} mptest__fault_target;
+
+/* Maximum length of a fault schedule given on the command line. */
+#define MPTEST__FAULT_SPEC_MAX 128
+
+#if MPTEST_USE_DYN_ALLOC
+typedef struct mptest__fault_entry mptest__fault_entry;
+
+/* A failure read from a fault schedule file. */
+struct mptest__fault_entry {
+  const char* test_name;
+  /* Fault checking mode the failure was found with */
+  int mode;
+  mptest__fault_target targets[MPTEST__FAULT_TARGET_MAX];
+  int target_count;
+  mptest__fault_entry* next;
+};
+#endif
+
 struct mptest__state {
   /* Total number of assertions */
   int assertions;
@@ -225,10 +602,59 @@ struct mptest__state {
   int fault_checking;
   /* Number of possible fault calls */
   int fault_calls;
-  /* Iteration that the fault failed on */
-  int fault_fail_call_idx;
+  /* Calls to fail in the current run */
+  mptest__fault_target fault_targets[MPTEST__FAULT_TARGET_MAX];
+  int fault_target_count;
   /* Whether or not a fault caused a failure */
   int fault_failed;
+  /* Per-class counts of possible fault calls, in order of first call */
+  mptest__fault_class fault_classes[MPTEST__FAULT_CLASS_MAX];
+  int fault_class_count;
+  /* Comma-separated list of classes to simulate faults in, NULL for all */
+  const char* fault_class_filter;
+  mn_size fault_class_filter_len;
+  /* Maximum number of faults to simulate per call site, 0 to simulate a
+   * fault for every call */
+  int fault_site_limit;
+  /* Call sites seen during the current test, in order of first call */
+  mptest__fault_site fault_sites[MPTEST__FAULT_SITE_MAX];
+  int fault_site_count;
+  /* Site that was last called, checked first on the next lookup */
+  int fault_site_last;
+  /* Number of fault points found and swept for the current test */
+  int fault_points;
+  int fault_points_swept;
+  /* Whether to also fail pairs of calls, and how many pairs were swept */
+  int fault_pairs;
+  int fault_pairs_swept;
+  /* Number of fault points to sample per test, 0 for no limit */
+  int fault_sample;
+  /* Seconds of wall time a sampled sweep may take, 0 for no limit */
+  int fault_budget;
+  /* Seed of sampled sweeps, and the generator state */
+  unsigned long fault_seed;
+  unsigned long fault_rand_state;
+  /* Fault points tried by the sampled sweep of the current test */
+  mptest__fault_point fault_tried[MPTEST__FAULT_TRIED_MAX];
+  int fault_tried_count;
+  /* Whether the current test was swept for faults */
+  int fault_swept;
+  /* Whether a test is running under mptest__fault_run_test(). Outside of it,
+   * fault points are neither counted nor failed. */
+  int fault_active;
+  /* Calls to fail in every test instead of sweeping, and the buffer holding
+   * their class names */
+  mptest__fault_target fault_index[MPTEST__FAULT_TARGET_MAX];
+  int fault_index_count;
+  char fault_index_spec[MPTEST__FAULT_SPEC_MAX];
+#if MPTEST_USE_DYN_ALLOC
+  /* Failures to replay instead of sweeping, and the file contents that their
+   * names point into */
+  mptest__fault_entry* fault_replay;
+  char* fault_replay_buf;
+#endif
+  /* File that failures found by sweeping are written to, or NULL */
+  FILE* fault_record;
 
 #if MPTEST_USE_LONGJMP
   mptest__longjmp_state longjmp_state;
@@ -249,15 +675,35 @@ struct mptest__state {
 #if MPTEST_USE_FUZZ
   mptest__fuzz_state fuzz_state;
 #endif
-};
 
-#include <stdio.h>
+#if MPTEST_USE_COVERAGE
+  mptest__coverage_state coverage_state;
+#endif
 
+#if MPTEST_USE_SYM
+  mptest__sym_state sym_state;
+#endif
+};
+
+MN_INTERNAL void
+mptest__state_after_test(struct mptest__state* state, mptest__result res);
+MN_INTERNAL void mptest__state_discard_failure(struct mptest__state* state);
 MN_INTERNAL mptest__result mptest__state_do_run_test(
     struct mptest__state* state, mptest__test_func test_func);
 MN_INTERNAL void mptest__state_print_indent(struct mptest__state* state);
+MN_INTERNAL void mptest__state_print_test(struct mptest__state* state);
 MN_INTERNAL void mptest__print_source_location(const char* file, int line);
+MN_INTERNAL int mptest__streq(const char* a, const char* b);
+
+MN_INTERNAL void mptest__fault_init(struct mptest__state* state);
+MN_INTERNAL void mptest__fault_destroy(struct mptest__state* state);
+MN_INTERNAL void mptest__fault_reset(struct mptest__state* state);
 MN_INTERNAL int mptest__fault(struct mptest__state* state, const char* class);
+MN_INTERNAL int mptest__fault_scheduled(struct mptest__state* state);
+MN_INTERNAL mptest__result
+mptest__fault_run_test(struct mptest__state* state, mptest__test_func test_func);
+MN_INTERNAL void
+mptest__fault_report_test(struct mptest__state* state, mptest__result res);
 
 #if MPTEST_USE_LONGJMP
 
@@ -273,6 +719,9 @@ MN_INTERNAL void mptest__longjmp_exec(
 /* Number of guard bytes to put at the top of each block. */
 #define MPTEST__LEAKCHECK_GUARD_BYTES_COUNT 16
 
+/* Byte written over quarantined memory, chosen to differ from the guard. */
+#define MPTEST__LEAKCHECK_POISON_BYTE 0xDD
+
 /* Flags kept for each block. */
 enum mptest__leakcheck_block_flags {
   /* The block was allocated with malloc(). */
@@ -282,7 +731,9 @@ enum mptest__leakcheck_block_flags {
   /* The block was the *input* of a reallocation with realloc(). */
   MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_OLD = 4,
   /* The block was the *result* of a reallocation with realloc(). */
-  MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_NEW = 8
+  MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_NEW = 8,
+  /* The block's memory is poisoned and held in the free quarantine. */
+  MPTEST__LEAKCHECK_BLOCK_FLAG_QUARANTINED = 16
 };
 
 /* Header kept in memory before each allocation. */
@@ -308,10 +759,24 @@ struct mptest__leakcheck_block {
   /* Source location where the malloc originated */
   const char* file;
   int line;
+  /* Source location where the block was freed or reallocated away */
+  const char* free_file;
+  int free_line;
+  /* Next (newer) block in the free quarantine */
+  struct mptest__leakcheck_block* quarantine_next;
   /* Flags (see `enum mptest__leakcheck_block_flags`) */
   enum mptest__leakcheck_block_flags flags;
 }; /* Cross fingers and hope for 64 bytes */
 
+/* A batch of block records, allocated at once and owned by one log. */
+struct mptest__leakcheck_chunk {
+  /* Next (older) chunk of the same log */
+  struct mptest__leakcheck_chunk* next;
+  /* Number of records handed out so far */
+  int used;
+  struct mptest__leakcheck_block blocks[MPTEST__LEAKCHECK_CHUNK_BLOCKS];
+};
+
 #define MPTEST__LEAKCHECK_HEADER_SIZEOF                                        \
   (sizeof(struct mptest__leakcheck_header))
 
@@ -327,6 +792,9 @@ MN_INTERNAL mptest__result
 mptest__leakcheck_after_test(struct mptest__state* state);
 MN_INTERNAL void
 mptest__leakcheck_report_test(struct mptest__state* state, mptest__result res);
+MN_INTERNAL int mptest__leakcheck_fault(
+    struct mptest__state* state, const char* class, const char* file,
+    int line);
 #endif
 
 #if MPTEST_USE_COLOR
@@ -349,6 +817,8 @@ mptest__leakcheck_report_test(struct mptest__state* state, mptest__result res);
 #define MPTEST__COLOR_SYM_STR ""
 #endif
 
+MN_INTERNAL double mptest__time_wall(void);
+
 #if MPTEST_USE_TIME
 MN_INTERNAL void mptest__time_init(struct mptest__state* state);
 MN_INTERNAL void mptest__time_destroy(struct mptest__state* state);
@@ -366,15 +836,48 @@ MN_INTERNAL int mptest__aparse_match_suite_name(
 
 #if MPTEST_USE_FUZZ
 MN_INTERNAL void mptest__fuzz_init(struct mptest__state* state);
+MN_INTERNAL void
+mptest__fuzz_seed(struct mptest__state* state, mptest_rand seed);
+MN_INTERNAL void mptest__fuzz_seed_words(mptest_rand* s, mptest_rand seed);
+MN_INTERNAL mptest_rand mptest__fuzz_next(mptest_rand* s);
+MN_INTERNAL mptest_rand
+mptest__fuzz_iteration_seed(struct mptest__state* state, int iteration);
+MN_INTERNAL void mptest__fuzz_destroy(struct mptest__state* state);
+MN_INTERNAL int mptest__fuzz_tick(struct mptest__state* state, int live);
+#if MPTEST_USE_DYN_ALLOC
+MN_INTERNAL void mptest__fuzz_tape_init(mptest__fuzz_tape* tape);
+MN_INTERNAL void mptest__fuzz_tape_destroy(mptest__fuzz_tape* tape);
+MN_INTERNAL int
+mptest__fuzz_tape_push(mptest__fuzz_tape* tape, mptest_rand word);
+MN_INTERNAL int
+mptest__fuzz_tape_copy(mptest__fuzz_tape* dst, const mptest__fuzz_tape* src);
+MN_INTERNAL mptest__result mptest__fuzz_run_tape(
+    struct mptest__state* state, mptest__test_func test_func, int iteration,
+    int mode);
+MN_INTERNAL mptest__result mptest__fuzz_shrink(
+    struct mptest__state* state, mptest__test_func test_func, int iteration,
+    mptest__result res);
+#endif
 MN_INTERNAL mptest__result
 mptest__fuzz_run_test(struct mptest__state* state, mptest__test_func test_func);
 MN_INTERNAL void
 mptest__fuzz_report_test(struct mptest__state* state, mptest__result res);
 #endif
 
-#if MPTEST_USE_SYM
+#if MPTEST_USE_COVERAGE
+MN_INTERNAL void mptest__coverage_init(struct mptest__state* state);
+MN_INTERNAL void mptest__coverage_destroy(struct mptest__state* state);
+MN_INTERNAL mptest__result mptest__coverage_run_test(
+    struct mptest__state* state, mptest__test_func test_func, int iters);
 MN_INTERNAL void
-mptest__sym_dump(mptest_sym* sym, mn_int32 parent_ref, mn_int32 indent);
+mptest__coverage_report_test(struct mptest__state* state, mptest__result res);
+#endif
+
+#if MPTEST_USE_SYM
+MN_INTERNAL void mptest__sym_cache_init(struct mptest__state* state);
+MN_INTERNAL void mptest__sym_cache_destroy(struct mptest__state* state);
+MN_INTERNAL void mptest__sym_diff(
+    struct mptest__state* state, mptest_sym* actual, mptest_sym* expected);
 MN_INTERNAL int mptest__sym_parse_do(
     mptest_sym_build* build_in, const mn__str_view in, const char** err_msg,
     mn_size* err_pos);
@@ -0,0 +1,191 @@
+#include "mptest_internal.h"
+
+#if MPTEST_USE_IO
+
+#if MPTEST__IO_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+/* Count a call of `class` at `file` and `line`, returning 1 if it should
+ * fail. */
+MN_INTERNAL int mptest__io_fault(
+    struct mptest__state* state, const char* class, const char* file,
+    int line)
+{
+#if MPTEST_USE_LEAKCHECK
+  /* Shares the leak checker's lock with the allocation hooks */
+  return mptest__leakcheck_fault(state, class, file, line);
+#else
+  return mptest__fault_at(state, class, file, line);
+#endif
+}
+
+/* Report a simulated failure through `errno` where that is meaningful. */
+MN_INTERNAL void mptest__io_set_errno(void)
+{
+#if MPTEST__IO_POSIX
+  errno = EIO;
+#endif
+}
+
+/* Determine how many of `count` units to transfer. A call that could move
+ * more than one unit is a "short_read" or "short_write" fault point, and
+ * moves only half of them when that fault is simulated. */
+MN_INTERNAL size_t mptest__io_short(
+    struct mptest__state* state, const char* class, const char* file,
+    int line, size_t count)
+{
+  if (count > 1 && mptest__io_fault(state, class, file, line)) {
+    return count / 2;
+  }
+  return count;
+}
+
+MN_API FILE* mptest__io_fopen(
+    struct mptest__state* state, const char* file, int line, const char* path,
+    const char* mode)
+{
+  if (mptest__io_fault(state, "open", file, line)) {
+    mptest__io_set_errno();
+    return NULL;
+  }
+  return fopen(path, mode);
+}
+
+MN_API size_t mptest__io_fread(
+    struct mptest__state* state, const char* file, int line, void* ptr,
+    size_t size, size_t nmemb, FILE* stream)
+{
+  if (mptest__io_fault(state, "read", file, line)) {
+    mptest__io_set_errno();
+    return 0;
+  }
+  nmemb = mptest__io_short(state, "short_read", file, line, nmemb);
+  return fread(ptr, size, nmemb, stream);
+}
+
+MN_API size_t mptest__io_fwrite(
+    struct mptest__state* state, const char* file, int line, const void* ptr,
+    size_t size, size_t nmemb, FILE* stream)
+{
+  if (mptest__io_fault(state, "write", file, line)) {
+    mptest__io_set_errno();
+    return 0;
+  }
+  nmemb = mptest__io_short(state, "short_write", file, line, nmemb);
+  return fwrite(ptr, size, nmemb, stream);
+}
+
+MN_API int mptest__io_fflush(
+    struct mptest__state* state, const char* file, int line, FILE* stream)
+{
+  if (mptest__io_fault(state, "fsync", file, line)) {
+    mptest__io_set_errno();
+    return EOF;
+  }
+  return fflush(stream);
+}
+
+MN_API int mptest__io_fclose(
+    struct mptest__state* state, const char* file, int line, FILE* stream)
+{
+  /* The stream is closed either way, so a simulated failure doesn't leak */
+  int faulted = mptest__io_fault(state, "close", file, line);
+  int res = fclose(stream);
+  if (faulted) {
+    mptest__io_set_errno();
+    return EOF;
+  }
+  return res;
+}
+
+#if MPTEST__IO_POSIX
+
+MN_API int mptest__io_open(
+    struct mptest__state* state, const char* file, int line, const char* path,
+    int flags, int mode)
+{
+  if (mptest__io_fault(state, "open", file, line)) {
+    errno = EIO;
+    return -1;
+  }
+  return open(path, flags, (mode_t)mode);
+}
+
+MN_API ssize_t mptest__io_read(
+    struct mptest__state* state, const char* file, int line, int fd,
+    void* buf, size_t count)
+{
+  if (mptest__io_fault(state, "read", file, line)) {
+    errno = EIO;
+    return -1;
+  }
+  count = mptest__io_short(state, "short_read", file, line, count);
+  return read(fd, buf, count);
+}
+
+MN_API ssize_t mptest__io_write(
+    struct mptest__state* state, const char* file, int line, int fd,
+    const void* buf, size_t count)
+{
+  if (mptest__io_fault(state, "write", file, line)) {
+    errno = EIO;
+    return -1;
+  }
+  count = mptest__io_short(state, "short_write", file, line, count);
+  return write(fd, buf, count);
+}
+
+MN_API ssize_t mptest__io_recv(
+    struct mptest__state* state, const char* file, int line, int fd,
+    void* buf, size_t len, int flags)
+{
+  if (mptest__io_fault(state, "read", file, line)) {
+    errno = ECONNRESET;
+    return -1;
+  }
+  len = mptest__io_short(state, "short_read", file, line, len);
+  return recv(fd, buf, len, flags);
+}
+
+MN_API ssize_t mptest__io_send(
+    struct mptest__state* state, const char* file, int line, int fd,
+    const void* buf, size_t len, int flags)
+{
+  if (mptest__io_fault(state, "write", file, line)) {
+    errno = ECONNRESET;
+    return -1;
+  }
+  len = mptest__io_short(state, "short_write", file, line, len);
+  return send(fd, buf, len, flags);
+}
+
+MN_API int mptest__io_fsync(
+    struct mptest__state* state, const char* file, int line, int fd)
+{
+  if (mptest__io_fault(state, "fsync", file, line)) {
+    errno = EIO;
+    return -1;
+  }
+  return fsync(fd);
+}
+
+MN_API int mptest__io_close(
+    struct mptest__state* state, const char* file, int line, int fd)
+{
+  /* Like fclose(), the descriptor is released even when close() fails */
+  int faulted = mptest__io_fault(state, "close", file, line);
+  int res = close(fd);
+  if (faulted) {
+    errno = EIO;
+    return -1;
+  }
+  return res;
+}
+
+#endif /* MPTEST__IO_POSIX */
+
+#endif /* MPTEST_USE_IO */
@@ -27,6 +27,36 @@ mptest__leakcheck_header_check_guard(struct mptest__leakcheck_header* header)
   return 1;
 }
 
+/* Fill the user memory of `block` with the poison byte. */
+MN_INTERNAL void
+mptest__leakcheck_block_poison(struct mptest__leakcheck_block* block)
+{
+  unsigned char* mem =
+      ((unsigned char*)block->header) + MPTEST__LEAKCHECK_HEADER_SIZEOF;
+  size_t i;
+  for (i = 0; i < block->block_size; i++) {
+    mem[i] = MPTEST__LEAKCHECK_POISON_BYTE;
+  }
+}
+
+/* Ensure that the user memory of `block` still holds the poison byte. Returns
+ * 1 if so, otherwise 0 with the offset of the first overwritten byte in
+ * `offset`. */
+MN_INTERNAL int mptest__leakcheck_block_check_poison(
+    struct mptest__leakcheck_block* block, size_t* offset)
+{
+  const unsigned char* mem =
+      ((const unsigned char*)block->header) + MPTEST__LEAKCHECK_HEADER_SIZEOF;
+  size_t i;
+  for (i = 0; i < block->block_size; i++) {
+    if (mem[i] != MPTEST__LEAKCHECK_POISON_BYTE) {
+      *offset = i;
+      return 0;
+    }
+  }
+  return 1;
+}
+
 /* Determine if `block` contains a `free()`able pointer. */
 MN_INTERNAL int
 mptest__leakcheck_block_has_freeable(struct mptest__leakcheck_block* block)
@@ -61,6 +91,9 @@ MN_INTERNAL void mptest__leakcheck_block_init(
   /* Save source info */
   block->file = file;
   block->line = line;
+  block->free_file = NULL;
+  block->free_line = 0;
+  block->quarantine_next = NULL;
 }
 
 /* Link a block to its respective header. */
@@ -72,57 +105,600 @@ MN_INTERNAL void mptest__leakcheck_block_link_header(
   header->block = block;
 }
 
+/* Initial capacity of the live pointer set, must be a power of two. */
+#define MPTEST__LEAKCHECK_PTRSET_INIT_CAPACITY 64
+
+MN_INTERNAL void mptest__leakcheck_ptrset_init(mptest__leakcheck_ptrset* set)
+{
+  set->slots = NULL;
+  set->capacity = 0;
+  set->size = 0;
+}
+
+MN_INTERNAL void
+mptest__leakcheck_ptrset_destroy(mptest__leakcheck_ptrset* set)
+{
+  if (set->slots) {
+    MN_FREE(set->slots);
+  }
+}
+
+/* Hash a pointer into a slot index of a set with `capacity` slots. */
+MN_INTERNAL size_t mptest__leakcheck_ptrset_hash(void* ptr, size_t capacity)
+{
+  /* Allocations are aligned, so the low bits carry no information. Fold them
+   * away and spread the rest with a Fibonacci multiplier. */
+  size_t h = (size_t)ptr;
+  h = (h >> 4) ^ (h >> 16);
+  h *= (size_t)0x9E3779B1UL;
+  return (h ^ (h >> 15)) & (capacity - 1);
+}
+
+/* Insert `ptr` into `set`, which must have a free slot. */
+MN_INTERNAL void
+mptest__leakcheck_ptrset_insert(mptest__leakcheck_ptrset* set, void* ptr)
+{
+  size_t i = mptest__leakcheck_ptrset_hash(ptr, set->capacity);
+  MN_ASSERT(set->size < set->capacity);
+  while (set->slots[i] != NULL) {
+    MN_ASSERT(set->slots[i] != ptr);
+    i = (i + 1) & (set->capacity - 1);
+  }
+  set->slots[i] = ptr;
+  set->size++;
+}
+
+/* Make room for one more pointer, keeping the load factor at or below 1/2.
+ * Returns nonzero if out of memory. */
+MN_INTERNAL int mptest__leakcheck_ptrset_reserve(mptest__leakcheck_ptrset* set)
+{
+  void** old_slots = set->slots;
+  size_t old_capacity = set->capacity;
+  size_t new_capacity;
+  size_t i;
+  if ((set->size + 1) * 2 <= set->capacity) {
+    return 0;
+  }
+  new_capacity =
+      old_capacity ? old_capacity * 2 : MPTEST__LEAKCHECK_PTRSET_INIT_CAPACITY;
+  set->slots = (void**)MN_MALLOC(sizeof(void*) * new_capacity);
+  if (set->slots == NULL) {
+    set->slots = old_slots;
+    return 1;
+  }
+  for (i = 0; i < new_capacity; i++) {
+    set->slots[i] = NULL;
+  }
+  set->capacity = new_capacity;
+  set->size = 0;
+  for (i = 0; i < old_capacity; i++) {
+    if (old_slots[i] != NULL) {
+      mptest__leakcheck_ptrset_insert(set, old_slots[i]);
+    }
+  }
+  if (old_slots) {
+    MN_FREE(old_slots);
+  }
+  return 0;
+}
+
+/* Find the slot holding `ptr`, or return `capacity` if it is not present. */
+MN_INTERNAL size_t
+mptest__leakcheck_ptrset_find(const mptest__leakcheck_ptrset* set, void* ptr)
+{
+  size_t i;
+  if (set->capacity == 0) {
+    return 0;
+  }
+  i = mptest__leakcheck_ptrset_hash(ptr, set->capacity);
+  while (set->slots[i] != NULL) {
+    if (set->slots[i] == ptr) {
+      return i;
+    }
+    i = (i + 1) & (set->capacity - 1);
+  }
+  return set->capacity;
+}
+
+MN_INTERNAL int
+mptest__leakcheck_ptrset_has(const mptest__leakcheck_ptrset* set, void* ptr)
+{
+  return mptest__leakcheck_ptrset_find(set, ptr) != set->capacity;
+}
+
+/* Remove `ptr` from `set`. Uses backward-shift deletion so that no tombstones
+ * are needed. */
+MN_INTERNAL void
+mptest__leakcheck_ptrset_remove(mptest__leakcheck_ptrset* set, void* ptr)
+{
+  size_t mask = set->capacity - 1;
+  size_t hole = mptest__leakcheck_ptrset_find(set, ptr);
+  size_t i = hole;
+  MN_ASSERT(hole != set->capacity);
+  set->slots[hole] = NULL;
+  set->size--;
+  while (1) {
+    size_t home;
+    i = (i + 1) & mask;
+    if (set->slots[i] == NULL) {
+      break;
+    }
+    home = mptest__leakcheck_ptrset_hash(set->slots[i], set->capacity);
+    /* Move the entry into the hole if its home slot does not lie cyclically
+     * within (hole, i]. */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      set->slots[hole] = set->slots[i];
+      set->slots[i] = NULL;
+      hole = i;
+    }
+  }
+}
+
+/* Remove every pointer from `set`, keeping its capacity. */
+MN_INTERNAL void mptest__leakcheck_ptrset_clear(mptest__leakcheck_ptrset* set)
+{
+  size_t i;
+  for (i = 0; i < set->capacity; i++) {
+    set->slots[i] = NULL;
+  }
+  set->size = 0;
+}
+
+#if MPTEST_USE_THREADS
+/* Thin wrappers over the platform's threading primitives. */
+#if defined(_WIN32)
+MN_INTERNAL void mptest__mutex_init(mptest__mutex* m)
+{
+  InitializeCriticalSection(m);
+}
+
+MN_INTERNAL void mptest__mutex_destroy(mptest__mutex* m)
+{
+  DeleteCriticalSection(m);
+}
+
+MN_INTERNAL void mptest__mutex_lock(mptest__mutex* m)
+{
+  EnterCriticalSection(m);
+}
+
+MN_INTERNAL void mptest__mutex_unlock(mptest__mutex* m)
+{
+  LeaveCriticalSection(m);
+}
+
+MN_INTERNAL void mptest__tls_init(mptest__tls_key* key) { *key = TlsAlloc(); }
+
+MN_INTERNAL void mptest__tls_destroy(mptest__tls_key* key) { TlsFree(*key); }
+
+MN_INTERNAL void* mptest__tls_get(mptest__tls_key* key)
+{
+  return TlsGetValue(*key);
+}
+
+MN_INTERNAL void mptest__tls_set(mptest__tls_key* key, void* value)
+{
+  TlsSetValue(*key, value);
+}
+
+MN_INTERNAL mptest__thread_id mptest__thread_self(void)
+{
+  return GetCurrentThreadId();
+}
+
+MN_INTERNAL int mptest__thread_equal(mptest__thread_id a, mptest__thread_id b)
+{
+  return a == b;
+}
+#else
+MN_INTERNAL void mptest__mutex_init(mptest__mutex* m)
+{
+  pthread_mutex_init(m, NULL);
+}
+
+MN_INTERNAL void mptest__mutex_destroy(mptest__mutex* m)
+{
+  pthread_mutex_destroy(m);
+}
+
+MN_INTERNAL void mptest__mutex_lock(mptest__mutex* m)
+{
+  pthread_mutex_lock(m);
+}
+
+MN_INTERNAL void mptest__mutex_unlock(mptest__mutex* m)
+{
+  pthread_mutex_unlock(m);
+}
+
+MN_INTERNAL void mptest__tls_init(mptest__tls_key* key)
+{
+  pthread_key_create(key, NULL);
+}
+
+MN_INTERNAL void mptest__tls_destroy(mptest__tls_key* key)
+{
+  pthread_key_delete(*key);
+}
+
+MN_INTERNAL void* mptest__tls_get(mptest__tls_key* key)
+{
+  return pthread_getspecific(*key);
+}
+
+MN_INTERNAL void mptest__tls_set(mptest__tls_key* key, void* value)
+{
+  pthread_setspecific(*key, value);
+}
+
+MN_INTERNAL mptest__thread_id mptest__thread_self(void)
+{
+  return pthread_self();
+}
+
+MN_INTERNAL int mptest__thread_equal(mptest__thread_id a, mptest__thread_id b)
+{
+  return pthread_equal(a, b);
+}
+#endif
+#endif
+
+/* Lock the state-wide fields (quarantine, failure info, thread logs). */
+MN_INTERNAL void
+mptest__leakcheck_lock(mptest__leakcheck_state* leakcheck_state)
+{
+#if MPTEST_USE_THREADS
+  mptest__mutex_lock(&leakcheck_state->lock);
+#else
+  MN__UNUSED(leakcheck_state);
+#endif
+}
+
+MN_INTERNAL void
+mptest__leakcheck_unlock(mptest__leakcheck_state* leakcheck_state)
+{
+#if MPTEST_USE_THREADS
+  mptest__mutex_unlock(&leakcheck_state->lock);
+#else
+  MN__UNUSED(leakcheck_state);
+#endif
+}
+
+/* Find and lock the live pointer shard responsible for `ptr`. */
+MN_INTERNAL mptest__leakcheck_shard* mptest__leakcheck_shard_lock(
+    mptest__leakcheck_state* leakcheck_state, void* ptr)
+{
+#if MPTEST_USE_THREADS
+  /* Use bits above the ones that pick a slot within the shard */
+  size_t h = ((size_t)ptr >> 4) * (size_t)0x9E3779B1UL;
+  mptest__leakcheck_shard* shard =
+      &leakcheck_state->live_shards
+           [(h >> 24) & (MPTEST__LEAKCHECK_SHARD_COUNT - 1)];
+  mptest__mutex_lock(&shard->lock);
+  return shard;
+#else
+  MN__UNUSED(ptr);
+  return &leakcheck_state->live_shards[0];
+#endif
+}
+
+MN_INTERNAL void mptest__leakcheck_shard_unlock(mptest__leakcheck_shard* shard)
+{
+#if MPTEST_USE_THREADS
+  mptest__mutex_unlock(&shard->lock);
+#else
+  MN__UNUSED(shard);
+#endif
+}
+
+/* Record `ptr` as live, returning nonzero if out of memory. */
+MN_INTERNAL int
+mptest__leakcheck_live_add(mptest__leakcheck_state* leakcheck_state, void* ptr)
+{
+  int err = 0;
+  mptest__leakcheck_shard* shard =
+      mptest__leakcheck_shard_lock(leakcheck_state, ptr);
+  if (!(err = mptest__leakcheck_ptrset_reserve(&shard->set))) {
+    mptest__leakcheck_ptrset_insert(&shard->set, ptr);
+  }
+  mptest__leakcheck_shard_unlock(shard);
+  return err;
+}
+
+/* Remove `ptr` from the live pointers, returning 1 if it was live. */
+MN_INTERNAL int
+mptest__leakcheck_live_take(mptest__leakcheck_state* leakcheck_state, void* ptr)
+{
+  int has;
+  mptest__leakcheck_shard* shard =
+      mptest__leakcheck_shard_lock(leakcheck_state, ptr);
+  if ((has = mptest__leakcheck_ptrset_has(&shard->set, ptr))) {
+    mptest__leakcheck_ptrset_remove(&shard->set, ptr);
+  }
+  mptest__leakcheck_shard_unlock(shard);
+  return has;
+}
+
+/* Return 1 if the calling thread is the one running the tests. */
+MN_INTERNAL int mptest__leakcheck_on_main_thread(struct mptest__state* state)
+{
+#if MPTEST_USE_THREADS
+  return mptest__thread_equal(
+      mptest__thread_self(), state->leakcheck_state.main_thread);
+#else
+  MN__UNUSED(state);
+  return 1;
+#endif
+}
+
+/* Count a fault point. Only calls made by the testing thread while faults
+ * are being checked are fault points, so the fault counters are only ever
+ * touched by that thread and no lock is needed. Calls from other threads would
+ * make the fault indices depend on scheduling anyway. */
+MN_INTERNAL int mptest__leakcheck_fault(
+    struct mptest__state* state, const char* class, const char* file,
+    int line)
+{
+  if (!state->fault_active || !mptest__leakcheck_on_main_thread(state)) {
+    return 0;
+  }
+  return mptest__fault_at(state, class, file, line);
+}
+
+MN_INTERNAL void mptest__leakcheck_log_init(mptest__leakcheck_log* log)
+{
+  log->first_block = NULL;
+  log->top_block = NULL;
+  log->chunks = NULL;
+  log->total_allocations = 0;
+  log->total_calls = 0;
+}
+
+/* Get the calling thread's allocation log, or NULL if out of memory. */
+MN_INTERNAL mptest__leakcheck_log*
+mptest__leakcheck_log_get(struct mptest__state* state)
+{
+#if MPTEST_USE_THREADS
+  mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  mptest__leakcheck_log* log;
+  if (mptest__leakcheck_on_main_thread(state)) {
+    return &leakcheck_state->log;
+  }
+  log = (mptest__leakcheck_log*)mptest__tls_get(&leakcheck_state->log_key);
+  if (log == NULL) {
+    /* First allocation on this thread: register a new log */
+    log = (mptest__leakcheck_log*)MN_MALLOC(sizeof(mptest__leakcheck_log));
+    if (log == NULL) {
+      return NULL;
+    }
+    mptest__leakcheck_log_init(log);
+    mptest__leakcheck_lock(leakcheck_state);
+    log->next = leakcheck_state->thread_logs;
+    leakcheck_state->thread_logs = log;
+    mptest__leakcheck_unlock(leakcheck_state);
+    mptest__tls_set(&leakcheck_state->log_key, log);
+  }
+  return log;
+#else
+  return &state->leakcheck_state.log;
+#endif
+}
+
+/* Append `block` to `log`. */
+MN_INTERNAL void mptest__leakcheck_log_push(
+    mptest__leakcheck_log* log, struct mptest__leakcheck_block* block)
+{
+  block->prev = log->top_block;
+  block->next = NULL;
+  if (log->top_block) {
+    log->top_block->next = block;
+  } else {
+    log->first_block = block;
+  }
+  log->top_block = block;
+}
+
+/* Hand out a block record from the newest chunk of `log`, starting a new chunk
+ * when it is full. Returns NULL if out of memory. */
+MN_INTERNAL struct mptest__leakcheck_block*
+mptest__leakcheck_log_block_alloc(mptest__leakcheck_log* log)
+{
+  mptest__leakcheck_chunk* chunk = log->chunks;
+  if (chunk == NULL || chunk->used == MPTEST__LEAKCHECK_CHUNK_BLOCKS) {
+    chunk =
+        (mptest__leakcheck_chunk*)MN_MALLOC(sizeof(mptest__leakcheck_chunk));
+    if (chunk == NULL) {
+      return NULL;
+    }
+    chunk->next = log->chunks;
+    chunk->used = 0;
+    log->chunks = chunk;
+  }
+  return &chunk->blocks[chunk->used++];
+}
+
+/* Give back the block record most recently handed out by `log`, which must
+ * not have been pushed yet. */
+MN_INTERNAL void mptest__leakcheck_log_block_unalloc(mptest__leakcheck_log* log)
+{
+  log->chunks->used--;
+}
+
+/* Move the chunks of `from` onto the chunk list of `to`. */
+MN_INTERNAL void mptest__leakcheck_log_move_chunks(
+    mptest__leakcheck_log* to, mptest__leakcheck_log* from)
+{
+  mptest__leakcheck_chunk* last = from->chunks;
+  if (last == NULL) {
+    return;
+  }
+  while (last->next) {
+    last = last->next;
+  }
+  last->next = to->chunks;
+  to->chunks = from->chunks;
+  from->chunks = NULL;
+}
+
+/* Move the blocks of every other thread's log onto the end of the main log.
+ * Other threads must not be allocating while this runs. */
+MN_INTERNAL void mptest__leakcheck_merge(struct mptest__state* state)
+{
+#if MPTEST_USE_THREADS
+  mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  mptest__leakcheck_log* log;
+  mptest__leakcheck_lock(leakcheck_state);
+  for (log = leakcheck_state->thread_logs; log; log = log->next) {
+    if (log->first_block) {
+      log->first_block->prev = leakcheck_state->log.top_block;
+      if (leakcheck_state->log.top_block) {
+        leakcheck_state->log.top_block->next = log->first_block;
+      } else {
+        leakcheck_state->log.first_block = log->first_block;
+      }
+      leakcheck_state->log.top_block = log->top_block;
+    }
+    mptest__leakcheck_log_move_chunks(&leakcheck_state->log, log);
+    leakcheck_state->log.total_allocations += log->total_allocations;
+    leakcheck_state->log.total_calls += log->total_calls;
+    mptest__leakcheck_log_init(log);
+  }
+  mptest__leakcheck_unlock(leakcheck_state);
+#else
+  MN__UNUSED(state);
+#endif
+}
+
+/* Find the most recent block record whose user pointer is `ptr`. Only block
+ * records (which mptest owns) are examined, never the pointer itself. Blocks
+ * that other threads have not yet merged are not searched. */
+MN_INTERNAL struct mptest__leakcheck_block*
+mptest__leakcheck_find_block(struct mptest__state* state, void* ptr)
+{
+  mptest__leakcheck_log* log = mptest__leakcheck_log_get(state);
+  struct mptest__leakcheck_block* block;
+  while (log) {
+    for (block = log->top_block; block; block = block->prev) {
+      if (((char*)block->header) + MPTEST__LEAKCHECK_HEADER_SIZEOF ==
+          (char*)ptr) {
+        return block;
+      }
+    }
+    log = (log == &state->leakcheck_state.log) ? NULL
+                                               : &state->leakcheck_state.log;
+  }
+  return NULL;
+}
+
 /* Initialize malloc-checking state. */
 MN_INTERNAL void mptest__leakcheck_init(struct mptest__state* state)
 {
   mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  int i;
   leakcheck_state->test_leak_checking = 0;
-  leakcheck_state->first_block = NULL;
-  leakcheck_state->top_block = NULL;
-  leakcheck_state->total_allocations = 0;
-  leakcheck_state->total_calls = 0;
+  mptest__leakcheck_log_init(&leakcheck_state->log);
+  for (i = 0; i < MPTEST__LEAKCHECK_SHARD_COUNT; i++) {
+    mptest__leakcheck_ptrset_init(&leakcheck_state->live_shards[i].set);
+#if MPTEST_USE_THREADS
+    mptest__mutex_init(&leakcheck_state->live_shards[i].lock);
+#endif
+  }
   leakcheck_state->fall_through = 0;
   leakcheck_state->fail_reason = MPTEST__LEAKCHECK_PASS;
   leakcheck_state->fail_file = NULL;
   leakcheck_state->fail_line = 0;
   leakcheck_state->fail_ptr = NULL;
+  leakcheck_state->fail_block = NULL;
+  leakcheck_state->fail_offset = 0;
+  leakcheck_state->quarantine_limit = 0;
+  leakcheck_state->quarantine_bytes = 0;
+  leakcheck_state->quarantine_head = NULL;
+  leakcheck_state->quarantine_tail = NULL;
+#if MPTEST_USE_THREADS
+  leakcheck_state->main_thread = mptest__thread_self();
+  mptest__tls_init(&leakcheck_state->log_key);
+  leakcheck_state->thread_logs = NULL;
+  mptest__mutex_init(&leakcheck_state->lock);
+#endif
 }
 
-/* Destroy malloc-checking state. */
-MN_INTERNAL void mptest__leakcheck_destroy(struct mptest__state* state)
+/* Free all block records and the memory they still own. */
+MN_INTERNAL void mptest__leakcheck_free_blocks(struct mptest__state* state)
 {
   /* Walk the malloc list, destroying everything */
-  struct mptest__leakcheck_block* current = state->leakcheck_state.first_block;
+  struct mptest__leakcheck_block* current;
+  mptest__leakcheck_chunk* chunk;
+  mptest__leakcheck_merge(state);
+  current = state->leakcheck_state.log.first_block;
   while (current) {
-    struct mptest__leakcheck_block* prev = current;
-    if (mptest__leakcheck_block_has_freeable(current)) {
+    if (mptest__leakcheck_block_has_freeable(current) ||
+        (current->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_QUARANTINED)) {
       MN_FREE(current->header);
     }
     current = current->next;
+  }
+  /* The block records themselves live in the chunks */
+  chunk = state->leakcheck_state.log.chunks;
+  while (chunk) {
+    mptest__leakcheck_chunk* prev = chunk;
+    chunk = chunk->next;
     MN_FREE(prev);
   }
+  mptest__leakcheck_log_init(&state->leakcheck_state.log);
 }
 
-/* Reset (NOT destroy) malloc-checking state. */
-/* For now, this is equivalent to a destruction. This may not be the case in
- * the future. */
+/* Destroy malloc-checking state. */
+MN_INTERNAL void mptest__leakcheck_destroy(struct mptest__state* state)
+{
+  mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  int i;
+  mptest__leakcheck_free_blocks(state);
+  for (i = 0; i < MPTEST__LEAKCHECK_SHARD_COUNT; i++) {
+    mptest__leakcheck_ptrset_destroy(&leakcheck_state->live_shards[i].set);
+#if MPTEST_USE_THREADS
+    mptest__mutex_destroy(&leakcheck_state->live_shards[i].lock);
+#endif
+  }
+#if MPTEST_USE_THREADS
+  while (leakcheck_state->thread_logs) {
+    mptest__leakcheck_log* next = leakcheck_state->thread_logs->next;
+    MN_FREE(leakcheck_state->thread_logs);
+    leakcheck_state->thread_logs = next;
+  }
+  mptest__tls_destroy(&leakcheck_state->log_key);
+  mptest__mutex_destroy(&leakcheck_state->lock);
+#endif
+}
+
+/* Reset (NOT destroy) malloc-checking state. Block records are freed, while
+ * settings, live pointer set capacity and per-thread logs are kept. */
 MN_INTERNAL void mptest__leakcheck_reset(struct mptest__state* state)
 {
-  /* Preserve `test_leak_checking` */
-  mptest__leakcheck_mode test_leak_checking =
-      state->leakcheck_state.test_leak_checking;
-  /* Preserve fall_through */
-  int fall_through = state->leakcheck_state.fall_through;
-  mptest__leakcheck_destroy(state);
-  mptest__leakcheck_init(state);
-  state->leakcheck_state.test_leak_checking = test_leak_checking;
-  state->leakcheck_state.fall_through = fall_through;
+  mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  int i;
+  mptest__leakcheck_free_blocks(state);
+  for (i = 0; i < MPTEST__LEAKCHECK_SHARD_COUNT; i++) {
+    mptest__leakcheck_ptrset_clear(&leakcheck_state->live_shards[i].set);
+  }
+  leakcheck_state->fail_reason = MPTEST__LEAKCHECK_PASS;
+  leakcheck_state->fail_file = NULL;
+  leakcheck_state->fail_line = 0;
+  leakcheck_state->fail_ptr = NULL;
+  leakcheck_state->fail_block = NULL;
+  leakcheck_state->fail_offset = 0;
+  leakcheck_state->quarantine_bytes = 0;
+  leakcheck_state->quarantine_head = NULL;
+  leakcheck_state->quarantine_tail = NULL;
+#if MPTEST_USE_THREADS
+  leakcheck_state->main_thread = mptest__thread_self();
+#endif
 }
 
 /* Check the block record for leaks, returning 1 if there are any. */
 MN_INTERNAL int mptest__leakcheck_has_leaks(struct mptest__state* state)
 {
-  struct mptest__leakcheck_block* current = state->leakcheck_state.first_block;
+  struct mptest__leakcheck_block* current =
+      state->leakcheck_state.log.first_block;
   while (current) {
     if (mptest__leakcheck_block_has_freeable(current)) {
       return 1;
@@ -142,6 +718,120 @@ MN_INTERNAL void mptest__leakcheck_error(
   state->fail_line = line;
 }
 
+/* Fail the test because of `fail_reason`. On the testing thread this jumps
+ * out of the test and does not return. On other threads only the first
+ * failure is recorded, and the caller must back out of the operation. */
+MN_INTERNAL void mptest__leakcheck_fail(
+    struct mptest__state* state, mptest__leakcheck_fail_reason fail_reason,
+    const char* file, int line, void* fail_ptr,
+    struct mptest__leakcheck_block* fail_block)
+{
+  mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  mptest__leakcheck_lock(leakcheck_state);
+  if (leakcheck_state->fail_reason == MPTEST__LEAKCHECK_PASS ||
+      mptest__leakcheck_on_main_thread(state)) {
+    mptest__leakcheck_error(leakcheck_state, fail_reason, file, line, fail_ptr);
+    leakcheck_state->fail_block = fail_block;
+  }
+  mptest__leakcheck_unlock(leakcheck_state);
+  if (fail_reason == MPTEST__LEAKCHECK_NOMEM) {
+    mptest_ex_nomem();
+  } else {
+    mptest_ex_bad_alloc();
+  }
+  if (mptest__leakcheck_on_main_thread(state)) {
+    state->fail_data.memory_block = fail_ptr;
+    mptest__longjmp_exec(
+        state,
+        fail_reason == MPTEST__LEAKCHECK_NOMEM ? MPTEST__FAIL_REASON_NOMEM
+                                               : MPTEST__FAIL_REASON_NONE,
+        file, line, NULL);
+  }
+}
+
+/* Remove the oldest block from the quarantine and release its memory,
+ * returning 1 (and the user pointer in `bad_ptr`) if the block's poison was
+ * disturbed. */
+MN_INTERNAL int mptest__leakcheck_quarantine_evict(
+    struct mptest__state* state, struct mptest__leakcheck_block** bad_block,
+    void** bad_ptr)
+{
+  mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  struct mptest__leakcheck_block* block = leakcheck_state->quarantine_head;
+  size_t offset;
+  int intact;
+  MN_ASSERT(block);
+  leakcheck_state->quarantine_head = block->quarantine_next;
+  if (leakcheck_state->quarantine_head == NULL) {
+    leakcheck_state->quarantine_tail = NULL;
+  }
+  leakcheck_state->quarantine_bytes -= block->block_size;
+  block->quarantine_next = NULL;
+  intact = mptest__leakcheck_block_check_poison(block, &offset);
+  if (!intact) {
+    *bad_block = block;
+    *bad_ptr = ((char*)block->header) + MPTEST__LEAKCHECK_HEADER_SIZEOF;
+    leakcheck_state->fail_offset = offset;
+  }
+  block->flags ^= MPTEST__LEAKCHECK_BLOCK_FLAG_QUARANTINED;
+  MN_FREE(block->header);
+  return !intact;
+}
+
+/* Poison `block` and hold its memory in the quarantine instead of releasing
+ * it. Older blocks are evicted (and checked) once the quarantine holds more
+ * than `quarantine_limit` bytes. */
+MN_INTERNAL void mptest__leakcheck_quarantine_push(
+    struct mptest__state* state, struct mptest__leakcheck_block* block,
+    const char* file, int line)
+{
+  mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  struct mptest__leakcheck_block* bad_block = NULL;
+  void* bad_ptr = NULL;
+  mptest__leakcheck_block_poison(block);
+  mptest__leakcheck_lock(leakcheck_state);
+  block->flags |= MPTEST__LEAKCHECK_BLOCK_FLAG_QUARANTINED;
+  if (leakcheck_state->quarantine_tail == NULL) {
+    leakcheck_state->quarantine_head = block;
+  } else {
+    leakcheck_state->quarantine_tail->quarantine_next = block;
+  }
+  leakcheck_state->quarantine_tail = block;
+  leakcheck_state->quarantine_bytes += block->block_size;
+  while (leakcheck_state->quarantine_bytes >
+             leakcheck_state->quarantine_limit &&
+         bad_block == NULL) {
+    mptest__leakcheck_quarantine_evict(state, &bad_block, &bad_ptr);
+  }
+  mptest__leakcheck_unlock(leakcheck_state);
+  if (bad_block) {
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_USE_AFTER_FREE, file, line, bad_ptr,
+        bad_block);
+  }
+}
+
+/* Check every quarantined block for writes, returning 1 on the first block
+ * whose poison was disturbed. */
+MN_INTERNAL int mptest__leakcheck_quarantine_check(struct mptest__state* state)
+{
+  mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  struct mptest__leakcheck_block* block = leakcheck_state->quarantine_head;
+  size_t offset;
+  while (block) {
+    if (!mptest__leakcheck_block_check_poison(block, &offset)) {
+      mptest__leakcheck_error(
+          leakcheck_state, MPTEST__LEAKCHECK_USE_AFTER_FREE, NULL, 0,
+          ((char*)block->header) + MPTEST__LEAKCHECK_HEADER_SIZEOF);
+      leakcheck_state->fail_block = block;
+      leakcheck_state->fail_offset = offset;
+      return 1;
+    }
+    block = block->quarantine_next;
+  }
+  return 0;
+}
+
 MN_API void* mptest__leakcheck_hook_malloc(
     struct mptest__state* state, const char* file, int line, size_t size)
 {
@@ -154,65 +844,58 @@ MN_API void* mptest__leakcheck_hook_malloc(
   /* Pointer to return to the user */
   char* out_ptr;
   struct mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  /* Allocation log of the calling thread */
+  mptest__leakcheck_log* log;
   if (!leakcheck_state->test_leak_checking) {
     return (char*)MN_MALLOC(size);
   }
-  if (mptest__fault(state, "malloc")) {
+  if (mptest__leakcheck_fault(state, "malloc", file, line)) {
+    return NULL;
+  }
+  if ((log = mptest__leakcheck_log_get(state)) == NULL) {
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_NOMEM, file, line, NULL, NULL);
     return NULL;
   }
   if (leakcheck_state->fall_through) {
-    leakcheck_state->total_calls++;
+    log->total_calls++;
     return (char*)MN_MALLOC(size);
   }
   /* Allocate the memory the user requested + space for the header */
   base_ptr = (char*)MN_MALLOC(size + MPTEST__LEAKCHECK_HEADER_SIZEOF);
   if (base_ptr == NULL) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_NOMEM, file, line, NULL);
-    state->fail_data.memory_block = NULL;
-    mptest_ex_nomem();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NOMEM, file, line, NULL);
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_NOMEM, file, line, NULL, NULL);
+    return NULL;
   }
-  /* Allocate memory for the block_info structure */
-  block_info = (struct mptest__leakcheck_block*)MN_MALLOC(
-      sizeof(struct mptest__leakcheck_block));
-  if (block_info == NULL) {
+  /* Get a record for the block_info structure */
+  block_info = mptest__leakcheck_log_block_alloc(log);
+  /* Return the base pointer offset by the header amount */
+  out_ptr = base_ptr + MPTEST__LEAKCHECK_HEADER_SIZEOF;
+  /* Record the new pointer */
+  if (block_info == NULL ||
+      mptest__leakcheck_live_add(leakcheck_state, out_ptr)) {
     MN_FREE(base_ptr);
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_NOMEM, file, line, NULL);
-    state->fail_data.memory_block = NULL;
-    mptest_ex_nomem();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NOMEM, file, line, NULL);
+    if (block_info) {
+      mptest__leakcheck_log_block_unalloc(log);
+    }
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_NOMEM, file, line, NULL, NULL);
+    return NULL;
   }
   /* Setup the header */
   header = (struct mptest__leakcheck_header*)base_ptr;
   mptest__leakcheck_header_set_guard(header);
-  /* Setup the block_info */
-  if (leakcheck_state->first_block == NULL) {
-    /* If `state->first_block == NULL`, then this is the first allocation.
-     * Use NULL as the previous value, and then set the `first_block` and
-     * `top_block` to the new block. */
-    mptest__leakcheck_block_init(
-        block_info, size, NULL, MPTEST__LEAKCHECK_BLOCK_FLAG_INITIAL, file,
-        line);
-    leakcheck_state->first_block = block_info;
-    leakcheck_state->top_block = block_info;
-  } else {
-    /* If this isn't the first allocation, use `state->top_block` as the
-     * previous block. */
-    mptest__leakcheck_block_init(
-        block_info, size, leakcheck_state->top_block,
-        MPTEST__LEAKCHECK_BLOCK_FLAG_INITIAL, file, line);
-    leakcheck_state->top_block = block_info;
-  }
+  /* Setup the block_info and add it to the log */
+  mptest__leakcheck_block_init(
+      block_info, size, NULL, MPTEST__LEAKCHECK_BLOCK_FLAG_INITIAL, file, line);
+  mptest__leakcheck_log_push(log, block_info);
   /* Link the header and block_info together */
   mptest__leakcheck_block_link_header(block_info, header);
-  /* Return the base pointer offset by the header amount */
-  out_ptr = base_ptr + MPTEST__LEAKCHECK_HEADER_SIZEOF;
   /* Increment the total number of allocations */
-  leakcheck_state->total_allocations++;
+  log->total_allocations++;
   /* Increment the total number of calls */
-  leakcheck_state->total_calls++;
+  log->total_calls++;
   return out_ptr;
 }
 
@@ -222,50 +905,54 @@ MN_API void mptest__leakcheck_hook_free(
   struct mptest__leakcheck_header* header;
   struct mptest__leakcheck_block* block_info;
   struct mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  mptest__leakcheck_log* log;
   if (!leakcheck_state->test_leak_checking || leakcheck_state->fall_through) {
     MN_FREE(ptr);
     return;
   }
   if (ptr == NULL) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_FREE_OF_NULL, file, line, NULL);
-    state->fail_data.memory_block = NULL;
-    mptest_ex_bad_alloc();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NONE, file, line, NULL);
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_FREE_OF_NULL, file, line, NULL, NULL);
+    return;
+  }
+  /* Ensure that the pointer is live before touching its header */
+  if (!mptest__leakcheck_live_take(leakcheck_state, ptr)) {
+    mptest__leakcheck_fail_reason reason = MPTEST__LEAKCHECK_FREE_OF_INVALID;
+    block_info = mptest__leakcheck_find_block(state, ptr);
+    if (block_info == NULL) {
+      /* Never allocated, or allocated before leak checking began */
+    } else if (block_info->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_FREED) {
+      reason = MPTEST__LEAKCHECK_FREE_OF_FREED;
+    } else if (block_info->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_OLD) {
+      reason = MPTEST__LEAKCHECK_FREE_OF_REALLOCED;
+    }
+    mptest__leakcheck_fail(state, reason, file, line, ptr, block_info);
+    return;
   }
   /* Retrieve header by subtracting header size from pointer */
   header =
       (struct
        mptest__leakcheck_header*)((char*)ptr - MPTEST__LEAKCHECK_HEADER_SIZEOF);
-  /* TODO: check for SIGSEGV here */
   if (!mptest__leakcheck_header_check_guard(header)) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_FREE_OF_INVALID, file, line, ptr);
-    state->fail_data.memory_block = ptr;
-    mptest_ex_bad_alloc();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NONE, file, line, NULL);
+    /* The header was overwritten by the program */
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_FREE_OF_INVALID, file, line, ptr, NULL);
+    return;
   }
   block_info = header->block;
-  /* Ensure that the pointer has not been freed or reallocated already */
-  if (block_info->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_FREED) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_FREE_OF_FREED, file, line, ptr);
-    state->fail_data.memory_block = ptr;
-    mptest_ex_bad_alloc();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NONE, file, line, NULL);
-  }
-  if (block_info->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_OLD) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_FREE_OF_REALLOCED, file, line, ptr);
-    state->fail_data.memory_block = ptr;
-    mptest_ex_bad_alloc();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NONE, file, line, NULL);
-  }
-  /* We can finally `free()` the pointer */
-  MN_FREE(header);
   block_info->flags |= MPTEST__LEAKCHECK_BLOCK_FLAG_FREED;
+  block_info->free_file = file;
+  block_info->free_line = line;
   /* Decrement the total number of allocations */
-  leakcheck_state->total_allocations--;
+  if ((log = mptest__leakcheck_log_get(state)) != NULL) {
+    log->total_allocations--;
+  }
+  /* We can finally `free()` the pointer, or hold onto it for checking */
+  if (leakcheck_state->quarantine_limit) {
+    mptest__leakcheck_quarantine_push(state, block_info, file, line);
+  } else {
+    MN_FREE(header);
+  }
 }
 
 MN_API void* mptest__leakcheck_hook_realloc(
@@ -280,97 +967,123 @@ MN_API void* mptest__leakcheck_hook_realloc(
   struct mptest__leakcheck_block* new_block_info;
   /* Pointer to return to the user */
   char* out_ptr;
+  size_t i;
+  size_t copy_size;
   struct mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
+  /* Allocation log of the calling thread */
+  mptest__leakcheck_log* log;
   if (!leakcheck_state->test_leak_checking) {
     return (void*)MN_REALLOC(old_ptr, new_size);
   }
-  if (mptest__fault(state, "realloc")) {
+  if (mptest__leakcheck_fault(state, "realloc", file, line)) {
+    return NULL;
+  }
+  if ((log = mptest__leakcheck_log_get(state)) == NULL) {
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_NOMEM, file, line, old_ptr, NULL);
     return NULL;
   }
   if (leakcheck_state->fall_through) {
-    leakcheck_state->total_calls++;
+    log->total_calls++;
     return (char*)MN_REALLOC(old_ptr, new_size);
   }
+  if (old_ptr == NULL) {
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_REALLOC_OF_NULL, file, line, NULL, NULL);
+    return NULL;
+  }
+  /* Take the pointer out of the live set before touching its header, so that
+   * no other thread can free or reallocate it meanwhile */
+  if (!mptest__leakcheck_live_take(leakcheck_state, old_ptr)) {
+    mptest__leakcheck_fail_reason reason =
+        MPTEST__LEAKCHECK_REALLOC_OF_INVALID;
+    old_block_info = mptest__leakcheck_find_block(state, old_ptr);
+    if (old_block_info == NULL) {
+      /* Never allocated, or allocated before leak checking began */
+    } else if (old_block_info->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_FREED) {
+      reason = MPTEST__LEAKCHECK_REALLOC_OF_FREED;
+    } else if (
+        old_block_info->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_OLD) {
+      reason = MPTEST__LEAKCHECK_REALLOC_OF_REALLOCED;
+    }
+    mptest__leakcheck_fail(state, reason, file, line, old_ptr, old_block_info);
+    return NULL;
+  }
   old_header =
       (struct
        mptest__leakcheck_header*)((char*)old_ptr - MPTEST__LEAKCHECK_HEADER_SIZEOF);
-  old_block_info = old_header->block;
-  if (old_ptr == NULL) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_REALLOC_OF_NULL, file, line, NULL);
-    state->fail_data.memory_block = NULL;
-    mptest_ex_bad_alloc();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NONE, file, line, NULL);
-  }
   if (!mptest__leakcheck_header_check_guard(old_header)) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_REALLOC_OF_INVALID, file, line,
-        old_ptr);
-    state->fail_data.memory_block = old_ptr;
-    mptest_ex_bad_alloc();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NONE, file, line, NULL);
-  }
-  if (old_block_info->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_FREED) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_REALLOC_OF_FREED, file, line,
-        old_ptr);
-    state->fail_data.memory_block = old_ptr;
-    mptest_ex_bad_alloc();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NONE, file, line, NULL);
+    /* The header was overwritten by the program */
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_REALLOC_OF_INVALID, file, line, old_ptr,
+        NULL);
+    return NULL;
   }
-  if (old_block_info->flags & MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_OLD) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_REALLOC_OF_REALLOCED, file, line,
-        old_ptr);
-    state->fail_data.memory_block = old_ptr;
-    mptest_ex_bad_alloc();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NONE, file, line, NULL);
+  old_block_info = old_header->block;
+  /* Get a record for the new block_info structure */
+  new_block_info = mptest__leakcheck_log_block_alloc(log);
+  if (new_block_info == NULL) {
+    /* Still allocated, so put it back */
+    mptest__leakcheck_live_add(leakcheck_state, old_ptr);
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_NOMEM, file, line, old_ptr, NULL);
+    return NULL;
   }
-  /* Allocate the memory the user requested + space for the header */
-  base_ptr =
-      (char*)MN_REALLOC(old_header, new_size + MPTEST__LEAKCHECK_HEADER_SIZEOF);
+  /* Allocate the memory the user requested + space for the header. This is
+   * always a fresh block, so that the old one stays intact until the new one
+   * is registered. */
+  base_ptr = (char*)MN_MALLOC(new_size + MPTEST__LEAKCHECK_HEADER_SIZEOF);
   if (base_ptr == NULL) {
-    state->fail_data.memory_block = old_ptr;
-    mptest_ex_nomem();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NOMEM, file, line, NULL);
+    mptest__leakcheck_log_block_unalloc(log);
+    /* The old block is untouched, so put it back */
+    mptest__leakcheck_live_add(leakcheck_state, old_ptr);
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_NOMEM, file, line, old_ptr, NULL);
+    return NULL;
   }
-  /* Allocate memory for the new block_info structure */
-  new_block_info = (struct mptest__leakcheck_block*)MN_MALLOC(
-      sizeof(struct mptest__leakcheck_block));
-  if (new_block_info == NULL) {
-    mptest__leakcheck_error(
-        leakcheck_state, MPTEST__LEAKCHECK_NOMEM, file, line, NULL);
-    state->fail_data.memory_block = old_ptr;
-    mptest_ex_nomem();
-    mptest__longjmp_exec(state, MPTEST__FAIL_REASON_NOMEM, file, line, NULL);
+  out_ptr = base_ptr + MPTEST__LEAKCHECK_HEADER_SIZEOF;
+  /* Record the new pointer in place of the old one */
+  if (mptest__leakcheck_live_add(leakcheck_state, out_ptr)) {
+    MN_FREE(base_ptr);
+    mptest__leakcheck_log_block_unalloc(log);
+    mptest__leakcheck_live_add(leakcheck_state, old_ptr);
+    mptest__leakcheck_fail(
+        state, MPTEST__LEAKCHECK_NOMEM, file, line, old_ptr, NULL);
+    return NULL;
+  }
+  /* Move the contents over */
+  copy_size = old_block_info->block_size < new_size
+                  ? old_block_info->block_size
+                  : new_size;
+  for (i = 0; i < copy_size; i++) {
+    out_ptr[i] = ((char*)old_ptr)[i];
   }
   /* Setup the header */
   new_header = (struct mptest__leakcheck_header*)base_ptr;
   /* Set the guard again (double bag it per se) */
   mptest__leakcheck_header_set_guard(new_header);
-  /* Setup the block_info */
-  if (leakcheck_state->first_block == NULL) {
-    mptest__leakcheck_block_init(
-        new_block_info, new_size, NULL,
-        MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_NEW, file, line);
-    leakcheck_state->first_block = new_block_info;
-    leakcheck_state->top_block = new_block_info;
-  } else {
-    mptest__leakcheck_block_init(
-        new_block_info, new_size, leakcheck_state->top_block,
-        MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_NEW, file, line);
-    leakcheck_state->top_block = new_block_info;
-  }
+  /* Setup the block_info and add it to the log */
+  mptest__leakcheck_block_init(
+      new_block_info, new_size, NULL, MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_NEW,
+      file, line);
+  mptest__leakcheck_log_push(log, new_block_info);
   /* Mark `old_block_info` as reallocation target */
   old_block_info->flags |= MPTEST__LEAKCHECK_BLOCK_FLAG_REALLOC_OLD;
+  old_block_info->free_file = file;
+  old_block_info->free_line = line;
   /* Link the block with its respective header */
   mptest__leakcheck_block_link_header(new_block_info, new_header);
   /* Finally, indicate the new allocation in the realloc chain */
   old_block_info->realloc_next = new_block_info;
   new_block_info->realloc_prev = old_block_info;
-  out_ptr = base_ptr + MPTEST__LEAKCHECK_HEADER_SIZEOF;
   /* Increment the total number of calls */
-  leakcheck_state->total_calls++;
+  log->total_calls++;
+  /* The old block can now be released, or held onto for checking */
+  if (leakcheck_state->quarantine_limit) {
+    mptest__leakcheck_quarantine_push(state, old_block_info, file, line);
+  } else {
+    MN_FREE(old_header);
+  }
   return out_ptr;
 }
 
@@ -379,6 +1092,12 @@ MN_API void mptest__leakcheck_set(struct mptest__state* state, int on)
   state->leakcheck_state.test_leak_checking = on;
 }
 
+MN_API void
+mptest__leakcheck_set_quarantine(struct mptest__state* state, size_t bytes)
+{
+  state->leakcheck_state.quarantine_limit = bytes;
+}
+
 MN_API void mptest_ex_nomem(void) { mptest_ex(); }
 MN_API void mptest_ex_oom_inject(void) { mptest_ex(); }
 MN_API void mptest_ex_bad_alloc(void) { mptest_ex(); }
@@ -387,7 +1106,7 @@ MN_API void mptest_malloc_dump(void)
 {
   struct mptest__state* state = &mptest__state_g;
   struct mptest__leakcheck_state* leakcheck_state = &state->leakcheck_state;
-  struct mptest__leakcheck_block* block = leakcheck_state->first_block;
+  struct mptest__leakcheck_block* block = leakcheck_state->log.first_block;
   while (block) {
     printf(
         "%p: %u bytes at %s:%i: %s%s%s%s",
@@ -419,7 +1138,17 @@ MN_INTERNAL mptest__result
 mptest__leakcheck_after_test(struct mptest__state* state)
 {
   if (state->leakcheck_state.test_leak_checking) {
-    int has_leaks = mptest__leakcheck_has_leaks(state);
+    int has_leaks;
+    /* Other threads may have finished allocating, collect their blocks */
+    mptest__leakcheck_merge(state);
+    if (state->leakcheck_state.fail_reason != MPTEST__LEAKCHECK_PASS) {
+      /* A thread other than the testing thread made an invalid call */
+      return MPTEST__RESULT_FAIL;
+    }
+    if (mptest__leakcheck_quarantine_check(state)) {
+      return MPTEST__RESULT_FAIL;
+    }
+    has_leaks = mptest__leakcheck_has_leaks(state);
     if (has_leaks) {
       mptest__leakcheck_error(
           &state->leakcheck_state, MPTEST__LEAKCHECK_LEAKED, NULL, 0, NULL);
@@ -431,6 +1160,26 @@ mptest__leakcheck_after_test(struct mptest__state* state)
   return MPTEST__RESULT_PASS;
 }
 
+/* Print where the offending block was allocated and freed, if known. */
+MN_INTERNAL void
+mptest__leakcheck_report_fail_block(struct mptest__state* state)
+{
+  struct mptest__leakcheck_block* block = state->leakcheck_state.fail_block;
+  if (block == NULL) {
+    return;
+  }
+  mptest__state_print_indent(state);
+  printf("    ...allocated at ");
+  mptest__print_source_location(block->file, block->line);
+  printf("\n");
+  if (block->free_file) {
+    mptest__state_print_indent(state);
+    printf("    ...freed at ");
+    mptest__print_source_location(block->free_file, block->free_line);
+    printf("\n");
+  }
+}
+
 MN_INTERNAL void
 mptest__leakcheck_report_test(struct mptest__state* state, mptest__result res)
 {
@@ -478,6 +1227,7 @@ mptest__leakcheck_report_test(struct mptest__state* state, mptest__result res)
     mptest__print_source_location(
         leakcheck_state->fail_file, leakcheck_state->fail_line);
     printf("\n");
+    mptest__leakcheck_report_fail_block(state);
   } else if (
       leakcheck_state->fail_reason == MPTEST__LEAKCHECK_REALLOC_OF_REALLOCED) {
     mptest__state_print_indent(state);
@@ -491,6 +1241,7 @@ mptest__leakcheck_report_test(struct mptest__state* state, mptest__result res)
     mptest__print_source_location(
         leakcheck_state->fail_file, leakcheck_state->fail_line);
     printf("\n");
+    mptest__leakcheck_report_fail_block(state);
   } else if (leakcheck_state->fail_reason == MPTEST__LEAKCHECK_FREE_OF_NULL) {
     mptest__state_print_indent(state);
     printf("  " MPTEST__COLOR_FAIL "attempt to call free() on a NULL "
@@ -524,6 +1275,7 @@ mptest__leakcheck_report_test(struct mptest__state* state, mptest__result res)
     printf("    ...at ");
     mptest__print_source_location(state->fail_file, state->fail_line);
     printf("\n");
+    mptest__leakcheck_report_fail_block(state);
   } else if (
       leakcheck_state->fail_reason == MPTEST__LEAKCHECK_FREE_OF_REALLOCED) {
     mptest__state_print_indent(state);
@@ -536,11 +1288,34 @@ mptest__leakcheck_report_test(struct mptest__state* state, mptest__result res)
     printf("    ...at ");
     mptest__print_source_location(state->fail_file, state->fail_line);
     printf("\n");
+    mptest__leakcheck_report_fail_block(state);
+  } else if (
+      leakcheck_state->fail_reason == MPTEST__LEAKCHECK_USE_AFTER_FREE) {
+    struct mptest__leakcheck_block* block = leakcheck_state->fail_block;
+    mptest__state_print_indent(state);
+    printf("  " MPTEST__COLOR_FAIL
+           "write to memory after it was freed" MPTEST__COLOR_RESET ":\n");
+    mptest__state_print_indent(state);
+    printf(
+        "    pointer: %p (byte " MPTEST__COLOR_EMPHASIS
+        "%lu" MPTEST__COLOR_RESET " of " MPTEST__COLOR_EMPHASIS
+        "%lu" MPTEST__COLOR_RESET ")\n",
+        leakcheck_state->fail_ptr,
+        (long unsigned int)leakcheck_state->fail_offset,
+        (long unsigned int)block->block_size);
+    mptest__leakcheck_report_fail_block(state);
+    if (leakcheck_state->fail_file) {
+      mptest__state_print_indent(state);
+      printf("    ...detected at ");
+      mptest__print_source_location(
+          leakcheck_state->fail_file, leakcheck_state->fail_line);
+      printf("\n");
+    }
   }
   if (leakcheck_state->fail_reason == MPTEST__LEAKCHECK_LEAKED ||
       mptest__leakcheck_has_leaks(state)) {
     struct mptest__leakcheck_block* current =
-        state->leakcheck_state.first_block;
+        state->leakcheck_state.log.first_block;
     mptest__state_print_indent(state);
     printf("  " MPTEST__COLOR_FAIL "memory leak(s) detected" MPTEST__COLOR_RESET
            ":\n");
@@ -21,10 +21,7 @@ MN_API void mptest__state_init(struct mptest__state* state)
   state->fail_file = NULL;
   state->fail_line = 0;
   state->indent_lvl = 0;
-  state->fault_checking = 0;
-  state->fault_calls = 0;
-  state->fault_fail_call_idx = -1;
-  state->fault_failed = 0;
+  mptest__fault_init(state);
 #if MPTEST_USE_LONGJMP
   mptest__longjmp_init(state);
 #endif
@@ -40,12 +37,27 @@ MN_API void mptest__state_init(struct mptest__state* state)
 #if MPTEST_USE_FUZZ
   mptest__fuzz_init(state);
 #endif
+#if MPTEST_USE_COVERAGE
+  mptest__coverage_init(state);
+#endif
+#if MPTEST_USE_SYM
+  mptest__sym_cache_init(state);
+#endif
 }
 
 /* Destroy a test runner state. */
 MN_API void mptest__state_destroy(struct mptest__state* state)
 {
   (void)(state);
+#if MPTEST_USE_SYM
+  mptest__sym_cache_destroy(state);
+#endif
+#if MPTEST_USE_COVERAGE
+  mptest__coverage_destroy(state);
+#endif
+#if MPTEST_USE_FUZZ
+  mptest__fuzz_destroy(state);
+#endif
 #if MPTEST_USE_APARSE
   mptest__aparse_destroy(state);
 #endif
@@ -58,6 +70,7 @@ MN_API void mptest__state_destroy(struct mptest__state* state)
 #if MPTEST_USE_LONGJMP
   mptest__longjmp_destroy(state);
 #endif
+  mptest__fault_destroy(state);
 }
 
 /* Actually define (create storage space for) the global state */
@@ -110,6 +123,29 @@ MN_INTERNAL void mptest__state_print_indent(struct mptest__state* state)
   }
 }
 
+/* Print the start of the current test's line, up to its result. */
+MN_INTERNAL void mptest__state_print_test(struct mptest__state* state)
+{
+  mptest__state_print_indent(state);
+  printf(
+      "test " MPTEST__COLOR_TEST_NAME "%s" MPTEST__COLOR_RESET "... ",
+      state->current_test);
+}
+
+/* Forget the failure of a run that won't be reported, releasing what it holds
+ * on to. */
+MN_INTERNAL void mptest__state_discard_failure(struct mptest__state* state)
+{
+#if MPTEST_USE_SYM
+  if (state->fail_reason == MPTEST__FAIL_REASON_SYM_INEQUALITY) {
+    mptest__sym_check_destroy();
+  }
+#endif
+  state->fail_reason = MPTEST__FAIL_REASON_NONE;
+  state->fail_file = NULL;
+  state->fail_line = 0;
+}
+
 /* Print a formatted source location. */
 MN_INTERNAL void mptest__print_source_location(const char* file, int line)
 {
@@ -140,71 +176,6 @@ MN_INTERNAL int mptest__streq(const char* a, const char* b)
   }
 }
 
-MN_INTERNAL int mptest__fault(struct mptest__state* state, const char* class)
-{
-  MN__UNUSED(class);
-  if (state->fault_checking == MPTEST__FAULT_MODE_ONE &&
-      state->fault_calls == state->fault_fail_call_idx) {
-    state->fault_calls++;
-    return 1;
-  } else if (
-      state->fault_checking == MPTEST__FAULT_MODE_SET &&
-      state->fault_calls == state->fault_fail_call_idx) {
-    return 1;
-  } else {
-    state->fault_calls++;
-  }
-  return 0;
-}
-
-MN_API int mptest_fault(const char* class)
-{
-  return mptest__fault(&mptest__state_g, class);
-}
-
-MN_INTERNAL void mptest__fault_reset(struct mptest__state* state)
-{
-  state->fault_calls = 0;
-  state->fault_failed = 0;
-  state->fault_fail_call_idx = -1;
-}
-
-MN_INTERNAL mptest__result
-mptest__fault_run_test(struct mptest__state* state, mptest__test_func test_func)
-{
-  int max_iter = 0;
-  int i;
-  mptest__result res = MPTEST__RESULT_PASS;
-  /* Suspend fault checking */
-  int fault_prev = state->fault_checking;
-  state->fault_checking = MPTEST__FAULT_MODE_OFF;
-  mptest__fault_reset(state);
-  res = mptest__state_do_run_test(state, test_func);
-  /* Reinstate fault checking */
-  state->fault_checking = fault_prev;
-  max_iter = state->fault_calls;
-  if (res != MPTEST__RESULT_PASS) {
-    /* Initial test failed. */
-    return res;
-  }
-  for (i = 0; i < max_iter; i++) {
-    mptest__fault_reset(state);
-    state->fault_fail_call_idx = i;
-    res = mptest__state_do_run_test(state, test_func);
-    if (res != MPTEST__RESULT_PASS) {
-      /* Save fail context */
-      state->fault_failed = 1;
-      break;
-    }
-  }
-  return res;
-}
-
-MN_API void mptest__fault_set(struct mptest__state* state, int on)
-{
-  state->fault_checking = on;
-}
-
 /* Ran when setting up for a test before it is run. */
 MN_INTERNAL mptest__result mptest__state_before_test(
     struct mptest__state* state, mptest__test_func test_func,
@@ -212,24 +183,28 @@ MN_INTERNAL mptest__result mptest__state_before_test(
 {
   state->current_test = test_name;
   /* indent if we are running a suite */
-  mptest__state_print_indent(state);
-  printf(
-      "test " MPTEST__COLOR_TEST_NAME "%s" MPTEST__COLOR_RESET "... ",
-      state->current_test);
+  mptest__state_print_test(state);
   fflush(stdout);
 #if MPTEST_USE_APARSE
   if (!mptest__aparse_match_test_name(state, test_name)) {
     return MPTEST__RESULT_SKIPPED;
   }
 #endif
-  if (state->fault_checking == MPTEST__FAULT_MODE_OFF) {
+  if (state->fault_checking == MPTEST__FAULT_MODE_OFF &&
+      !mptest__fault_scheduled(state)) {
+    /* Don't report faults from an earlier test */
+    mptest__fault_reset(state);
 #if MPTEST_USE_FUZZ
     return mptest__fuzz_run_test(state, test_func);
 #else
     return mptest__state_do_run_test(state, test_func);
 #endif
   } else {
-    return mptest__fault_run_test(state, test_func);
+    mptest__result res;
+    state->fault_active = 1;
+    res = mptest__fault_run_test(state, test_func);
+    state->fault_active = 0;
+    return res;
   }
 }
 
@@ -237,6 +212,10 @@ MN_INTERNAL mptest__result mptest__state_do_run_test(
     struct mptest__state* state, mptest__test_func test_func)
 {
   mptest__result res;
+#if MPTEST_USE_SYM
+  /* Take back syms that a failed SYM() didn't return */
+  state->sym_state.pool_used = 0;
+#endif
 #if MPTEST_USE_LEAKCHECK
   if (mptest__leakcheck_before_test(state, test_func)) {
     return MPTEST__RESULT_FAIL;
@@ -309,17 +288,9 @@ mptest__state_after_test(struct mptest__state* state, mptest__result res)
           "assertion failure: s-expression inequality" MPTEST__COLOR_RESET
           ": " MPTEST__COLOR_EMPHASIS "%s" MPTEST__COLOR_RESET "\n",
           state->fail_msg);
-      mptest__state_print_indent(state);
-      printf("    actual:\n");
-      mptest__sym_dump(
-          state->fail_data.sym_fail_data.sym_actual, 0, state->indent_lvl + 6);
-      printf("\n");
-      mptest__state_print_indent(state);
-      printf("    expected:\n");
-      mptest__sym_dump(
-          state->fail_data.sym_fail_data.sym_expected, 0,
-          state->indent_lvl + 6);
-      printf("\n");
+      mptest__sym_diff(
+          state, state->fail_data.sym_fail_data.sym_actual,
+          state->fail_data.sym_fail_data.sym_expected);
       mptest__sym_check_destroy();
     }
 #endif
@@ -354,6 +325,17 @@ mptest__state_after_test(struct mptest__state* state, mptest__result res)
           state->fail_msg, state->fail_data.sym_syntax_error_data.err_msg,
           (int)state->fail_data.sym_syntax_error_data.err_pos);
     }
+    if (state->fail_reason == MPTEST__FAIL_REASON_SYM_SNAPSHOT) {
+      mptest__state_print_indent(state);
+      printf(
+          "  " MPTEST__COLOR_FAIL "%s" MPTEST__COLOR_RESET
+          ": " MPTEST__COLOR_EMPHASIS "%s" MPTEST__COLOR_RESET "\n",
+          (const char*)state->fail_data.string_data, state->fail_msg);
+      mptest__state_print_indent(state);
+      printf("    ...at ");
+      mptest__print_source_location(state->fail_file, state->fail_line);
+      printf("\n");
+    }
 #endif
 #if MPTEST_USE_LONGJMP
     if (state->fail_reason == MPTEST__FAIL_REASON_UNCAUGHT_PROGRAM_ASSERT) {
@@ -385,14 +367,10 @@ mptest__state_after_test(struct mptest__state* state, mptest__result res)
 #if MPTEST_USE_FUZZ
   mptest__fuzz_report_test(state, res);
 #endif
-  if (res == MPTEST__RESULT_FAIL || res == MPTEST__RESULT_ERROR) {
-    if (state->fault_fail_call_idx != -1) {
-      printf(
-          "    ...at fault iteration " MPTEST__COLOR_EMPHASIS
-          "%i" MPTEST__COLOR_RESET "\n",
-          state->fault_fail_call_idx);
-    }
-  }
+#if MPTEST_USE_COVERAGE
+  mptest__coverage_report_test(state, res);
+#endif
+  mptest__fault_report_test(state, res);
 }
 
 MN_API void mptest__run_test(
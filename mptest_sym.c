@@ -2,95 +2,387 @@
 
 #if MPTEST_USE_SYM
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MPTEST__SYM_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define MPTEST__SYM_MMAP 0
+#endif
+
 typedef enum mptest__sym_type {
   MPTEST__SYM_TYPE_EXPR,
   MPTEST__SYM_TYPE_ATOM_STRING,
   MPTEST__SYM_TYPE_ATOM_NUMBER
 } mptest__sym_type;
 
-typedef union mptest__sym_data {
-  mn__str str;
-  mn_int32 num;
-} mptest__sym_data;
+/* A tree's type, stored in a single byte */
+typedef unsigned char mptest__sym_type_byte;
+
+MN__VEC_DECL(mptest__sym_type_byte);
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, init)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, destroy)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, push)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, pop)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, clear)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, size)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, get)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, set)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, capacity)
+MN__VEC_IMPL_FUNC(mptest__sym_type_byte, reserve)
+
+typedef unsigned long mptest__sym_hash;
+
+#define MPTEST__SYM_HASH_MASK 0xFFFFFFFFUL
+
+/* Expressions keep this much of their hash (31 bits), so that it fits in
+ * their int32 of data */
+#define MPTEST__SYM_EXPR_HASH_MASK 0x7FFFFFFFUL
+
+/* A distinct string atom, stored once per sym no matter how many trees refer
+ * to it. Its text lives at `offset` in the sym's arena, followed by a NUL. */
+typedef struct mptest__sym_atom {
+  mn_size offset;
+  mn_size size;
+  mptest__sym_hash hash;
+} mptest__sym_atom;
+
+MN__VEC_DECL(mptest__sym_atom);
+MN__VEC_IMPL_FUNC(mptest__sym_atom, init)
+MN__VEC_IMPL_FUNC(mptest__sym_atom, destroy)
+MN__VEC_IMPL_FUNC(mptest__sym_atom, push)
+MN__VEC_IMPL_FUNC(mptest__sym_atom, clear)
+MN__VEC_IMPL_FUNC(mptest__sym_atom, size)
+MN__VEC_IMPL_FUNC(mptest__sym_atom, getcref)
+
+MN__VEC_DECL(mn_int32);
+MN__VEC_IMPL_FUNC(mn_int32, init)
+MN__VEC_IMPL_FUNC(mn_int32, destroy)
+MN__VEC_IMPL_FUNC(mn_int32, push)
+MN__VEC_IMPL_FUNC(mn_int32, pop)
+MN__VEC_IMPL_FUNC(mn_int32, size)
+MN__VEC_IMPL_FUNC(mn_int32, get)
+MN__VEC_IMPL_FUNC(mn_int32, set)
+MN__VEC_IMPL_FUNC(mn_int32, reserve)
+MN__VEC_IMPL_FUNC(mn_int32, clear)
+MN__VEC_IMPL_FUNC(mn_int32, get_data)
+MN__VEC_IMPL_FUNC(mn_int32, capacity)
+
+/* Trees are stored as parallel arrays indexed by ref, so that walking the
+ * structure only touches the structure. A tree is always added after its
+ * parent. Each tree takes 13 bytes: an expression needs both of its refs and
+ * its cached hash, and atoms share the same layout so that any ref indexes
+ * every array. */
+struct mptest_sym {
+  mptest__sym_type_byte_vec types;
+  mn_int32_vec first_child_refs;
+  mn_int32_vec next_sibling_refs;
+  /* A number's value, a string's atom index, or an expression's hash */
+  mn_int32_vec data;
+  /* Text of every distinct string atom, back to back */
+  mn__str atom_text;
+  mptest__sym_atom_vec atoms;
+  /* Open-addressed table of atom indices, keyed by hash; a power of two in
+   * size and never more than half full */
+  mn_int32_vec atom_index;
+  /* 1 if every expression's hash is up to date */
+  int hashed;
+};
+
+void mptest__sym_init(mptest_sym* sym)
+{
+  mptest__sym_type_byte_vec_init(&sym->types);
+  mn_int32_vec_init(&sym->first_child_refs);
+  mn_int32_vec_init(&sym->next_sibling_refs);
+  mn_int32_vec_init(&sym->data);
+  mn__str_init(&sym->atom_text);
+  mptest__sym_atom_vec_init(&sym->atoms);
+  mn_int32_vec_init(&sym->atom_index);
+  sym->hashed = 1;
+}
 
-typedef struct mptest__sym_tree {
-  mptest__sym_type type;
-  mn_int32 first_child_ref;
-  mn_int32 next_sibling_ref;
-  mptest__sym_data data;
-} mptest__sym_tree;
+void mptest__sym_destroy(mptest_sym* sym)
+{
+  mptest__sym_type_byte_vec_destroy(&sym->types);
+  mn_int32_vec_destroy(&sym->first_child_refs);
+  mn_int32_vec_destroy(&sym->next_sibling_refs);
+  mn_int32_vec_destroy(&sym->data);
+  mn__str_destroy(&sym->atom_text);
+  mptest__sym_atom_vec_destroy(&sym->atoms);
+  mn_int32_vec_destroy(&sym->atom_index);
+}
 
-void mptest__sym_tree_init(mptest__sym_tree* tree, mptest__sym_type type)
+/* Empty `sym` while keeping its storage for reuse. */
+void mptest__sym_clear(mptest_sym* sym)
 {
-  tree->type = type;
-  tree->first_child_ref = MPTEST__SYM_NONE;
-  tree->next_sibling_ref = MPTEST__SYM_NONE;
+  mn_size i;
+  mptest__sym_type_byte_vec_clear(&sym->types);
+  mn_int32_vec_clear(&sym->first_child_refs);
+  mn_int32_vec_clear(&sym->next_sibling_refs);
+  mn_int32_vec_clear(&sym->data);
+  mn__str_clear(&sym->atom_text);
+  mptest__sym_atom_vec_clear(&sym->atoms);
+  for (i = 0; i < mn_int32_vec_size(&sym->atom_index); i++) {
+    mn_int32_vec_set(&sym->atom_index, i, MPTEST__SYM_NONE);
+  }
+  sym->hashed = 1;
 }
 
-void mptest__sym_tree_destroy(mptest__sym_tree* tree)
+MN_INTERNAL mptest__sym_hash
+mptest__sym_hash_str(const char* str, mn_size str_size)
 {
-  if (tree->type == MPTEST__SYM_TYPE_ATOM_STRING) {
-    mn__str_destroy(&tree->data.str);
+  /* FNV-1a */
+  mptest__sym_hash x = 0x811C9DC5UL;
+  while (str_size--) {
+    x = ((x ^ (mptest__sym_hash)(unsigned char)*(str++)) * 0x01000193UL) &
+        MPTEST__SYM_HASH_MASK;
   }
+  return x;
 }
 
-MN__VEC_DECL(mptest__sym_tree);
-MN__VEC_IMPL_FUNC(mptest__sym_tree, init)
-MN__VEC_IMPL_FUNC(mptest__sym_tree, destroy)
-MN__VEC_IMPL_FUNC(mptest__sym_tree, push)
-MN__VEC_IMPL_FUNC(mptest__sym_tree, size)
-MN__VEC_IMPL_FUNC(mptest__sym_tree, getref)
-MN__VEC_IMPL_FUNC(mptest__sym_tree, getcref)
+/* Fold `value` into the running hash `hash`. */
+MN_INTERNAL mptest__sym_hash
+mptest__sym_hash_mix(mptest__sym_hash hash, mptest__sym_hash value)
+{
+  /* murmur3 finalizer */
+  hash = ((hash ^ value) * 0x85EBCA6BUL) & MPTEST__SYM_HASH_MASK;
+  hash ^= hash >> 13;
+  hash = (hash * 0xC2B2AE35UL) & MPTEST__SYM_HASH_MASK;
+  hash ^= hash >> 16;
+  return hash;
+}
 
-struct mptest_sym {
-  mptest__sym_tree_vec tree_storage;
-};
+MN_INTERNAL const mptest__sym_atom*
+mptest__sym_atom_get(const mptest_sym* sym, mn_int32 atom)
+{
+  return mptest__sym_atom_vec_getcref(&sym->atoms, (mn_size)atom);
+}
 
-void mptest__sym_init(mptest_sym* sym)
+/* Get the NUL-terminated text of `atom`. The pointer is invalidated by the
+ * next atom interned into `sym`. */
+MN_INTERNAL const char*
+mptest__sym_atom_data(const mptest_sym* sym, mn_int32 atom)
 {
-  mptest__sym_tree_vec_init(&sym->tree_storage);
+  return (const char*)mn__str_get_data(&sym->atom_text) +
+         mptest__sym_atom_get(sym, atom)->offset;
 }
 
-void mptest__sym_destroy(mptest_sym* sym)
+/* Check whether `atom` in `sym` holds exactly `str`. */
+MN_INTERNAL int mptest__sym_atom_is(
+    const mptest_sym* sym, mn_int32 atom, const char* str, mn_size str_size,
+    mptest__sym_hash hash)
+{
+  const mptest__sym_atom* entry = mptest__sym_atom_get(sym, atom);
+  const char* data;
+  mn_size i;
+  if (entry->hash != hash || entry->size != str_size) {
+    return 0;
+  }
+  data = mptest__sym_atom_data(sym, atom);
+  for (i = 0; i < str_size; i++) {
+    if (data[i] != str[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Find the slot of `atom_index` that holds the atom matching `str`, or the
+ * empty slot where it belongs. */
+MN_INTERNAL mn_size mptest__sym_atom_slot(
+    const mptest_sym* sym, const char* str, mn_size str_size,
+    mptest__sym_hash hash)
+{
+  mn_size mask = mn_int32_vec_size(&sym->atom_index) - 1;
+  mn_size slot = (mn_size)hash & mask;
+  mn_int32 atom;
+  while ((atom = mn_int32_vec_get(&sym->atom_index, slot)) !=
+         MPTEST__SYM_NONE) {
+    if (mptest__sym_atom_is(sym, atom, str, str_size, hash)) {
+      break;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+/* Double the size of the atom index, reinserting every atom. */
+MN_INTERNAL int mptest__sym_atom_rehash(mptest_sym* sym)
 {
+  int err = 0;
+  mn_size capacity = mn_int32_vec_size(&sym->atom_index) * 2;
   mn_size i;
-  for (i = 0; i < mptest__sym_tree_vec_size(&sym->tree_storage); i++) {
-    mptest__sym_tree_destroy(
-        mptest__sym_tree_vec_getref(&sym->tree_storage, i));
+  mn_int32_vec old_index = sym->atom_index;
+  if (capacity == 0) {
+    capacity = 16;
+  }
+  mn_int32_vec_init(&sym->atom_index);
+  if ((err = mn_int32_vec_reserve(&sym->atom_index, capacity))) {
+    goto error;
+  }
+  for (i = 0; i < capacity; i++) {
+    if ((err = mn_int32_vec_push(&sym->atom_index, MPTEST__SYM_NONE))) {
+      goto error;
+    }
+  }
+  for (i = 0; i < mptest__sym_atom_vec_size(&sym->atoms); i++) {
+    const mptest__sym_atom* entry =
+        mptest__sym_atom_vec_getcref(&sym->atoms, i);
+    mn_size slot = (mn_size)entry->hash & (capacity - 1);
+    while (mn_int32_vec_get(&sym->atom_index, slot) != MPTEST__SYM_NONE) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    mn_int32_vec_set(&sym->atom_index, slot, (mn_int32)i);
+  }
+  mn_int32_vec_destroy(&old_index);
+  return err;
+error:
+  mn_int32_vec_destroy(&sym->atom_index);
+  sym->atom_index = old_index;
+  return err;
+}
+
+/* Find or add the atom holding `str`, returning its index in `atom`. */
+MN_INTERNAL int mptest__sym_intern(
+    mptest_sym* sym, const char* str, mn_size str_size, mn_int32* atom)
+{
+  int err = 0;
+  mptest__sym_hash hash = mptest__sym_hash_str(str, str_size);
+  mptest__sym_atom entry;
+  mn_size slot;
+  if ((mptest__sym_atom_vec_size(&sym->atoms) + 1) * 2 >
+      mn_int32_vec_size(&sym->atom_index)) {
+    if ((err = mptest__sym_atom_rehash(sym))) {
+      return err;
+    }
+  }
+  slot = mptest__sym_atom_slot(sym, str, str_size, hash);
+  if ((*atom = mn_int32_vec_get(&sym->atom_index, slot)) !=
+      MPTEST__SYM_NONE) {
+    return err;
+  }
+  entry.offset = mn__str_size(&sym->atom_text);
+  entry.size = str_size;
+  entry.hash = hash;
+  if ((err = mn__str_cat_n(&sym->atom_text, (const mn_char*)str, str_size)) ||
+      (err = mn__str_push(&sym->atom_text, '\0'))) {
+    return err;
+  }
+  *atom = (mn_int32)mptest__sym_atom_vec_size(&sym->atoms);
+  if ((err = mptest__sym_atom_vec_push(&sym->atoms, entry))) {
+    return err;
   }
-  mptest__sym_tree_vec_destroy(&sym->tree_storage);
+  mn_int32_vec_set(&sym->atom_index, slot, *atom);
+  return err;
+}
+
+/* Number of trees in `sym`. */
+MN_INTERNAL mn_size mptest__sym_size(const mptest_sym* sym)
+{
+  return mptest__sym_type_byte_vec_size(&sym->types);
+}
+
+MN_INTERNAL mptest__sym_type
+mptest__sym_type_of(const mptest_sym* sym, mn_int32 ref)
+{
+  MN_ASSERT(ref != MPTEST__SYM_NONE);
+  return (mptest__sym_type)mptest__sym_type_byte_vec_get(
+      &sym->types, (mn_size)ref);
+}
+
+MN_INTERNAL mn_int32
+mptest__sym_first_child(const mptest_sym* sym, mn_int32 ref)
+{
+  MN_ASSERT(ref != MPTEST__SYM_NONE);
+  return mn_int32_vec_get(&sym->first_child_refs, (mn_size)ref);
 }
 
-MN_INTERNAL mptest__sym_tree* mptest__sym_get(mptest_sym* sym, mn_int32 ref)
+MN_INTERNAL mn_int32
+mptest__sym_next_sibling(const mptest_sym* sym, mn_int32 ref)
 {
   MN_ASSERT(ref != MPTEST__SYM_NONE);
-  return mptest__sym_tree_vec_getref(&sym->tree_storage, (mn_size)ref);
+  return mn_int32_vec_get(&sym->next_sibling_refs, (mn_size)ref);
 }
 
-MN_INTERNAL const mptest__sym_tree*
-mptest__sym_getcref(const mptest_sym* sym, mn_int32 ref)
+MN_INTERNAL mn_int32 mptest__sym_data(const mptest_sym* sym, mn_int32 ref)
 {
   MN_ASSERT(ref != MPTEST__SYM_NONE);
-  return mptest__sym_tree_vec_getcref(&sym->tree_storage, (mn_size)ref);
+  return mn_int32_vec_get(&sym->data, (mn_size)ref);
+}
+
+/* Drop every tree from `size` on. */
+MN_INTERNAL void mptest__sym_truncate(mptest_sym* sym, mn_size size)
+{
+  while (mptest__sym_type_byte_vec_size(&sym->types) > size) {
+    mptest__sym_type_byte_vec_pop(&sym->types);
+  }
+  while (mn_int32_vec_size(&sym->first_child_refs) > size) {
+    mn_int32_vec_pop(&sym->first_child_refs);
+  }
+  while (mn_int32_vec_size(&sym->next_sibling_refs) > size) {
+    mn_int32_vec_pop(&sym->next_sibling_refs);
+  }
+  while (mn_int32_vec_size(&sym->data) > size) {
+    mn_int32_vec_pop(&sym->data);
+  }
+}
+
+/* Make `vec` big enough for `size` ints, at least doubling it if it grows. */
+MN_INTERNAL int mptest__sym_reserve_refs(mn_int32_vec* vec, mn_size size)
+{
+  mn_size capacity = mn_int32_vec_capacity(vec);
+  if (size <= capacity) {
+    return 0;
+  }
+  return mn_int32_vec_reserve(vec, size < capacity * 2 ? capacity * 2 : size);
+}
+
+/* Make room for `trees` more trees in `sym`. */
+MN_INTERNAL int mptest__sym_reserve(mptest_sym* sym, mn_size trees)
+{
+  int err = 0;
+  mn_size size = mptest__sym_size(sym) + trees;
+  mn_size capacity = mptest__sym_type_byte_vec_capacity(&sym->types);
+  if (size > capacity &&
+      (err = mptest__sym_type_byte_vec_reserve(
+           &sym->types, size < capacity * 2 ? capacity * 2 : size))) {
+    return err;
+  }
+  if ((err = mptest__sym_reserve_refs(&sym->first_child_refs, size)) ||
+      (err = mptest__sym_reserve_refs(&sym->next_sibling_refs, size)) ||
+      (err = mptest__sym_reserve_refs(&sym->data, size))) {
+    return err;
+  }
+  return err;
 }
 
+/* Add a tree without children, holding `data`, after `prev_sibling_ref` in
+ * `parent_ref`. */
 MN_INTERNAL int mptest__sym_new(
     mptest_sym* sym, mn_int32 parent_ref, mn_int32 prev_sibling_ref,
-    mptest__sym_tree new_tree, mn_int32* new_ref)
+    mptest__sym_type type, mn_int32 data, mn_int32* new_ref)
 {
   int err = 0;
-  mn_int32 next_ref = (mn_int32)mptest__sym_tree_vec_size(&sym->tree_storage);
-  if ((err = mptest__sym_tree_vec_push(&sym->tree_storage, new_tree))) {
+  mn_size size = mptest__sym_size(sym);
+  if ((err = mptest__sym_type_byte_vec_push(
+           &sym->types, (mptest__sym_type_byte)type)) ||
+      (err = mn_int32_vec_push(&sym->first_child_refs, MPTEST__SYM_NONE)) ||
+      (err = mn_int32_vec_push(&sym->next_sibling_refs, MPTEST__SYM_NONE)) ||
+      (err = mn_int32_vec_push(&sym->data, data))) {
+    /* Keep the arrays the same length */
+    mptest__sym_truncate(sym, size);
     return err;
   }
-  *new_ref = next_ref;
+  *new_ref = (mn_int32)size;
+  sym->hashed = 0;
   if (parent_ref != MPTEST__SYM_NONE) {
     if (prev_sibling_ref == MPTEST__SYM_NONE) {
-      mptest__sym_tree* parent = mptest__sym_get(sym, parent_ref);
-      parent->first_child_ref = *new_ref;
+      mn_int32_vec_set(&sym->first_child_refs, (mn_size)parent_ref, *new_ref);
     } else {
-      mptest__sym_tree* sibling = mptest__sym_get(sym, prev_sibling_ref);
-      sibling->next_sibling_ref = *new_ref;
+      mn_int32_vec_set(
+          &sym->next_sibling_refs, (mn_size)prev_sibling_ref, *new_ref);
     }
   }
   return err;
@@ -139,7 +431,8 @@ int mptest__sym_parse_next(mptest__sym_parse* parse)
     parse->str_pos++;
     return -1;
   } else {
-    return parse->str[parse->str_pos++];
+    /* Bytes above 0x7F are returned as-is, and never mistaken for EOF */
+    return (unsigned char)parse->str[parse->str_pos++];
   }
 }
 
@@ -527,200 +820,746 @@ error:
   return err;
 }
 
-MN_INTERNAL void mptest__sym_dump_r(
-    mptest_sym* sym, mn_int32 parent_ref, mn_int32 begin, mn_int32 indent)
+/* Get the hash of the structure and contents of `ref`. Atoms' hashes are
+ * worked out as needed; expressions keep theirs in their data, put there by
+ * mptest__sym_hash_sweep(). */
+MN_INTERNAL mptest__sym_hash
+mptest__sym_tree_hash(const mptest_sym* sym, mn_int32 ref)
 {
-  mptest__sym_tree* tree;
-  mn_int32 child_ref;
-  mn_int32 i;
-  if (parent_ref == MPTEST__SYM_NONE) {
+  mptest__sym_type type = mptest__sym_type_of(sym, ref);
+  mn_int32 data = mptest__sym_data(sym, ref);
+  if (type == MPTEST__SYM_TYPE_ATOM_STRING) {
+    return mptest__sym_hash_mix(
+        (mptest__sym_hash)MPTEST__SYM_TYPE_ATOM_STRING,
+        mptest__sym_atom_get(sym, data)->hash);
+  } else if (type == MPTEST__SYM_TYPE_ATOM_NUMBER) {
+    return mptest__sym_hash_mix(
+        (mptest__sym_hash)MPTEST__SYM_TYPE_ATOM_NUMBER,
+        (mptest__sym_hash)data & MPTEST__SYM_HASH_MASK);
+  }
+  MN_ASSERT(sym->hashed);
+  return (mptest__sym_hash)data;
+}
+
+/* Bring the hash of every expression up to date. Trees are only ever
+ * appended after their parent, so walking backwards sees each tree's children
+ * before the tree itself. */
+MN_INTERNAL void mptest__sym_hash_sweep(mptest_sym* sym)
+{
+  mn_size i = mptest__sym_size(sym);
+  if (sym->hashed) {
     return;
   }
-  tree = mptest__sym_get(sym, parent_ref);
-  if (tree->first_child_ref == MPTEST__SYM_NONE) {
-    if (tree->type == MPTEST__SYM_TYPE_ATOM_NUMBER) {
-      printf(MPTEST__COLOR_SYM_INT "%i" MPTEST__COLOR_RESET, tree->data.num);
-    } else if (tree->type == MPTEST__SYM_TYPE_ATOM_STRING) {
-      int has_special = 0;
-      const char* sbegin = mn__str_get_data(&tree->data.str);
-      const char* end = sbegin + mn__str_size(&tree->data.str);
-      while (sbegin != end) {
-        if (*sbegin < 32 || *sbegin > 126) {
-          has_special = 1;
-          break;
-        }
-        sbegin++;
-      }
-      printf(MPTEST__COLOR_SYM_STR);
-      if (has_special) {
-        printf("\"");
-        sbegin = mn__str_get_data(&tree->data.str);
-        while (sbegin != end) {
-          if (*sbegin < 32 || *sbegin > 126) {
-            printf("\\x%02X", *sbegin);
-          } else {
-            printf("%C", *sbegin);
-          }
-          sbegin++;
-        }
-        printf("\"");
-      } else {
-        printf("%s", mn__str_get_data(&tree->data.str));
+  /* Children are hashed first, so their hashes are ready to use */
+  sym->hashed = 1;
+  while (i--) {
+    if (mptest__sym_type_byte_vec_get(&sym->types, i) ==
+        MPTEST__SYM_TYPE_EXPR) {
+      mn_int32 child_ref = mn_int32_vec_get(&sym->first_child_refs, i);
+      mptest__sym_hash hash = (mptest__sym_hash)MPTEST__SYM_TYPE_EXPR;
+      while (child_ref != MPTEST__SYM_NONE) {
+        MN_ASSERT(child_ref > (mn_int32)i);
+        hash = mptest__sym_hash_mix(
+            hash, mptest__sym_tree_hash(sym, child_ref));
+        child_ref = mptest__sym_next_sibling(sym, child_ref);
       }
-      printf(MPTEST__COLOR_RESET);
-    } else if (tree->type == MPTEST__SYM_TYPE_EXPR) {
-      printf("()");
+      mn_int32_vec_set(
+          &sym->data, i, (mn_int32)(hash & MPTEST__SYM_EXPR_HASH_MASK));
     }
-  } else {
-    if (begin != indent) {
-      printf("\n");
-      for (i = 0; i < indent; i++) {
-        printf(" ");
-      }
+  }
+}
+
+/* Check whether an atom must be quoted to be read back as the same string. */
+MN_INTERNAL int mptest__sym_atom_needs_quotes(const char* str, mn_size size)
+{
+  mn_size i;
+  if (size == 0 || (str[0] >= '0' && str[0] <= '9')) {
+    return 1;
+  }
+  for (i = 0; i < size; i++) {
+    if (str[i] < 33 || str[i] > 126 || str[i] == '(' || str[i] == ')' ||
+        str[i] == '"' || str[i] == '\'' || str[i] == '\\') {
+      return 1;
     }
-    printf("(");
-    child_ref = tree->first_child_ref;
-    while (child_ref != MPTEST__SYM_NONE) {
-      mptest__sym_tree* child = mptest__sym_get(sym, child_ref);
-      mptest__sym_dump_r(sym, child_ref, begin, indent + 2);
-      child_ref = child->next_sibling_ref;
-      if (child_ref != MPTEST__SYM_NONE) {
-        printf(" ");
+  }
+  return 0;
+}
+
+/* Print a tree with no children to `out`, highlighted if `color` is set. */
+MN_INTERNAL void
+mptest__sym_dump_leaf(FILE* out, int color, mptest_sym* sym, mn_int32 ref)
+{
+  const char* reset = color ? MPTEST__COLOR_RESET : "";
+  mptest__sym_type type = mptest__sym_type_of(sym, ref);
+  mn_int32 data = mptest__sym_data(sym, ref);
+  if (type == MPTEST__SYM_TYPE_ATOM_NUMBER) {
+    fprintf(out, "%s%i%s", color ? MPTEST__COLOR_SYM_INT : "", data, reset);
+  } else if (type == MPTEST__SYM_TYPE_ATOM_STRING) {
+    const char* sbegin = mptest__sym_atom_data(sym, data);
+    mn_size size = mptest__sym_atom_get(sym, data)->size;
+    mn_size i;
+    fprintf(out, "%s", color ? MPTEST__COLOR_SYM_STR : "");
+    if (mptest__sym_atom_needs_quotes(sbegin, size)) {
+      fprintf(out, "\"");
+      for (i = 0; i < size; i++) {
+        unsigned char ch = (unsigned char)sbegin[i];
+        /* Bytes above 0x7F are written raw: the parser reads "\xNN" as a
+         * code point, which it would encode as UTF-8 */
+        if (ch < 32 || ch == 127 || ch == '"' || ch == '\\') {
+          fprintf(out, "\\x%02X", (unsigned int)ch);
+        } else {
+          fprintf(out, "%c", sbegin[i]);
+        }
       }
+      fprintf(out, "\"");
+    } else {
+      fprintf(out, "%s", sbegin);
     }
-    printf(")");
+    fprintf(out, "%s", reset);
+  } else if (type == MPTEST__SYM_TYPE_EXPR) {
+    fprintf(out, "()");
   }
 }
 
-MN_INTERNAL void
-mptest__sym_dump(mptest_sym* sym, mn_int32 parent_ref, mn_int32 indent)
+/* Print `ref` at `indent`, or open it and push it onto `stk` if it has
+ * children. Every expression but the outermost starts on a new line. */
+MN_INTERNAL int mptest__sym_dump_open(
+    FILE* out, int color, mptest_sym* sym, mn_int32_vec* stk, mn_int32 ref,
+    mn_int32 indent)
+{
+  int err = 0;
+  mn_int32 first_child_ref = mptest__sym_first_child(sym, ref);
+  mn_int32 i;
+  if (first_child_ref == MPTEST__SYM_NONE) {
+    mptest__sym_dump_leaf(out, color, sym, ref);
+    return err;
+  }
+  if (mn_int32_vec_size(stk)) {
+    fprintf(out, "\n");
+    for (i = 0; i < indent; i++) {
+      fprintf(out, " ");
+    }
+  }
+  fprintf(out, "(");
+  /* Each open expression is its first child, the next child to print and
+   * the indent of its children */
+  if ((err = mn_int32_vec_push(stk, first_child_ref)) ||
+      (err = mn_int32_vec_push(stk, first_child_ref)) ||
+      (err = mn_int32_vec_push(stk, indent + 2))) {
+    return err;
+  }
+  return err;
+}
+
+/* Print `parent_ref` to `out`, one expression per line, starting at
+ * `indent`. Highlighted if `color` is set; either way, the output can be
+ * parsed back into the same tree. */
+MN_INTERNAL int mptest__sym_dump(
+    FILE* out, int color, mptest_sym* sym, mn_int32 parent_ref,
+    mn_int32 indent)
 {
+  int err = 0;
+  mn_int32_vec stk;
   mn_int32 i;
   for (i = 0; i < indent; i++) {
-    printf(" ");
+    fprintf(out, " ");
+  }
+  if (parent_ref == MPTEST__SYM_NONE) {
+    return err;
+  }
+  /* Kept on the heap so that very deep trees can't overflow the stack */
+  mn_int32_vec_init(&stk);
+  if ((err = mptest__sym_dump_open(
+           out, color, sym, &stk, parent_ref, indent))) {
+    goto error;
+  }
+  while (mn_int32_vec_size(&stk)) {
+    mn_size top = mn_int32_vec_size(&stk) - 3;
+    mn_int32 child_ref = mn_int32_vec_get(&stk, top + 1);
+    if (child_ref == MPTEST__SYM_NONE) {
+      fprintf(out, ")");
+      mn_int32_vec_pop(&stk);
+      mn_int32_vec_pop(&stk);
+      mn_int32_vec_pop(&stk);
+      continue;
+    }
+    if (child_ref != mn_int32_vec_get(&stk, top)) {
+      fprintf(out, " ");
+    }
+    mn_int32_vec_set(&stk, top + 1, mptest__sym_next_sibling(sym, child_ref));
+    if ((err = mptest__sym_dump_open(
+             out, color, sym, &stk, child_ref,
+             mn_int32_vec_get(&stk, top + 2)))) {
+      goto error;
+    }
+  }
+  mn_int32_vec_destroy(&stk);
+  return err;
+error:
+  fprintf(out, "...");
+  mn_int32_vec_destroy(&stk);
+  return err;
+}
+
+/* Compare two trees, but not their children. */
+MN_INTERNAL int mptest__sym_equals_tree(
+    mptest_sym* sym, mptest_sym* other, mn_int32 sym_ref, mn_int32 other_ref)
+{
+  const mptest__sym_atom* other_atom;
+  mptest__sym_type type = mptest__sym_type_of(sym, sym_ref);
+  mn_int32 sym_data = mptest__sym_data(sym, sym_ref);
+  mn_int32 other_data = mptest__sym_data(other, other_ref);
+  if (type != mptest__sym_type_of(other, other_ref)) {
+    return 0;
+  } else if (type != MPTEST__SYM_TYPE_ATOM_STRING || sym == other) {
+    /* Numbers, hashes of expressions, or atoms of the same sym */
+    return sym_data == other_data;
   }
-  mptest__sym_dump_r(sym, parent_ref, indent, indent);
+  /* Atoms of different syms are interned separately */
+  other_atom = mptest__sym_atom_get(other, other_data);
+  return mptest__sym_atom_is(
+      sym, sym_data, mptest__sym_atom_data(other, other_data),
+      other_atom->size, other_atom->hash);
 }
 
+/* Returns 1 if the trees are equal, 0 if not, and -1 if out of memory. */
 MN_INTERNAL int mptest__sym_equals(
     mptest_sym* sym, mptest_sym* other, mn_int32 sym_ref, mn_int32 other_ref)
 {
-  mptest__sym_tree* parent_tree;
-  mptest__sym_tree* other_tree;
+  int res = 1;
+  mn_int32_vec stk;
   if ((sym_ref == other_ref) && sym_ref == MPTEST__SYM_NONE) {
     return 1;
   } else if (sym_ref == MPTEST__SYM_NONE || other_ref == MPTEST__SYM_NONE) {
     return 0;
   }
-  parent_tree = mptest__sym_get(sym, sym_ref);
-  other_tree = mptest__sym_get(other, other_ref);
-  if (parent_tree->type != other_tree->type) {
+  MN_ASSERT(sym->hashed && other->hashed);
+  if (!mptest__sym_equals_tree(sym, other, sym_ref, other_ref)) {
     return 0;
-  } else {
-    if (parent_tree->type == MPTEST__SYM_TYPE_ATOM_NUMBER) {
-      if (parent_tree->data.num != other_tree->data.num) {
-        return 0;
-      }
-      return 1;
-    } else if (parent_tree->type == MPTEST__SYM_TYPE_ATOM_STRING) {
-      if (mn__str_cmp(&parent_tree->data.str, &other_tree->data.str) != 0) {
-        return 0;
+  }
+  /* Pairs of sibling lists left to compare, kept on the heap so that very
+   * deep trees can't overflow the stack */
+  mn_int32_vec_init(&stk);
+  if (mn_int32_vec_push(&stk, mptest__sym_first_child(sym, sym_ref)) ||
+      mn_int32_vec_push(&stk, mptest__sym_first_child(other, other_ref))) {
+    res = -1;
+  }
+  while (res == 1 && mn_int32_vec_size(&stk)) {
+    other_ref = mn_int32_vec_pop(&stk);
+    sym_ref = mn_int32_vec_pop(&stk);
+    if (sym_ref == MPTEST__SYM_NONE || other_ref == MPTEST__SYM_NONE) {
+      /* Both lists must end at the same time */
+      res = sym_ref == other_ref;
+      continue;
+    }
+    if (!mptest__sym_equals_tree(sym, other, sym_ref, other_ref)) {
+      res = 0;
+    } else if (
+        mn_int32_vec_push(&stk, mptest__sym_next_sibling(sym, sym_ref)) ||
+        mn_int32_vec_push(&stk, mptest__sym_next_sibling(other, other_ref)) ||
+        mn_int32_vec_push(&stk, mptest__sym_first_child(sym, sym_ref)) ||
+        mn_int32_vec_push(&stk, mptest__sym_first_child(other, other_ref))) {
+      res = -1;
+    }
+  }
+  mn_int32_vec_destroy(&stk);
+  return res;
+}
+
+/* Largest tree printed in full when it isn't what was expected */
+#define MPTEST__SYM_DUMP_MAX 64
+
+/* Greatest number of differences printed for one inequality */
+#define MPTEST__SYM_DIFF_MAX 16
+
+/* Greatest number of trees printed on one line of a difference */
+#define MPTEST__SYM_INLINE_MAX 16
+
+/* Largest pair of differing child lists that is aligned child by child, in
+ * pairs of children; larger ones are reported as replaced wholesale */
+#define MPTEST__SYM_ALIGN_MAX 4096
+
+/* A run of `actual_count` siblings of the actual tree, starting at
+ * `actual_ref`, found in place of `expected_count` siblings of the expected
+ * tree. The run is child `index` of the actual tree `parent_ref`, `depth`
+ * levels down. */
+typedef struct mptest__sym_hunk {
+  mn_int32 actual_ref;
+  mn_int32 actual_count;
+  mn_int32 expected_ref;
+  mn_int32 expected_count;
+  mn_int32 parent_ref;
+  mn_int32 index;
+  mn_int32 depth;
+} mptest__sym_hunk;
+
+MN__VEC_DECL(mptest__sym_hunk);
+MN__VEC_IMPL_FUNC(mptest__sym_hunk, init)
+MN__VEC_IMPL_FUNC(mptest__sym_hunk, destroy)
+MN__VEC_IMPL_FUNC(mptest__sym_hunk, push)
+MN__VEC_IMPL_FUNC(mptest__sym_hunk, pop)
+MN__VEC_IMPL_FUNC(mptest__sym_hunk, size)
+MN__VEC_IMPL_FUNC(mptest__sym_hunk, get)
+MN__VEC_IMPL_FUNC(mptest__sym_hunk, clear)
+
+/* Print `ref` on one line, eliding all but its first few trees. */
+MN_INTERNAL void mptest__sym_print_inline(mptest_sym* sym, mn_int32 ref)
+{
+  mn_int32_vec stk;
+  mn_int32 first_child_ref = mptest__sym_first_child(sym, ref);
+  int trees = 1;
+  if (first_child_ref == MPTEST__SYM_NONE) {
+    mptest__sym_dump_leaf(stdout, 1, sym, ref);
+    return;
+  }
+  /* Each open expression is its first child and the next child to print */
+  mn_int32_vec_init(&stk);
+  printf("(");
+  if (mn_int32_vec_push(&stk, first_child_ref) ||
+      mn_int32_vec_push(&stk, first_child_ref)) {
+    goto error;
+  }
+  while (mn_int32_vec_size(&stk)) {
+    mn_size top = mn_int32_vec_size(&stk) - 2;
+    mn_int32 child_ref = mn_int32_vec_get(&stk, top + 1);
+    if (child_ref == MPTEST__SYM_NONE) {
+      printf(")");
+      mn_int32_vec_pop(&stk);
+      mn_int32_vec_pop(&stk);
+      continue;
+    }
+    if (child_ref != mn_int32_vec_get(&stk, top)) {
+      printf(" ");
+    }
+    if (trees++ >= MPTEST__SYM_INLINE_MAX) {
+      /* Close every open expression from here on */
+      printf("...");
+      for (top += 2; top; top -= 2) {
+        mn_int32_vec_set(&stk, top - 1, MPTEST__SYM_NONE);
       }
-      return 1;
-    } else if (parent_tree->type == MPTEST__SYM_TYPE_EXPR) {
-      mn_int32 parent_child_ref = parent_tree->first_child_ref;
-      mn_int32 other_child_ref = other_tree->first_child_ref;
-      mptest__sym_tree* parent_child;
-      mptest__sym_tree* other_child;
-      while (parent_child_ref != MPTEST__SYM_NONE &&
-             other_child_ref != MPTEST__SYM_NONE) {
-        if (!mptest__sym_equals(
-                sym, other, parent_child_ref, other_child_ref)) {
-          return 0;
-        }
-        parent_child = mptest__sym_get(sym, parent_child_ref);
-        other_child = mptest__sym_get(other, other_child_ref);
-        parent_child_ref = parent_child->next_sibling_ref;
-        other_child_ref = other_child->next_sibling_ref;
+      continue;
+    }
+    first_child_ref = mptest__sym_first_child(sym, child_ref);
+    mn_int32_vec_set(&stk, top + 1, mptest__sym_next_sibling(sym, child_ref));
+    if (first_child_ref == MPTEST__SYM_NONE) {
+      mptest__sym_dump_leaf(stdout, 1, sym, child_ref);
+    } else {
+      printf("(");
+      if (mn_int32_vec_push(&stk, first_child_ref) ||
+          mn_int32_vec_push(&stk, first_child_ref)) {
+        goto error;
       }
-      return parent_child_ref == other_child_ref;
     }
-    return 0;
   }
+  mn_int32_vec_destroy(&stk);
+  return;
+error:
+  printf("...");
+  mn_int32_vec_destroy(&stk);
 }
 
-MN_API void mptest_sym_build_init(
-    mptest_sym_build* build, mptest_sym* sym, mn_int32 parent_ref,
-    mn_int32 prev_child_ref)
+/* Print `count` siblings starting at `ref` on one line. */
+MN_INTERNAL void
+mptest__sym_print_run(mptest_sym* sym, mn_int32 ref, mn_int32 count)
 {
-  build->sym = sym;
-  build->parent_ref = parent_ref;
-  build->prev_child_ref = prev_child_ref;
+  mn_int32 i;
+  if (count == 0) {
+    printf("(nothing)");
+  }
+  for (i = 0; i < count; i++) {
+    if (i) {
+      printf(" ");
+    }
+    if (i == MPTEST__SYM_INLINE_MAX / 2) {
+      printf("...and %i more", count - i);
+      break;
+    }
+    mptest__sym_print_inline(sym, ref);
+    ref = mptest__sym_next_sibling(sym, ref);
+  }
 }
 
-MN_API void mptest_sym_build_destroy(mptest_sym_build* build)
+/* Number of siblings printed on either side of a difference */
+#define MPTEST__SYM_CONTEXT 3
+
+/* Print the part of the actual tree around `hunk`. */
+MN_INTERNAL void
+mptest__sym_print_context(mptest_sym* actual, const mptest__sym_hunk* hunk)
 {
-  MN__UNUSED(build);
+  mn_int32 child_ref;
+  mn_int32 i = 0, printed = 0;
+  child_ref = mptest__sym_first_child(actual, hunk->parent_ref);
+  printf("(");
+  if (hunk->index > MPTEST__SYM_CONTEXT) {
+    printf("...");
+    printed++;
+  }
+  while (child_ref != MPTEST__SYM_NONE) {
+    if (i >= hunk->index + hunk->actual_count + MPTEST__SYM_CONTEXT) {
+      printf(" ...");
+      break;
+    } else if (i >= hunk->index - MPTEST__SYM_CONTEXT) {
+      printf("%s", printed++ ? " " : "");
+      mptest__sym_print_inline(actual, child_ref);
+    }
+    child_ref = mptest__sym_next_sibling(actual, child_ref);
+    i++;
+  }
+  printf(")");
 }
 
-MN_API int mptest_sym_build_expr(mptest_sym_build* build, mptest_sym_build* sub)
+MN_INTERNAL void mptest__sym_print_hunk(
+    struct mptest__state* state, mptest_sym* actual, mptest_sym* expected,
+    const mn_int32_vec* path, const mptest__sym_hunk* hunk)
 {
-  mptest__sym_tree new_tree;
-  mn_int32 new_child_ref;
-  int err = 0;
-  mptest__sym_tree_init(&new_tree, MPTEST__SYM_TYPE_EXPR);
-  if ((err = mptest__sym_new(
-           build->sym, build->parent_ref, build->prev_child_ref, new_tree,
-           &new_child_ref))) {
-    return err;
+  mn_size i;
+  mptest__state_print_indent(state);
+  if (hunk->parent_ref == MPTEST__SYM_NONE) {
+    printf("    at the root:\n");
+  } else {
+    printf("    at " MPTEST__COLOR_EMPHASIS "[");
+    for (i = 0; i < mn_int32_vec_size(path); i++) {
+      if (i == 4 && mn_int32_vec_size(path) > 16) {
+        /* Skip the middle of long paths */
+        printf(" ...");
+        i = mn_int32_vec_size(path) - 12;
+      }
+      printf("%s%i", i ? " " : "", mn_int32_vec_get(path, i));
+    }
+    printf("]" MPTEST__COLOR_RESET ", in ");
+    mptest__sym_print_context(actual, hunk);
+    printf(":\n");
   }
-  build->prev_child_ref = new_child_ref;
-  mptest_sym_build_init(sub, build->sym, new_child_ref, MPTEST__SYM_NONE);
-  return err;
+  mptest__state_print_indent(state);
+  printf("      actual:   ");
+  mptest__sym_print_run(actual, hunk->actual_ref, hunk->actual_count);
+  printf("\n");
+  mptest__state_print_indent(state);
+  printf("      expected: ");
+  mptest__sym_print_run(expected, hunk->expected_ref, hunk->expected_count);
+  printf("\n");
 }
 
-MN_API int
-mptest_sym_build_str(mptest_sym_build* build, const char* str, mn_size str_size)
+/* Put the children of `ref` into `children`. */
+MN_INTERNAL int
+mptest__sym_children(mptest_sym* sym, mn_int32 ref, mn_int32_vec* children)
 {
-  mptest__sym_tree new_tree;
-  mn_int32 new_child_ref;
   int err = 0;
-  mptest__sym_tree_init(&new_tree, MPTEST__SYM_TYPE_ATOM_STRING);
-  if ((err =
-           mn__str_init_n(&new_tree.data.str, (const mn_char*)str, str_size))) {
-    return err;
-  }
-  if ((err = mptest__sym_new(
-           build->sym, build->parent_ref, build->prev_child_ref, new_tree,
-           &new_child_ref))) {
-    return err;
+  mn_int32 child_ref = mptest__sym_first_child(sym, ref);
+  mn_int32_vec_clear(children);
+  while (child_ref != MPTEST__SYM_NONE) {
+    if ((err = mn_int32_vec_push(children, child_ref))) {
+      return err;
+    }
+    child_ref = mptest__sym_next_sibling(sym, child_ref);
   }
-  build->prev_child_ref = new_child_ref;
   return err;
 }
 
-MN_API int mptest_sym_build_cstr(mptest_sym_build* build, const char* cstr)
+MN_INTERNAL int mptest__sym_diff_same(
+    mptest_sym* actual, mptest_sym* expected, mn_int32 actual_ref,
+    mn_int32 expected_ref)
 {
-  return mptest_sym_build_str(build, cstr, mn__str_slen((const mn_char*)cstr));
+  return mptest__sym_tree_hash(actual, actual_ref) ==
+             mptest__sym_tree_hash(expected, expected_ref) &&
+         mptest__sym_equals(actual, expected, actual_ref, expected_ref) == 1;
 }
 
-MN_API int mptest_sym_build_num(mptest_sym_build* build, mn_int32 num)
+/* Line up the differing middles of two child lists, `actual_size` children
+ * of `a` and `expected_size` of `e`, by the longest common subsequence of
+ * their hashes. Each unmatched stretch becomes a hunk in `out`. */
+MN_INTERNAL int mptest__sym_diff_align(
+    mptest_sym* actual, mptest_sym* expected, const mn_int32* a,
+    mn_int32 actual_size, const mn_int32* e, mn_int32 expected_size,
+    mptest__sym_hunk hunk, mptest__sym_hunk_vec* out)
 {
-  mptest__sym_tree new_tree;
-  mn_int32 new_child_ref;
   int err = 0;
-  mptest__sym_tree_init(&new_tree, MPTEST__SYM_TYPE_ATOM_NUMBER);
-  new_tree.data.num = num;
-  if ((err = mptest__sym_new(
-           build->sym, build->parent_ref, build->prev_child_ref, new_tree,
-           &new_child_ref))) {
-    return err;
+  mn_int32 width = expected_size + 1;
+  mn_int32 i, j, i_start = 0, j_start = 0;
+  /* lcs[i * width + j] is the length of the longest common subsequence of
+   * the children from a[i] and e[j] on */
+  mn_int32* lcs = (mn_int32*)MN_MALLOC(
+      sizeof(mn_int32) * (mn_size)((actual_size + 1) * width));
+  if (lcs == MN_NULL) {
+    return -1;
   }
-  build->prev_child_ref = new_child_ref;
-  return err;
-}
-
-MN_API int mptest_sym_build_type(mptest_sym_build* build, const char* type)
+  for (i = actual_size; i >= 0; i--) {
+    for (j = expected_size; j >= 0; j--) {
+      mn_int32 cell = 0;
+      if (i == actual_size || j == expected_size) {
+        cell = 0;
+      } else if (
+          mptest__sym_tree_hash(actual, a[i]) ==
+          mptest__sym_tree_hash(expected, e[j])) {
+        cell = lcs[(i + 1) * width + j + 1] + 1;
+      } else {
+        cell = lcs[(i + 1) * width + j];
+        if (lcs[i * width + j + 1] > cell) {
+          cell = lcs[i * width + j + 1];
+        }
+      }
+      lcs[i * width + j] = cell;
+    }
+  }
+  i = 0;
+  j = 0;
+  while (1) {
+    int matched = i < actual_size && j < expected_size &&
+                  mptest__sym_tree_hash(actual, a[i]) ==
+                      mptest__sym_tree_hash(expected, e[j]);
+    int done = i == actual_size && j == expected_size;
+    if ((matched || done) && (i != i_start || j != j_start)) {
+      hunk.actual_ref = i_start < actual_size ? a[i_start] : MPTEST__SYM_NONE;
+      hunk.actual_count = i - i_start;
+      hunk.expected_ref =
+          j_start < expected_size ? e[j_start] : MPTEST__SYM_NONE;
+      hunk.expected_count = j - j_start;
+      hunk.index += i_start;
+      if ((err = mptest__sym_hunk_vec_push(out, hunk))) {
+        goto error;
+      }
+      hunk.index -= i_start;
+    }
+    if (done) {
+      break;
+    } else if (matched) {
+      i_start = ++i;
+      j_start = ++j;
+    } else if (
+        j == expected_size ||
+        (i < actual_size &&
+         lcs[(i + 1) * width + j] >= lcs[i * width + j + 1])) {
+      i++;
+    } else {
+      j++;
+    }
+  }
+error:
+  MN_FREE(lcs);
+  return err;
+}
+
+/* Find where the children of the two trees in `hunk` differ, adding a hunk
+ * to `out` for each differing stretch. Identical subtrees are recognized by
+ * their hashes and skipped without being descended into. */
+MN_INTERNAL int mptest__sym_diff_children(
+    mptest_sym* actual, mptest_sym* expected, const mptest__sym_hunk* hunk,
+    mn_int32_vec* a_children, mn_int32_vec* e_children,
+    mptest__sym_hunk_vec* out)
+{
+  int err = 0;
+  mn_int32 a_size, e_size, prefix = 0, suffix = 0, i;
+  const mn_int32* a;
+  const mn_int32* e;
+  mptest__sym_hunk sub;
+  if ((err = mptest__sym_children(actual, hunk->actual_ref, a_children)) ||
+      (err = mptest__sym_children(expected, hunk->expected_ref, e_children))) {
+    return err;
+  }
+  a = mn_int32_vec_get_data(a_children);
+  e = mn_int32_vec_get_data(e_children);
+  a_size = (mn_int32)mn_int32_vec_size(a_children);
+  e_size = (mn_int32)mn_int32_vec_size(e_children);
+  while (prefix < a_size && prefix < e_size &&
+         mptest__sym_diff_same(actual, expected, a[prefix], e[prefix])) {
+    prefix++;
+  }
+  while (suffix < a_size - prefix && suffix < e_size - prefix &&
+         mptest__sym_diff_same(
+             actual, expected, a[a_size - suffix - 1],
+             e[e_size - suffix - 1])) {
+    suffix++;
+  }
+  a += prefix;
+  e += prefix;
+  a_size -= prefix + suffix;
+  e_size -= prefix + suffix;
+  sub.parent_ref = hunk->actual_ref;
+  sub.depth = hunk->depth + 1;
+  sub.index = prefix;
+  if (a_size == e_size) {
+    /* Most likely the same children with different contents */
+    sub.actual_count = 1;
+    sub.expected_count = 1;
+    for (i = 0; i < a_size; i++) {
+      if (!mptest__sym_diff_same(actual, expected, a[i], e[i])) {
+        sub.actual_ref = a[i];
+        sub.expected_ref = e[i];
+        sub.index = prefix + i;
+        if ((err = mptest__sym_hunk_vec_push(out, sub))) {
+          return err;
+        }
+      }
+    }
+  } else if ((a_size + 1) * (e_size + 1) <= MPTEST__SYM_ALIGN_MAX) {
+    return mptest__sym_diff_align(
+        actual, expected, a, a_size, e, e_size, sub, out);
+  } else {
+    sub.actual_ref = a_size ? a[0] : MPTEST__SYM_NONE;
+    sub.actual_count = a_size;
+    sub.expected_ref = e_size ? e[0] : MPTEST__SYM_NONE;
+    sub.expected_count = e_size;
+    return mptest__sym_hunk_vec_push(out, sub);
+  }
+  return err;
+}
+
+/* Print how `actual` differs from `expected`: both in full if they're small,
+ * otherwise only the places where they differ, in document order. */
+MN_INTERNAL void mptest__sym_diff(
+    struct mptest__state* state, mptest_sym* actual, mptest_sym* expected)
+{
+  int err = 0, printed = 0;
+  /* Hunks left to look at, and the ones found in the last tree looked at */
+  mptest__sym_hunk_vec stk, found;
+  mn_int32_vec path, a_children, e_children;
+  mptest__sym_hunk hunk;
+  if (mptest__sym_size(actual) <=
+          MPTEST__SYM_DUMP_MAX &&
+      mptest__sym_size(expected) <=
+          MPTEST__SYM_DUMP_MAX) {
+    mptest__state_print_indent(state);
+    printf("    actual:\n");
+    mptest__sym_dump(stdout, 1, actual, 0, state->indent_lvl + 6);
+    printf("\n");
+    mptest__state_print_indent(state);
+    printf("    expected:\n");
+    mptest__sym_dump(stdout, 1, expected, 0, state->indent_lvl + 6);
+    printf("\n");
+    return;
+  }
+  mptest__sym_hunk_vec_init(&stk);
+  mptest__sym_hunk_vec_init(&found);
+  mn_int32_vec_init(&path);
+  mn_int32_vec_init(&a_children);
+  mn_int32_vec_init(&e_children);
+  mptest__sym_hash_sweep(actual);
+  mptest__sym_hash_sweep(expected);
+  hunk.actual_ref = 0;
+  hunk.actual_count = 1;
+  hunk.expected_ref = 0;
+  hunk.expected_count = 1;
+  hunk.parent_ref = MPTEST__SYM_NONE;
+  hunk.index = 0;
+  hunk.depth = 0;
+  if ((err = mptest__sym_hunk_vec_push(&stk, hunk))) {
+    goto error;
+  }
+  while (mptest__sym_hunk_vec_size(&stk)) {
+    hunk = mptest__sym_hunk_vec_pop(&stk);
+    /* The path to a hunk is the path to its parent, then its index */
+    while (mn_int32_vec_size(&path) &&
+           mn_int32_vec_size(&path) >= (mn_size)hunk.depth) {
+      mn_int32_vec_pop(&path);
+    }
+    if (hunk.depth && (err = mn_int32_vec_push(&path, hunk.index))) {
+      goto error;
+    }
+    if (hunk.actual_count == 1 && hunk.expected_count == 1 &&
+        mptest__sym_type_of(actual, hunk.actual_ref) ==
+            MPTEST__SYM_TYPE_EXPR &&
+        mptest__sym_type_of(expected, hunk.expected_ref) ==
+            MPTEST__SYM_TYPE_EXPR) {
+      mptest__sym_hunk_vec_clear(&found);
+      if ((err = mptest__sym_diff_children(
+               actual, expected, &hunk, &a_children, &e_children, &found))) {
+        goto error;
+      }
+      if (mptest__sym_hunk_vec_size(&found) == 0) {
+        /* Only the hashes differed */
+        continue;
+      }
+      /* Push in reverse, so that they are popped in document order */
+      while (mptest__sym_hunk_vec_size(&found)) {
+        if ((err = mptest__sym_hunk_vec_push(
+                 &stk, mptest__sym_hunk_vec_pop(&found)))) {
+          goto error;
+        }
+      }
+    } else if (printed++ == MPTEST__SYM_DIFF_MAX) {
+      mptest__state_print_indent(state);
+      printf("    ...and more differences\n");
+      break;
+    } else {
+      mptest__sym_print_hunk(state, actual, expected, &path, &hunk);
+    }
+  }
+error:
+  if (err) {
+    mptest__state_print_indent(state);
+    printf("    ...out of memory\n");
+  }
+  mptest__sym_hunk_vec_destroy(&stk);
+  mptest__sym_hunk_vec_destroy(&found);
+  mn_int32_vec_destroy(&path);
+  mn_int32_vec_destroy(&a_children);
+  mn_int32_vec_destroy(&e_children);
+}
+
+MN_API void mptest_sym_build_init(
+    mptest_sym_build* build, mptest_sym* sym, mn_int32 parent_ref,
+    mn_int32 prev_child_ref)
+{
+  build->sym = sym;
+  build->parent_ref = parent_ref;
+  build->prev_child_ref = prev_child_ref;
+}
+
+MN_API void mptest_sym_build_destroy(mptest_sym_build* build)
+{
+  MN__UNUSED(build);
+}
+
+MN_API int mptest_sym_build_expr(mptest_sym_build* build, mptest_sym_build* sub)
+{
+  mn_int32 new_child_ref;
+  int err = 0;
+  if ((err = mptest__sym_new(
+           build->sym, build->parent_ref, build->prev_child_ref,
+           MPTEST__SYM_TYPE_EXPR, 0, &new_child_ref))) {
+    return err;
+  }
+  build->prev_child_ref = new_child_ref;
+  mptest_sym_build_init(sub, build->sym, new_child_ref, MPTEST__SYM_NONE);
+  return err;
+}
+
+MN_API int
+mptest_sym_build_str(mptest_sym_build* build, const char* str, mn_size str_size)
+{
+  mn_int32 new_child_ref, atom;
+  int err = 0;
+  if ((err = mptest__sym_intern(build->sym, str, str_size, &atom))) {
+    return err;
+  }
+  if ((err = mptest__sym_new(
+           build->sym, build->parent_ref, build->prev_child_ref,
+           MPTEST__SYM_TYPE_ATOM_STRING, atom, &new_child_ref))) {
+    return err;
+  }
+  build->prev_child_ref = new_child_ref;
+  return err;
+}
+
+MN_API int mptest_sym_build_cstr(mptest_sym_build* build, const char* cstr)
+{
+  return mptest_sym_build_str(build, cstr, mn__str_slen((const mn_char*)cstr));
+}
+
+MN_API int mptest_sym_build_num(mptest_sym_build* build, mn_int32 num)
+{
+  mn_int32 new_child_ref;
+  int err = 0;
+  if ((err = mptest__sym_new(
+           build->sym, build->parent_ref, build->prev_child_ref,
+           MPTEST__SYM_TYPE_ATOM_NUMBER, num, &new_child_ref))) {
+    return err;
+  }
+  build->prev_child_ref = new_child_ref;
+  return err;
+}
+
+MN_API int mptest_sym_build_type(mptest_sym_build* build, const char* type)
 {
   mptest_sym_build new;
   int err = 0;
@@ -734,6 +1573,151 @@ MN_API int mptest_sym_build_type(mptest_sym_build* build, const char* type)
   return err;
 }
 
+/* Make room for `trees` more trees, so that building them won't need to
+ * allocate (except for new string atoms). */
+MN_API int mptest_sym_build_reserve(mptest_sym_build* build, mn_size trees)
+{
+  return mptest__sym_reserve(build->sym, trees);
+}
+
+/* Check that the trees of `sym` from `base` on form a forest whose roots are
+ * the sibling chain of `base`: atoms have no children, and every other tree is
+ * linked from exactly one parent or previous sibling. Links must already be
+ * known to point forward, to trees from `base` on. Returns SYM_INVALID if
+ * not. */
+MN_INTERNAL int mptest__sym_check_links(mptest_sym* sym, mn_size base)
+{
+  int err = 0;
+  mn_size size = mptest__sym_size(sym), i;
+  /* Whether each tree is linked yet */
+  mptest__sym_type_byte_vec linked;
+  mptest__sym_type_byte_vec_init(&linked);
+  if ((err = mptest__sym_type_byte_vec_reserve(&linked, size - base))) {
+    goto done;
+  }
+  for (i = base; i < size; i++) {
+    mptest__sym_type_byte_vec_push(&linked, 0);
+  }
+  for (i = base; i < size; i++) {
+    mn_int32 refs[2];
+    int j;
+    refs[0] = mptest__sym_first_child(sym, (mn_int32)i);
+    refs[1] = mptest__sym_next_sibling(sym, (mn_int32)i);
+    if (refs[0] != MPTEST__SYM_NONE &&
+        mptest__sym_type_of(sym, (mn_int32)i) != MPTEST__SYM_TYPE_EXPR) {
+      err = SYM_INVALID;
+      goto done;
+    }
+    for (j = 0; j < 2; j++) {
+      if (refs[j] == MPTEST__SYM_NONE) {
+        continue;
+      } else if (mptest__sym_type_byte_vec_get(
+                     &linked, (mn_size)refs[j] - base)) {
+        /* Linked twice */
+        err = SYM_INVALID;
+        goto done;
+      }
+      mptest__sym_type_byte_vec_set(&linked, (mn_size)refs[j] - base, 1);
+    }
+  }
+  for (i = base + 1; i < size; i++) {
+    if (!mptest__sym_type_byte_vec_get(&linked, i - base)) {
+      /* Unreachable */
+      err = SYM_INVALID;
+      goto done;
+    }
+  }
+done:
+  mptest__sym_type_byte_vec_destroy(&linked);
+  return err;
+}
+
+/* Add `count` trees at once, from `nodes`. The first of them and its
+ * siblings become the next children of `build`. Returns SYM_INVALID, adding
+ * nothing, unless every other node is linked exactly once and only
+ * expressions have children. */
+MN_API int mptest_sym_build_bulk(
+    mptest_sym_build* build, const mptest_sym_node* nodes, mn_size count)
+{
+  int err = 0;
+  mptest_sym* sym = build->sym;
+  mn_size i, base = mptest__sym_size(sym);
+  mn_int32 last = 0;
+  if (count == 0) {
+    return err;
+  } else if (count > 0x7FFFFFFF - base) {
+    return SYM_INVALID;
+  }
+  if ((err = mptest__sym_reserve(sym, count))) {
+    return err;
+  }
+  for (i = 0; i < count; i++) {
+    const mptest_sym_node* node = nodes + i;
+    mn_int32 first_child = node->first_child, next_sibling = node->next_sibling;
+    mn_int32 data = node->num;
+    mptest__sym_type type;
+    if ((first_child != MPTEST__SYM_NONE &&
+         (first_child <= (mn_int32)i || (mn_size)first_child >= count)) ||
+        (next_sibling != MPTEST__SYM_NONE &&
+         (next_sibling <= (mn_int32)i || (mn_size)next_sibling >= count))) {
+      err = SYM_INVALID;
+      goto error;
+    }
+    if (node->type == MPTEST_SYM_EXPR) {
+      type = MPTEST__SYM_TYPE_EXPR;
+      data = 0;
+    } else if (first_child != MPTEST__SYM_NONE) {
+      /* Only expressions have children */
+      err = SYM_INVALID;
+      goto error;
+    } else if (node->type == MPTEST_SYM_STR) {
+      type = MPTEST__SYM_TYPE_ATOM_STRING;
+      if ((err = mptest__sym_intern(sym, node->str, node->str_size, &data))) {
+        goto error;
+      }
+    } else if (node->type == MPTEST_SYM_NUM) {
+      type = MPTEST__SYM_TYPE_ATOM_NUMBER;
+    } else {
+      err = SYM_INVALID;
+      goto error;
+    }
+    /* Space was reserved above, so these don't allocate */
+    mptest__sym_type_byte_vec_push(&sym->types, (mptest__sym_type_byte)type);
+    mn_int32_vec_push(
+        &sym->first_child_refs,
+        first_child == MPTEST__SYM_NONE ? first_child
+                                        : (mn_int32)base + first_child);
+    mn_int32_vec_push(
+        &sym->next_sibling_refs,
+        next_sibling == MPTEST__SYM_NONE ? next_sibling
+                                         : (mn_int32)base + next_sibling);
+    mn_int32_vec_push(&sym->data, data);
+  }
+  sym->hashed = 0;
+  if ((err = mptest__sym_check_links(sym, base))) {
+    goto error;
+  }
+  /* Attach the new trees where the next child of `build` goes */
+  if (build->parent_ref != MPTEST__SYM_NONE) {
+    if (build->prev_child_ref == MPTEST__SYM_NONE) {
+      mn_int32_vec_set(
+          &sym->first_child_refs, (mn_size)build->parent_ref, (mn_int32)base);
+    } else {
+      mn_int32_vec_set(
+          &sym->next_sibling_refs, (mn_size)build->prev_child_ref,
+          (mn_int32)base);
+    }
+  }
+  while (nodes[last].next_sibling != MPTEST__SYM_NONE) {
+    last = nodes[last].next_sibling;
+  }
+  build->prev_child_ref = (mn_int32)base + last;
+  return err;
+error:
+  mptest__sym_truncate(sym, base);
+  return err;
+}
+
 MN_API void mptest_sym_walk_init(
     mptest_sym_walk* walk, const mptest_sym* sym, mn_int32 parent_ref,
     mn_int32 prev_child_ref)
@@ -746,19 +1730,16 @@ MN_API void mptest_sym_walk_init(
 MN_API int
 mptest__sym_walk_peeknext(mptest_sym_walk* walk, mn_int32* out_child_ref)
 {
-  const mptest__sym_tree* prev;
   mn_int32 child_ref;
   if (walk->parent_ref == MPTEST__SYM_NONE) {
-    if (!mptest__sym_tree_vec_size(&walk->sym->tree_storage)) {
+    if (!mptest__sym_size(walk->sym)) {
       return SYM_EMPTY;
     }
     child_ref = 0;
   } else if (walk->prev_child_ref == MPTEST__SYM_NONE) {
-    prev = mptest__sym_getcref(walk->sym, walk->parent_ref);
-    child_ref = prev->first_child_ref;
+    child_ref = mptest__sym_first_child(walk->sym, walk->parent_ref);
   } else {
-    prev = mptest__sym_getcref(walk->sym, walk->prev_child_ref);
-    child_ref = prev->next_sibling_ref;
+    child_ref = mptest__sym_next_sibling(walk->sym, walk->prev_child_ref);
   }
   if (child_ref == MPTEST__SYM_NONE) {
     return SYM_NO_MORE;
@@ -781,13 +1762,11 @@ mptest__sym_walk_getnext(mptest_sym_walk* walk, mn_int32* out_child_ref)
 MN_API int mptest_sym_walk_getexpr(mptest_sym_walk* walk, mptest_sym_walk* sub)
 {
   int err = 0;
-  const mptest__sym_tree* child;
   mn_int32 child_ref;
   if ((err = mptest__sym_walk_getnext(walk, &child_ref))) {
     return err;
   }
-  child = mptest__sym_getcref(walk->sym, child_ref);
-  if (child->type != MPTEST__SYM_TYPE_EXPR) {
+  if (mptest__sym_type_of(walk->sym, child_ref) != MPTEST__SYM_TYPE_EXPR) {
     return SYM_WRONG_TYPE;
   } else {
     mptest_sym_walk_init(sub, walk->sym, child_ref, MPTEST__SYM_NONE);
@@ -799,17 +1778,17 @@ MN_API int mptest_sym_walk_getstr(
     mptest_sym_walk* walk, const char** str, mn_size* str_size)
 {
   int err = 0;
-  const mptest__sym_tree* child;
-  mn_int32 child_ref;
+  mn_int32 child_ref, atom;
   if ((err = mptest__sym_walk_getnext(walk, &child_ref))) {
     return err;
   }
-  child = mptest__sym_getcref(walk->sym, child_ref);
-  if (child->type != MPTEST__SYM_TYPE_ATOM_STRING) {
+  if (mptest__sym_type_of(walk->sym, child_ref) !=
+      MPTEST__SYM_TYPE_ATOM_STRING) {
     return SYM_WRONG_TYPE;
   } else {
-    *str = (const char*)mn__str_get_data(&child->data.str);
-    *str_size = mn__str_size(&child->data.str);
+    atom = mptest__sym_data(walk->sym, child_ref);
+    *str = mptest__sym_atom_data(walk->sym, atom);
+    *str_size = mptest__sym_atom_get(walk->sym, atom)->size;
     return 0;
   }
 }
@@ -817,16 +1796,15 @@ MN_API int mptest_sym_walk_getstr(
 MN_API int mptest_sym_walk_getnum(mptest_sym_walk* walk, mn_int32* num)
 {
   int err = 0;
-  const mptest__sym_tree* child;
   mn_int32 child_ref;
   if ((err = mptest__sym_walk_getnext(walk, &child_ref))) {
     return err;
   }
-  child = mptest__sym_getcref(walk->sym, child_ref);
-  if (child->type != MPTEST__SYM_TYPE_ATOM_NUMBER) {
+  if (mptest__sym_type_of(walk->sym, child_ref) !=
+      MPTEST__SYM_TYPE_ATOM_NUMBER) {
     return SYM_WRONG_TYPE;
   } else {
-    *num = child->data.num;
+    *num = mptest__sym_data(walk->sym, child_ref);
     return 0;
   }
 }
@@ -852,23 +1830,22 @@ mptest_sym_walk_checktype(mptest_sym_walk* walk, const char* expected_type)
 
 MN_API int mptest_sym_walk_hasmore(mptest_sym_walk* walk)
 {
-  const mptest__sym_tree* prev;
   if (walk->parent_ref == MPTEST__SYM_NONE) {
-    if (mptest__sym_tree_vec_size(&walk->sym->tree_storage) == 0) {
+    if (mptest__sym_size(walk->sym) == 0) {
       return 0;
     } else {
       return 1;
     }
   } else if (walk->prev_child_ref == MPTEST__SYM_NONE) {
-    prev = mptest__sym_getcref(walk->sym, walk->parent_ref);
-    if (prev->first_child_ref == MPTEST__SYM_NONE) {
+    if (mptest__sym_first_child(walk->sym, walk->parent_ref) ==
+        MPTEST__SYM_NONE) {
       return 0;
     } else {
       return 1;
     }
   } else {
-    prev = mptest__sym_getcref(walk->sym, walk->prev_child_ref);
-    if (prev->next_sibling_ref == MPTEST__SYM_NONE) {
+    if (mptest__sym_next_sibling(walk->sym, walk->prev_child_ref) ==
+        MPTEST__SYM_NONE) {
       return 0;
     } else {
       return 1;
@@ -879,37 +1856,206 @@ MN_API int mptest_sym_walk_hasmore(mptest_sym_walk* walk)
 MN_API int mptest_sym_walk_peekstr(mptest_sym_walk* walk)
 {
   int err = 0;
-  const mptest__sym_tree* child;
   mn_int32 child_ref;
   if ((err = mptest__sym_walk_peeknext(walk, &child_ref))) {
     return err;
   }
-  child = mptest__sym_getcref(walk->sym, child_ref);
-  return child->type == MPTEST__SYM_TYPE_ATOM_STRING;
+  return mptest__sym_type_of(walk->sym, child_ref) ==
+         MPTEST__SYM_TYPE_ATOM_STRING;
 }
 
 MN_API int mptest_sym_walk_peekexpr(mptest_sym_walk* walk)
 {
   int err = 0;
-  const mptest__sym_tree* child;
   mn_int32 child_ref;
   if ((err = mptest__sym_walk_peeknext(walk, &child_ref))) {
     return err;
   }
-  child = mptest__sym_getcref(walk->sym, child_ref);
-  return child->type == MPTEST__SYM_TYPE_EXPR;
+  return mptest__sym_type_of(walk->sym, child_ref) == MPTEST__SYM_TYPE_EXPR;
 }
 
 MN_API int mptest_sym_walk_peeknum(mptest_sym_walk* walk)
 {
   int err = 0;
-  const mptest__sym_tree* child;
   mn_int32 child_ref;
   if ((err = mptest__sym_walk_peeknext(walk, &child_ref))) {
     return err;
   }
-  child = mptest__sym_getcref(walk->sym, child_ref);
-  return child->type == MPTEST__SYM_TYPE_ATOM_NUMBER;
+  return mptest__sym_type_of(walk->sym, child_ref) ==
+         MPTEST__SYM_TYPE_ATOM_NUMBER;
+}
+
+MN_INTERNAL void mptest__sym_cache_init(struct mptest__state* state)
+{
+  state->sym_state.actual = MN_NULL;
+  state->sym_state.cache = MN_NULL;
+  state->sym_state.cache_size = 0;
+  state->sym_state.cache_count = 0;
+  state->sym_state.snapshot = MN_NULL;
+  state->sym_state.update_snapshots = 0;
+  state->sym_state.pool = MN_NULL;
+  state->sym_state.pool_size = 0;
+  state->sym_state.pool_used = 0;
+}
+
+MN_INTERNAL void mptest__sym_cache_destroy(struct mptest__state* state)
+{
+  mn_size i;
+  for (i = 0; i < state->sym_state.cache_size; i++) {
+    mptest__sym_cache_entry* entry = state->sym_state.cache + i;
+    if (entry->sym != MN_NULL) {
+      mptest__sym_destroy(entry->sym);
+      MN_FREE(entry->sym);
+      MN_FREE(entry->text);
+    }
+  }
+  if (state->sym_state.cache != MN_NULL) {
+    MN_FREE(state->sym_state.cache);
+  }
+  if (state->sym_state.actual != MN_NULL) {
+    mptest__sym_destroy(state->sym_state.actual);
+    MN_FREE(state->sym_state.actual);
+  }
+  if (state->sym_state.snapshot != MN_NULL) {
+    mptest__sym_destroy(state->sym_state.snapshot);
+    MN_FREE(state->sym_state.snapshot);
+  }
+  for (i = 0; i < state->sym_state.pool_size; i++) {
+    if (state->sym_state.pool[i] != MN_NULL) {
+      mptest__sym_destroy(state->sym_state.pool[i]);
+      MN_FREE(state->sym_state.pool[i]);
+    }
+  }
+  if (state->sym_state.pool != MN_NULL) {
+    MN_FREE(state->sym_state.pool);
+  }
+  mptest__sym_cache_init(state);
+}
+
+/* Find the slot of the cache that holds the tree parsed from `str`, or the
+ * empty slot where it belongs. */
+MN_INTERNAL mptest__sym_cache_entry*
+mptest__sym_cache_slot(struct mptest__state* state, const char* str)
+{
+  mn_size mask = state->sym_state.cache_size - 1;
+  /* Pooled literals may be only a byte apart, so hash the whole address, then
+   * fold the better-mixed upper bits of the product into the slot */
+  mn_size hash = (mn_size)str * 0x9E3779B1UL;
+  mn_size slot = (hash ^ (hash >> 16)) & mask;
+  mptest__sym_cache_entry* entry;
+  while ((entry = state->sym_state.cache + slot)->sym != MN_NULL &&
+         entry->str != str) {
+    slot = (slot + 1) & mask;
+  }
+  return entry;
+}
+
+/* Double the size of the cache, reinserting every entry. */
+MN_INTERNAL int mptest__sym_cache_grow(struct mptest__state* state)
+{
+  mn_size old_size = state->sym_state.cache_size;
+  mptest__sym_cache_entry* old_cache = state->sym_state.cache;
+  mn_size i;
+  mn_size size = old_size ? old_size * 2 : 16;
+  mptest__sym_cache_entry* cache = (mptest__sym_cache_entry*)MN_MALLOC(
+      sizeof(mptest__sym_cache_entry) * size);
+  if (cache == MN_NULL) {
+    return -1;
+  }
+  for (i = 0; i < size; i++) {
+    cache[i].str = MN_NULL;
+    cache[i].text = MN_NULL;
+    cache[i].sym = MN_NULL;
+  }
+  state->sym_state.cache = cache;
+  state->sym_state.cache_size = size;
+  for (i = 0; i < old_size; i++) {
+    if (old_cache[i].sym != MN_NULL) {
+      *mptest__sym_cache_slot(state, old_cache[i].str) = old_cache[i];
+    }
+  }
+  if (old_cache != MN_NULL) {
+    MN_FREE(old_cache);
+  }
+  return 0;
+}
+
+/* Get the tree parsed from `str`, parsing it only if this address hasn't been
+ * seen before or now holds a different string. */
+MN_INTERNAL int mptest__sym_cache_get(
+    struct mptest__state* state, const char* str, mptest_sym** sym_out,
+    const char** err_msg, mn_size* err_pos)
+{
+  int err = 0;
+  mptest__sym_cache_entry* entry;
+  mptest_sym* sym;
+  char* text;
+  mn__str_view in_str_view;
+  mptest_sym_build parse_build;
+  mn_size str_size;
+  mn_size i;
+  if ((state->sym_state.cache_count + 1) * 2 > state->sym_state.cache_size) {
+    if ((err = mptest__sym_cache_grow(state))) {
+      return err;
+    }
+  }
+  entry = mptest__sym_cache_slot(state, str);
+  if (entry->sym != MN_NULL && mptest__streq(entry->text, str)) {
+    *sym_out = entry->sym;
+    return err;
+  }
+  str_size = mn__str_slen(str);
+  sym = (mptest_sym*)MN_MALLOC(sizeof(mptest_sym));
+  if (sym == MN_NULL) {
+    return -1;
+  }
+  mptest__sym_init(sym);
+  mn__str_view_init_n(&in_str_view, str, str_size);
+  mptest_sym_build_init(&parse_build, sym, MPTEST__SYM_NONE, MPTEST__SYM_NONE);
+  if ((err = mptest__sym_parse_do(
+           &parse_build, in_str_view, err_msg, err_pos))) {
+    goto error;
+  }
+  text = (char*)MN_MALLOC(str_size + 1);
+  if (text == MN_NULL) {
+    err = -1;
+    goto error;
+  }
+  for (i = 0; i <= str_size; i++) {
+    text[i] = str[i];
+  }
+  if (entry->sym != MN_NULL) {
+    /* The address now holds a different string */
+    mptest__sym_destroy(entry->sym);
+    MN_FREE(entry->sym);
+    MN_FREE(entry->text);
+  } else {
+    state->sym_state.cache_count++;
+  }
+  entry->str = str;
+  entry->text = text;
+  entry->sym = sym;
+  *sym_out = sym;
+  return err;
+error:
+  mptest__sym_destroy(sym);
+  MN_FREE(sym);
+  return err;
+}
+
+/* Empty the sym in `slot`, making one if there isn't one yet. */
+MN_INTERNAL int mptest__sym_reuse(mptest_sym** slot)
+{
+  if (*slot == MN_NULL) {
+    *slot = (mptest_sym*)MN_MALLOC(sizeof(mptest_sym));
+    if (*slot == MN_NULL) {
+      return -1;
+    }
+    mptest__sym_init(*slot);
+  } else {
+    mptest__sym_clear(*slot);
+  }
+  return 0;
 }
 
 MN_API int mptest__sym_check_init(
@@ -917,45 +2063,24 @@ MN_API int mptest__sym_check_init(
     const char* msg)
 {
   int err = 0;
-  mptest_sym* sym_actual = MN_NULL;
-  mptest_sym* sym_expected = MN_NULL;
-  mn__str_view in_str_view;
+  mptest_sym* sym_actual;
+  mptest_sym* sym_expected;
   const char* err_msg;
   mn_size err_pos;
-  mptest_sym_build parse_build;
-  sym_actual = (mptest_sym*)MN_MALLOC(sizeof(mptest_sym));
-  if (sym_actual == MN_NULL) {
-    err = 1;
+  if ((err = mptest__sym_reuse(&mptest__state_g.sym_state.actual))) {
     goto error;
   }
-  mptest__sym_init(sym_actual);
-  sym_expected = (mptest_sym*)MN_MALLOC(sizeof(mptest_sym));
-  if (sym_expected == MN_NULL) {
-    err = 1;
+  sym_actual = mptest__state_g.sym_state.actual;
+  if ((err = mptest__sym_cache_get(
+           &mptest__state_g, str, &sym_expected, &err_msg, &err_pos))) {
     goto error;
   }
-  mptest__sym_init(sym_expected);
   mptest_sym_build_init(
       build_out, sym_actual, MPTEST__SYM_NONE, MPTEST__SYM_NONE);
-  mn__str_view_init_n(&in_str_view, str, mn__str_slen(str));
-  mptest_sym_build_init(
-      &parse_build, sym_expected, MPTEST__SYM_NONE, MPTEST__SYM_NONE);
-  if ((err = mptest__sym_parse_do(
-           &parse_build, in_str_view, &err_msg, &err_pos))) {
-    goto error;
-  }
   mptest__state_g.fail_data.sym_fail_data.sym_actual = sym_actual;
   mptest__state_g.fail_data.sym_fail_data.sym_expected = sym_expected;
   return err;
 error:
-  if (sym_actual != MN_NULL) {
-    mptest__sym_destroy(sym_actual);
-    MN_FREE(sym_actual);
-  }
-  if (sym_expected != MN_NULL) {
-    mptest__sym_destroy(sym_expected);
-    MN_FREE(sym_expected);
-  }
   if (err == MPTEST__SYM_PARSE_ERROR) { /* parse error */
     mptest__state_g.fail_reason = MPTEST__FAIL_REASON_SYM_SYNTAX;
     mptest__state_g.fail_file = file;
@@ -972,27 +2097,56 @@ error:
   return err;
 }
 
+/* Returns 0 if the syms are equal, 1 if not, and -1 if out of memory. */
 MN_API int mptest__sym_check(const char* file, int line, const char* msg)
 {
-  if (!mptest__sym_equals(
-          mptest__state_g.fail_data.sym_fail_data.sym_actual,
-          mptest__state_g.fail_data.sym_fail_data.sym_expected, 0, 0)) {
-    mptest__state_g.fail_reason = MPTEST__FAIL_REASON_SYM_INEQUALITY;
-    mptest__state_g.fail_file = file;
-    mptest__state_g.fail_line = line;
-    mptest__state_g.fail_msg = msg;
-    return 1;
-  } else {
+  int res;
+  mptest__sym_hash_sweep(mptest__state_g.fail_data.sym_fail_data.sym_actual);
+  mptest__sym_hash_sweep(mptest__state_g.fail_data.sym_fail_data.sym_expected);
+  res = mptest__sym_equals(
+      mptest__state_g.fail_data.sym_fail_data.sym_actual,
+      mptest__state_g.fail_data.sym_fail_data.sym_expected, 0, 0);
+  if (res == 1) {
     return 0;
   }
+  mptest__state_g.fail_reason = res ? MPTEST__FAIL_REASON_NOMEM
+                                    : MPTEST__FAIL_REASON_SYM_INEQUALITY;
+  mptest__state_g.fail_file = file;
+  mptest__state_g.fail_line = line;
+  mptest__state_g.fail_msg = msg;
+  return res ? -1 : 1;
 }
 
+/* Both trees stay with the runner for the next assertion to reuse. */
 MN_API void mptest__sym_check_destroy(void)
 {
-  mptest__sym_destroy(mptest__state_g.fail_data.sym_fail_data.sym_actual);
-  mptest__sym_destroy(mptest__state_g.fail_data.sym_fail_data.sym_expected);
-  MN_FREE(mptest__state_g.fail_data.sym_fail_data.sym_actual);
-  MN_FREE(mptest__state_g.fail_data.sym_fail_data.sym_expected);
+  mptest__state_g.fail_data.sym_fail_data.sym_actual = MN_NULL;
+  mptest__state_g.fail_data.sym_fail_data.sym_expected = MN_NULL;
+}
+
+/* Take an empty sym from the pool, growing it if every sym is in use. */
+MN_INTERNAL int mptest__sym_pool_get(mptest_sym** out)
+{
+  mptest__sym_state* sym_state = &mptest__state_g.sym_state;
+  int err = 0;
+  if (sym_state->pool_used == sym_state->pool_size) {
+    mn_size i, new_size = sym_state->pool_size ? sym_state->pool_size * 2 : 4;
+    mptest_sym** new_pool = (mptest_sym**)MN_REALLOC(
+        sym_state->pool, sizeof(mptest_sym*) * new_size);
+    if (new_pool == MN_NULL) {
+      return -1;
+    }
+    for (i = sym_state->pool_size; i < new_size; i++) {
+      new_pool[i] = MN_NULL;
+    }
+    sym_state->pool = new_pool;
+    sym_state->pool_size = new_size;
+  }
+  if ((err = mptest__sym_reuse(sym_state->pool + sym_state->pool_used))) {
+    return err;
+  }
+  *out = sym_state->pool[sym_state->pool_used++];
+  return err;
 }
 
 MN_API int mptest__sym_make_init(
@@ -1003,13 +2157,10 @@ MN_API int mptest__sym_make_init(
   const char* err_msg;
   mn_size err_pos;
   int err = 0;
-  mptest_sym* sym_out;
-  sym_out = (mptest_sym*)MN_MALLOC(sizeof(mptest_sym));
-  if (sym_out == MN_NULL) {
-    err = 1;
+  mptest_sym* sym_out = MN_NULL;
+  if ((err = mptest__sym_pool_get(&sym_out))) {
     goto error;
   }
-  mptest__sym_init(sym_out);
   mptest_sym_build_init(build_out, sym_out, MPTEST__SYM_NONE, MPTEST__SYM_NONE);
   mn__str_view_init_n(&in_str_view, str, mn__str_slen(str));
   if ((err =
@@ -1020,8 +2171,7 @@ MN_API int mptest__sym_make_init(
   return err;
 error:
   if (sym_out) {
-    mptest__sym_destroy(sym_out);
-    MN_FREE(sym_out);
+    mptest__sym_make_destroy(build_out);
   }
   if (err == MPTEST__SYM_PARSE_ERROR) { /* parse error */
     mptest__state_g.fail_reason = MPTEST__FAIL_REASON_SYM_SYNTAX;
@@ -1039,10 +2189,472 @@ error:
   return err;
 }
 
+/* Give the sym of `build` back to the pool, keeping its storage. */
 MN_API void mptest__sym_make_destroy(mptest_sym_build* build)
 {
-  mptest__sym_destroy(build->sym);
-  MN_FREE(build->sym);
+  mptest__sym_state* sym_state = &mptest__state_g.sym_state;
+  MN_ASSERT(sym_state->pool_used);
+  MN_ASSERT(build->sym == sym_state->pool[sym_state->pool_used - 1]);
+  MN__UNUSED(build);
+  sym_state->pool_used--;
+}
+
+/* Snapshot files start with this, followed by the number of trees, the
+ * number of atoms and the size of the atom text. Then come four words per
+ * tree (type, first child, next sibling, number or atom), one word per atom
+ * (its size), and the text of every atom with a NUL after each. Words are
+ * 32-bit little-endian, and refs that point nowhere are all ones. */
+#define MPTEST__SYM_SNAPSHOT_MAGIC "mpsym\0\0\1"
+
+#define MPTEST__SYM_SNAPSHOT_MAGIC_SIZE 8
+
+#define MPTEST__SYM_SNAPSHOT_HEADER_SIZE (MPTEST__SYM_SNAPSHOT_MAGIC_SIZE + 12)
+
+#define MPTEST__SYM_SNAPSHOT_NONE 0xFFFFFFFFUL
+
+/* Contents of a snapshot file, mapped into memory where possible. */
+typedef struct mptest__sym_snapshot_file {
+  const unsigned char* data;
+  mn_size size;
+  /* Buffer read into where files can't be mapped */
+  unsigned char* buf;
+} mptest__sym_snapshot_file;
+
+MN_INTERNAL int mptest__sym_put_word(mn__str* out, unsigned long word)
+{
+  mn_char bytes[4];
+  bytes[0] = (mn_char)(word & 0xFF);
+  bytes[1] = (mn_char)((word >> 8) & 0xFF);
+  bytes[2] = (mn_char)((word >> 16) & 0xFF);
+  bytes[3] = (mn_char)((word >> 24) & 0xFF);
+  return mn__str_cat_n(out, bytes, 4);
+}
+
+MN_INTERNAL unsigned long mptest__sym_get_word(const unsigned char* in)
+{
+  return (unsigned long)in[0] | ((unsigned long)in[1] << 8) |
+         ((unsigned long)in[2] << 16) | ((unsigned long)in[3] << 24);
+}
+
+/* Get the word for `ref`, numbered by `tree_map`. */
+MN_INTERNAL unsigned long
+mptest__sym_ref_word(const mn_int32* tree_map, mn_int32 ref)
+{
+  return ref == MPTEST__SYM_NONE ? MPTEST__SYM_SNAPSHOT_NONE
+                                 : (unsigned long)tree_map[ref];
+}
+
+/* Write the trees of `sym` to `out` in snapshot format. Trees are
+ * numbered in preorder and atoms in order of first use, so equal trees
+ * always give the same bytes. */
+MN_INTERNAL int mptest__sym_serialize(mptest_sym* sym, mn__str* out)
+{
+  int err = 0;
+  mn_size tree_count = mptest__sym_size(sym);
+  mn_size atom_count = mptest__sym_atom_vec_size(&sym->atoms);
+  mn_int32* tree_map;
+  mn_int32* atom_map;
+  mn_int32_vec trees, atoms, stk;
+  mn_size i, text_size = 0;
+  mn_int32_vec_init(&trees);
+  mn_int32_vec_init(&atoms);
+  mn_int32_vec_init(&stk);
+  mn__str_clear(out);
+  tree_map = (mn_int32*)MN_MALLOC(sizeof(mn_int32) * (tree_count + 1));
+  atom_map = (mn_int32*)MN_MALLOC(sizeof(mn_int32) * (atom_count + 1));
+  if (tree_map == MN_NULL || atom_map == MN_NULL) {
+    err = -1;
+    goto error;
+  }
+  for (i = 0; i < atom_count; i++) {
+    atom_map[i] = MPTEST__SYM_NONE;
+  }
+  if (tree_count && (err = mn_int32_vec_push(&stk, 0))) {
+    goto error;
+  }
+  while (mn_int32_vec_size(&stk)) {
+    mn_int32 ref = mn_int32_vec_pop(&stk);
+    mn_int32 next_sibling_ref = mptest__sym_next_sibling(sym, ref);
+    mn_int32 first_child_ref = mptest__sym_first_child(sym, ref);
+    mn_int32 atom = mptest__sym_data(sym, ref);
+    tree_map[ref] = (mn_int32)mn_int32_vec_size(&trees);
+    if ((err = mn_int32_vec_push(&trees, ref))) {
+      goto error;
+    }
+    if (mptest__sym_type_of(sym, ref) == MPTEST__SYM_TYPE_ATOM_STRING &&
+        atom_map[atom] == MPTEST__SYM_NONE) {
+      atom_map[atom] = (mn_int32)mn_int32_vec_size(&atoms);
+      text_size += mptest__sym_atom_get(sym, atom)->size + 1;
+      if ((err = mn_int32_vec_push(&atoms, atom))) {
+        goto error;
+      }
+    }
+    if ((next_sibling_ref != MPTEST__SYM_NONE &&
+         (err = mn_int32_vec_push(&stk, next_sibling_ref))) ||
+        (first_child_ref != MPTEST__SYM_NONE &&
+         (err = mn_int32_vec_push(&stk, first_child_ref)))) {
+      goto error;
+    }
+  }
+  if ((err = mn__str_cat_n(
+           out, MPTEST__SYM_SNAPSHOT_MAGIC, MPTEST__SYM_SNAPSHOT_MAGIC_SIZE)) ||
+      (err = mptest__sym_put_word(out, mn_int32_vec_size(&trees))) ||
+      (err = mptest__sym_put_word(out, mn_int32_vec_size(&atoms))) ||
+      (err = mptest__sym_put_word(out, text_size))) {
+    goto error;
+  }
+  for (i = 0; i < mn_int32_vec_size(&trees); i++) {
+    mn_int32 ref = mn_int32_vec_get(&trees, i);
+    mptest__sym_type type = mptest__sym_type_of(sym, ref);
+    unsigned long data = 0;
+    if (type == MPTEST__SYM_TYPE_ATOM_NUMBER) {
+      data = (unsigned long)mptest__sym_data(sym, ref) & MPTEST__SYM_HASH_MASK;
+    } else if (type == MPTEST__SYM_TYPE_ATOM_STRING) {
+      data = (unsigned long)atom_map[mptest__sym_data(sym, ref)];
+    }
+    if ((err = mptest__sym_put_word(out, (unsigned long)type)) ||
+        (err = mptest__sym_put_word(
+             out, mptest__sym_ref_word(
+                      tree_map, mptest__sym_first_child(sym, ref)))) ||
+        (err = mptest__sym_put_word(
+             out, mptest__sym_ref_word(
+                      tree_map, mptest__sym_next_sibling(sym, ref)))) ||
+        (err = mptest__sym_put_word(out, data))) {
+      goto error;
+    }
+  }
+  for (i = 0; i < mn_int32_vec_size(&atoms); i++) {
+    if ((err = mptest__sym_put_word(
+             out,
+             mptest__sym_atom_get(sym, mn_int32_vec_get(&atoms, i))->size))) {
+      goto error;
+    }
+  }
+  for (i = 0; i < mn_int32_vec_size(&atoms); i++) {
+    mn_int32 atom = mn_int32_vec_get(&atoms, i);
+    if ((err = mn__str_cat_n(
+             out, mptest__sym_atom_data(sym, atom),
+             mptest__sym_atom_get(sym, atom)->size + 1))) {
+      goto error;
+    }
+  }
+error:
+  if (tree_map != MN_NULL) {
+    MN_FREE(tree_map);
+  }
+  if (atom_map != MN_NULL) {
+    MN_FREE(atom_map);
+  }
+  mn_int32_vec_destroy(&trees);
+  mn_int32_vec_destroy(&atoms);
+  mn_int32_vec_destroy(&stk);
+  return err;
+}
+
+/* Convert a tree ref read from a snapshot of `count` trees, which must come
+ * after tree `index`. Returns 1 if it doesn't. */
+MN_INTERNAL int mptest__sym_get_ref(
+    unsigned long word, unsigned long index, unsigned long count,
+    mn_int32* ref)
+{
+  if (word == MPTEST__SYM_SNAPSHOT_NONE) {
+    *ref = MPTEST__SYM_NONE;
+    return 0;
+  } else if (word <= index || word >= count) {
+    return 1;
+  }
+  *ref = (mn_int32)word;
+  return 0;
+}
+
+/* Read the snapshot in `data` into `sym`, copying it without parsing it.
+ * Returns 1 if it isn't a valid snapshot. */
+MN_INTERNAL int mptest__sym_deserialize(
+    mptest_sym* sym, const unsigned char* data, mn_size size)
+{
+  int err = 0;
+  unsigned long tree_count, atom_count, text_size, i, pos = 0;
+  const unsigned char* nodes = data + MPTEST__SYM_SNAPSHOT_HEADER_SIZE;
+  const unsigned char* sizes;
+  const char* text;
+  if (size < MPTEST__SYM_SNAPSHOT_HEADER_SIZE) {
+    return 1;
+  }
+  for (i = 0; i < MPTEST__SYM_SNAPSHOT_MAGIC_SIZE; i++) {
+    if (data[i] != (unsigned char)MPTEST__SYM_SNAPSHOT_MAGIC[i]) {
+      return 1;
+    }
+  }
+  size -= MPTEST__SYM_SNAPSHOT_HEADER_SIZE;
+  tree_count = mptest__sym_get_word(data + MPTEST__SYM_SNAPSHOT_MAGIC_SIZE);
+  atom_count = mptest__sym_get_word(data + MPTEST__SYM_SNAPSHOT_MAGIC_SIZE + 4);
+  text_size = mptest__sym_get_word(data + MPTEST__SYM_SNAPSHOT_MAGIC_SIZE + 8);
+  if (tree_count > size / 16 || atom_count > (size - tree_count * 16) / 4 ||
+      text_size != size - tree_count * 16 - atom_count * 4) {
+    return 1;
+  }
+  sizes = nodes + tree_count * 16;
+  text = (const char*)(sizes + atom_count * 4);
+  mptest__sym_clear(sym);
+  for (i = 0; i < atom_count; i++) {
+    unsigned long atom_size = mptest__sym_get_word(sizes + i * 4);
+    mn_int32 atom;
+    if (atom_size >= text_size - pos || text[pos + atom_size] != '\0') {
+      return 1;
+    }
+    if ((err = mptest__sym_intern(sym, text + pos, atom_size, &atom))) {
+      return err;
+    } else if ((unsigned long)atom != i) {
+      /* The same atom twice */
+      return 1;
+    }
+    pos += atom_size + 1;
+  }
+  if (pos != text_size) {
+    return 1;
+  }
+  for (i = 0; i < tree_count; i++) {
+    const unsigned char* node = nodes + i * 16;
+    unsigned long type = mptest__sym_get_word(node);
+    unsigned long word = mptest__sym_get_word(node + 12);
+    mn_int32 first_child_ref, next_sibling_ref, ref, value = 0;
+    if (type > MPTEST__SYM_TYPE_ATOM_NUMBER ||
+        mptest__sym_get_ref(
+            mptest__sym_get_word(node + 4), i, tree_count,
+            &first_child_ref) ||
+        mptest__sym_get_ref(
+            mptest__sym_get_word(node + 8), i, tree_count,
+            &next_sibling_ref)) {
+      return 1;
+    }
+    if (type == MPTEST__SYM_TYPE_ATOM_NUMBER) {
+      /* Undo the two's complement */
+      value = word & 0x80000000UL ? -(mn_int32)(~word & 0x7FFFFFFFUL) - 1
+                                  : (mn_int32)word;
+    } else if (type == MPTEST__SYM_TYPE_ATOM_STRING) {
+      if (word >= atom_count) {
+        return 1;
+      }
+      value = (mn_int32)word;
+    }
+    if ((err = mptest__sym_new(
+             sym, MPTEST__SYM_NONE, MPTEST__SYM_NONE, (mptest__sym_type)type,
+             value, &ref))) {
+      return err;
+    }
+    mn_int32_vec_set(&sym->first_child_refs, (mn_size)ref, first_child_ref);
+    mn_int32_vec_set(&sym->next_sibling_refs, (mn_size)ref, next_sibling_ref);
+  }
+  sym->hashed = 0;
+  if ((err = mptest__sym_check_links(sym, 0)) == SYM_INVALID) {
+    return 1;
+  }
+  return err;
+}
+
+/* Map the file at `path` into memory. Returns 1 if it can't be read. */
+MN_INTERNAL int
+mptest__sym_snapshot_map(const char* path, mptest__sym_snapshot_file* file)
+{
+#if MPTEST__SYM_MMAP
+  struct stat st;
+  void* data;
+  int fd = open(path, O_RDONLY);
+  file->buf = MN_NULL;
+  if (fd == -1) {
+    return 1;
+  } else if (fstat(fd, &st)) {
+    close(fd);
+    return 1;
+  }
+  file->data = (const unsigned char*)"";
+  file->size = (mn_size)st.st_size;
+  if (file->size) {
+    data = mmap(MN_NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return 1;
+    }
+    file->data = (const unsigned char*)data;
+  }
+  close(fd);
+  return 0;
+#else
+  long size;
+  FILE* f = fopen(path, "rb");
+  file->buf = MN_NULL;
+  if (f == MN_NULL) {
+    return 1;
+  } else if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 ||
+             fseek(f, 0, SEEK_SET)) {
+    fclose(f);
+    return 1;
+  }
+  file->size = (mn_size)size;
+  file->buf = (unsigned char*)MN_MALLOC(file->size + 1);
+  if (file->buf == MN_NULL) {
+    fclose(f);
+    return -1;
+  } else if (fread(file->buf, 1, file->size, f) != file->size) {
+    MN_FREE(file->buf);
+    fclose(f);
+    return 1;
+  }
+  file->data = file->buf;
+  fclose(f);
+  return 0;
+#endif
+}
+
+MN_INTERNAL void mptest__sym_snapshot_unmap(mptest__sym_snapshot_file* file)
+{
+#if MPTEST__SYM_MMAP
+  if (file->size) {
+    munmap((void*)file->data, file->size);
+  }
+#else
+  MN_FREE(file->buf);
+#endif
+}
+
+/* Write the snapshot `bin` of `sym` to `path`, and its text to `path`.txt.
+ * Returns 1 if either can't be written. */
+MN_INTERNAL int mptest__sym_snapshot_write(
+    const char* path, mptest_sym* sym, const mn__str* bin)
+{
+  int err = 0;
+  mn__str text_path;
+  FILE* f;
+  mn__str_init(&text_path);
+  if ((err = mn__str_cat_s(&text_path, path)) ||
+      (err = mn__str_cat_s(&text_path, ".txt"))) {
+    goto error;
+  }
+  if ((f = fopen(path, "wb")) == MN_NULL) {
+    err = 1;
+    goto error;
+  }
+  if (fwrite(mn__str_get_data(bin), 1, mn__str_size(bin), f) !=
+      mn__str_size(bin)) {
+    err = 1;
+  }
+  if (fclose(f) || err) {
+    err = 1;
+    goto error;
+  }
+  if ((f = fopen(mn__str_get_data(&text_path), "w")) == MN_NULL) {
+    err = 1;
+    goto error;
+  }
+  if (mptest__sym_size(sym)) {
+    err = mptest__sym_dump(f, 0, sym, 0, 0);
+  }
+  fprintf(f, "\n");
+  if (ferror(f)) {
+    err = 1;
+  }
+  if (fclose(f) && !err) {
+    err = 1;
+  }
+error:
+  mn__str_destroy(&text_path);
+  return err;
+}
+
+MN_API void
+mptest__sym_set_update_snapshots(struct mptest__state* state, int update)
+{
+  state->sym_state.update_snapshots = update;
+}
+
+MN_API int mptest__sym_snapshot_init(
+    mptest_sym_build* build_out, const char* file, int line, const char* msg)
+{
+  int err = 0;
+  if ((err = mptest__sym_reuse(&mptest__state_g.sym_state.actual))) {
+    mptest__state_g.fail_reason = MPTEST__FAIL_REASON_NOMEM;
+    mptest__state_g.fail_file = file;
+    mptest__state_g.fail_line = line;
+    mptest__state_g.fail_msg = msg;
+    return err;
+  }
+  mptest_sym_build_init(
+      build_out, mptest__state_g.sym_state.actual, MPTEST__SYM_NONE,
+      MPTEST__SYM_NONE);
+  return err;
+}
+
+/* Returns 0 if the sym matches the snapshot at `path` (or if it was written
+ * there), 1 if not, and -1 if the snapshot couldn't be used. */
+MN_API int mptest__sym_snapshot_check(
+    const char* path, const char* file, int line, const char* msg)
+{
+  int err = 0;
+  mptest__sym_state* sym_state = &mptest__state_g.sym_state;
+  const char* problem = MN_NULL;
+  mptest__sym_snapshot_file snapshot;
+  mn__str bin;
+  mn_size i;
+  mn__str_init(&bin);
+  if ((err = mptest__sym_serialize(sym_state->actual, &bin))) {
+    goto error;
+  }
+  if (sym_state->update_snapshots) {
+    if ((err = mptest__sym_snapshot_write(path, sym_state->actual, &bin))) {
+      problem = "could not write snapshot";
+    }
+    goto error;
+  }
+  if ((err = mptest__sym_snapshot_map(path, &snapshot))) {
+    problem = "could not read snapshot";
+    goto error;
+  }
+  if (snapshot.size == mn__str_size(&bin)) {
+    /* Serializing is canonical, so equal trees have equal bytes */
+    const char* bytes = mn__str_get_data(&bin);
+    for (i = 0; i < snapshot.size; i++) {
+      if (snapshot.data[i] != (unsigned char)bytes[i]) {
+        break;
+      }
+    }
+    if (i == snapshot.size) {
+      mptest__sym_snapshot_unmap(&snapshot);
+      goto error;
+    }
+  }
+  /* Load the snapshot only to show how it differs */
+  if (!(err = mptest__sym_reuse(&sym_state->snapshot))) {
+    err = mptest__sym_deserialize(
+        sym_state->snapshot, snapshot.data, snapshot.size);
+  }
+  mptest__sym_snapshot_unmap(&snapshot);
+  if (err) {
+    problem = "invalid snapshot";
+    goto error;
+  }
+  mn__str_destroy(&bin);
+  mptest__state_g.fail_data.sym_fail_data.sym_actual = sym_state->actual;
+  mptest__state_g.fail_data.sym_fail_data.sym_expected = sym_state->snapshot;
+  mptest__state_g.fail_reason = MPTEST__FAIL_REASON_SYM_INEQUALITY;
+  mptest__state_g.fail_file = file;
+  mptest__state_g.fail_line = line;
+  mptest__state_g.fail_msg = msg;
+  return 1;
+error:
+  mn__str_destroy(&bin);
+  if (err == -1) {
+    mptest__state_g.fail_reason = MPTEST__FAIL_REASON_NOMEM;
+  } else if (err) {
+    mptest__state_g.fail_reason = MPTEST__FAIL_REASON_SYM_SNAPSHOT;
+    mptest__state_g.fail_data.string_data = problem;
+  }
+  if (err) {
+    mptest__state_g.fail_file = file;
+    mptest__state_g.fail_line = line;
+    mptest__state_g.fail_msg = msg;
+    return -1;
+  }
+  return err;
 }
 
 #endif
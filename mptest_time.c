@@ -1,5 +1,27 @@
 #include "mptest_internal.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#define MPTEST__TIME_POSIX 1
+#include <sys/time.h>
+#else
+#define MPTEST__TIME_POSIX 0
+#include <time.h>
+#endif
+
+/* Seconds of wall time since some fixed point. Time budgets are measured with
+ * this rather than clock(), so that tests that sleep or block on I/O cannot
+ * run past them. */
+MN_INTERNAL double mptest__time_wall(void)
+{
+#if MPTEST__TIME_POSIX
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+#else
+  return (double)time(NULL);
+#endif
+}
+
 #if MPTEST_USE_TIME
 
 MN_INTERNAL void mptest__time_init(struct mptest__state* state)
@@ -11,9 +11,39 @@ TEST(t_fuzz)
   PASS();
 }
 
-static void bad_assert() { MPTEST_INJECT_ASSERT(0); }
+TEST(t_fuzz_fill)
+{
+  unsigned char buf[39] = {0};
+  int i, nonzero = 0;
+  RAND_FILL(buf, 37);
+  for (i = 0; i < 37; i++) {
+    nonzero += buf[i] != 0;
+  }
+  ASSERT_GT(nonzero, 0);
+  ASSERT_EQ(buf[37], 0);
+  ASSERT_EQ(buf[38], 0);
+  PASS();
+}
+
+/* Bounds above 2^32 need more than one draw. Where unsigned long is 32 bits
+ * these shifts give 0, and the test degrades to small bounds. */
+TEST(t_fuzz_wide)
+{
+  mptest_rand above = (mptest_rand)1 << 16 << 16;
+  mptest_rand bound = above | 0x10000;
+  int i, high = 0;
+  for (i = 0; i < 64; i++) {
+    mptest_rand r = RAND_PARAM(bound);
+    ASSERT_LT(r, bound);
+    high += RAND_PARAM(above << 1) >= above;
+  }
+  ASSERT_GT(high, 0);
+  PASS();
+}
 
-static void good_assert() { MPTEST_INJECT_ASSERT(1); }
+static void bad_assert(void) { MPTEST_INJECT_ASSERT(0); }
+
+static void good_assert(void) { MPTEST_INJECT_ASSERT(1); }
 
 TEST(t_assert_catch)
 {
@@ -56,6 +86,74 @@ TEST(t_leak_realloc_SHOULD_FAIL)
   PASS();
 }
 
+TEST(t_leak_use_after_free_SHOULD_FAIL)
+{
+  char* ptr = MPTEST_INJECT_MALLOC(5);
+  MPTEST_INJECT_FREE(ptr);
+  ptr[2] = 'a';
+  PASS();
+}
+
+TEST(t_leak_free_invalid_SHOULD_FAIL)
+{
+  int not_allocated = 0;
+  MPTEST_INJECT_FREE(&not_allocated);
+  PASS();
+}
+
+TEST(t_leak_double_free_SHOULD_FAIL)
+{
+  void* ptr = MPTEST_INJECT_MALLOC(5);
+  MPTEST_INJECT_FREE(ptr);
+  MPTEST_INJECT_FREE(ptr);
+  PASS();
+}
+
+#if MPTEST_USE_THREADS && !defined(_WIN32)
+#include <pthread.h>
+
+static void* leak_thread_work(void* arg)
+{
+  int i;
+  void* ptrs[64];
+  for (i = 0; i < 64; i++) {
+    ptrs[i] = MPTEST_INJECT_MALLOC((size_t)i + 1);
+    ptrs[i] = MPTEST_INJECT_REALLOC(ptrs[i], (size_t)i + 2);
+  }
+  for (i = 0; i < 64; i++) {
+    if (arg == NULL || i != 0) {
+      MPTEST_INJECT_FREE(ptrs[i]);
+    }
+  }
+  return NULL;
+}
+
+static void leak_threads_run(void* arg)
+{
+  pthread_t threads[4];
+  int i;
+  for (i = 0; i < 4; i++) {
+    pthread_create(&threads[i], NULL, leak_thread_work, arg);
+  }
+  for (i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+TEST(t_leak_threads)
+{
+  leak_threads_run(NULL);
+  PASS();
+}
+
+TEST(t_leak_threads_SHOULD_FAIL)
+{
+  static int leak = 1;
+  leak_threads_run(&leak);
+  PASS();
+}
+#endif
+
 #include <stdio.h>
 
 TEST(t_oom_initial)
@@ -82,6 +180,142 @@ TEST(t_oom_bad_SHOULD_FAIL)
   PASS();
 }
 
+/* Fails only if a fault is simulated in the "read" class. */
+static mptest__result fault_class_read(void)
+{
+  void* a = MPTEST_INJECT_MALLOC(5);
+  if (a) {
+    MPTEST_INJECT_FREE(a);
+  }
+  ASSERT(!mptest_fault("read"));
+  PASS();
+}
+
+TEST(t_fault_class) { return fault_class_read(); }
+
+TEST(t_fault_class_SHOULD_FAIL) { return fault_class_read(); }
+
+TEST(t_fault_site_loop)
+{
+  int i;
+  for (i = 0; i < 100; i++) {
+    void* a = MPTEST_INJECT_MALLOC(5);
+    if (a) {
+      MPTEST_INJECT_FREE(a);
+    }
+  }
+  PASS();
+}
+
+TEST(t_fault_site_SHOULD_FAIL)
+{
+  int i;
+  for (i = 0; i < 100; i++) {
+    ASSERT(!MPTEST_FAULT("read"));
+  }
+  PASS();
+}
+
+/* Only the last of many fault points fails the test. */
+TEST(t_fault_sample_SHOULD_FAIL)
+{
+  int i;
+  for (i = 0; i < 100; i++) {
+    void* a = MPTEST_INJECT_MALLOC(5);
+    if (a) {
+      MPTEST_INJECT_FREE(a);
+    }
+  }
+  ASSERT(!MPTEST_FAULT("read"));
+  PASS();
+}
+
+/* Fails only if the allocation in the error path also fails. */
+static mptest__result fault_pair_cleanup(void)
+{
+  void* a = MPTEST_INJECT_MALLOC(5);
+  void* b;
+  if (!a) {
+    PASS();
+  }
+  b = MPTEST_INJECT_MALLOC(5);
+  if (!b) {
+    void* msg = MPTEST_INJECT_MALLOC(5);
+    MPTEST_INJECT_FREE(a);
+    ASSERT(msg);
+    MPTEST_INJECT_FREE(msg);
+    PASS();
+  }
+  MPTEST_INJECT_FREE(a);
+  MPTEST_INJECT_FREE(b);
+  PASS();
+}
+
+TEST(t_fault_pair) { return fault_pair_cleanup(); }
+
+TEST(t_fault_pair_SHOULD_FAIL) { return fault_pair_cleanup(); }
+
+/* Which of the allocations in the last run of t_fault_replay_SHOULD_FAIL
+ * succeeded, one bit each, or -1 if it hasn't run. */
+static int fault_replay_allocs = -1;
+static int fault_replay_swept = -1;
+static int fault_replay_limit;
+
+/* Fails if the first of two allocations at different sites fails. */
+TEST(t_fault_replay_SHOULD_FAIL)
+{
+  void* a = MPTEST_INJECT_MALLOC(5);
+  void* b = MPTEST_INJECT_MALLOC(5);
+  fault_replay_allocs = (a != NULL) | (b != NULL) << 1;
+  if (a) {
+    MPTEST_INJECT_FREE(a);
+  }
+  if (b) {
+    MPTEST_INJECT_FREE(b);
+  }
+  ASSERT(a);
+  PASS();
+}
+
+/* The recorded failure replayed with the same allocations failing. */
+TEST(t_fault_replay_same)
+{
+  ASSERT_NEQ(fault_replay_swept, -1);
+  ASSERT_EQ(fault_replay_allocs, fault_replay_swept);
+  PASS();
+}
+
+#if MPTEST_USE_IO
+/* Round-trips a string through a temporary file. Unless `check_short` is set,
+ * a short write is mistaken for success. */
+static mptest__result io_round_trip(int check_short)
+{
+  char buf[6] = {0};
+  size_t written, got = 0;
+  FILE* f = tmpfile();
+  ASSERT(f);
+  written = MPTEST_INJECT_FWRITE("hello", 1, 5, f);
+  if (written == 0 || (check_short && written != 5) ||
+      MPTEST_INJECT_FFLUSH(f)) {
+    fclose(f);
+    PASS();
+  }
+  rewind(f);
+  while (got != 5 && !ferror(f) && !feof(f)) {
+    got += MPTEST_INJECT_FREAD(buf + got, 1, 5 - got, f);
+  }
+  if (MPTEST_INJECT_FCLOSE(f)) {
+    PASS();
+  }
+  ASSERT_EQ(buf[4], 'o');
+  PASS();
+}
+
+TEST(t_io) { return io_round_trip(1); }
+
+TEST(t_io_SHOULD_FAIL) { return io_round_trip(0); }
+#endif
+
 TEST(t_fail_SHOULD_FAIL) { FAIL(); }
 
 int int_from_sym(sym_walk* walk, int* out)
@@ -118,6 +352,22 @@ TEST(t_sym_num)
   PASS();
 }
 
+TEST(t_sym_pool)
+{
+  int num = 0, i;
+  mptest_sym* sym;
+  SYM(int, "1", &num);
+  sym = mptest__state_g.sym_state.pool[0];
+  for (i = 0; i < 100; i++) {
+    SYM(int, "2", &num);
+    ASSERT(num == 2);
+  }
+  /* The same sym was handed out every time */
+  ASSERT(mptest__state_g.sym_state.pool[0] == sym);
+  ASSERT(mptest__state_g.sym_state.pool_used == 0);
+  PASS();
+}
+
 TEST(t_sym_atom_s)
 {
   mn__str s;
@@ -202,6 +452,18 @@ TEST(t_sym_eq)
   PASS();
 }
 
+/* The same address holding a different expression mustn't hit the cache */
+TEST(t_sym_eq_reused)
+{
+  char expr[2] = "1";
+  int num = 1;
+  ASSERT_SYMEQ(int, &num, expr);
+  expr[0] = '2';
+  num = 2;
+  ASSERT_SYMEQ(int, &num, expr);
+  PASS();
+}
+
 TEST(t_sym_ineq_SHOULD_FAIL)
 {
   int num = 1;
@@ -209,24 +471,335 @@ TEST(t_sym_ineq_SHOULD_FAIL)
   PASS();
 }
 
+/* Builds `(0 (1 (2 ... ())))`, `*depth` expressions deep */
+int nested_to_sym(sym_build* build, int* depth)
+{
+  sym_build b, sub;
+  int i;
+  SYM_PUT_EXPR(build, &b);
+  for (i = 0; i < *depth; i++) {
+    SYM_PUT_NUM(&b, i);
+    SYM_PUT_EXPR(&b, &sub);
+    b = sub;
+  }
+  return SYM_OK;
+}
+
+TEST(t_sym_nested)
+{
+  int depth = 3;
+  ASSERT_SYMEQ(nested, &depth, "(0 (1 (2 ())))");
+  PASS();
+}
+
+TEST(t_sym_nested_SHOULD_FAIL)
+{
+  int depth = 3;
+  ASSERT_SYMEQ(nested, &depth, "(0 (1 (2 (3))))");
+  PASS();
+}
+
+/* Builds `*depth` nested empty expressions */
+int deep_to_sym(sym_build* build, int* depth)
+{
+  sym_build b = *build, sub;
+  int i;
+  for (i = 0; i < *depth; i++) {
+    SYM_PUT_EXPR(&b, &sub);
+    b = sub;
+  }
+  return SYM_OK;
+}
+
+static mptest__result deep_sym_check(int* depth, const char* expr)
+{
+  ASSERT_SYMEQ(deep, depth, expr);
+  PASS();
+}
+
+/* Deep enough to overflow the stack if compared recursively */
+TEST(t_sym_deep)
+{
+  int depth = 2000000, i, res;
+  char* expr = (char*)malloc((size_t)depth * 2 + 1);
+  ASSERT(expr);
+  for (i = 0; i < depth; i++) {
+    expr[i] = '(';
+    expr[depth + i] = ')';
+  }
+  expr[depth * 2] = '\0';
+  res = deep_sym_check(&depth, expr);
+  free(expr);
+  return res;
+}
+
+/* Builds `(a b ... z a b ...)`, `*count` atoms long */
+int letters_to_sym(sym_build* build, int* count)
+{
+  sym_build b;
+  char letter;
+  int i;
+  SYM_PUT_EXPR(build, &b);
+  for (i = 0; i < *count; i++) {
+    letter = (char)('a' + i % 26);
+    SYM_PUT_STRN(&b, &letter, 1);
+  }
+  return SYM_OK;
+}
+
+TEST(t_sym_atoms)
+{
+  int count = 52;
+  ASSERT_SYMEQ(
+      letters, &count,
+      "(a b c d e f g h i j k l m n o p q r s t u v w x y z "
+      "a b c d e f g h i j k l m n o p q r s t u v w x y z)");
+  PASS();
+}
+
+/* (x (1 "two words") ()) */
+static const mptest_sym_node bulk_nodes[] = {
+    {MPTEST_SYM_EXPR, 1, MPTEST__SYM_NONE, 0, MN_NULL, 0},
+    {MPTEST_SYM_STR, MPTEST__SYM_NONE, 2, 0, "x", 1},
+    {MPTEST_SYM_EXPR, 3, 5, 0, MN_NULL, 0},
+    {MPTEST_SYM_NUM, MPTEST__SYM_NONE, 4, 1, MN_NULL, 0},
+    {MPTEST_SYM_STR, MPTEST__SYM_NONE, MPTEST__SYM_NONE, 0, "two words", 9},
+    {MPTEST_SYM_EXPR, MPTEST__SYM_NONE, MPTEST__SYM_NONE, 0, MN_NULL, 0}};
+
+int bulk_to_sym(sym_build* build, mn_size* count)
+{
+  sym_build b;
+  int err;
+  SYM_PUT_EXPR(build, &b);
+  SYM_PUT_NUM(&b, 0);
+  if ((err = mptest_sym_build_reserve(&b, *count + 1)) ||
+      (err = mptest_sym_build_bulk(&b, bulk_nodes, *count))) {
+    return err;
+  }
+  SYM_PUT_NUM(&b, 9);
+  return SYM_OK;
+}
+
+TEST(t_sym_bulk)
+{
+  mn_size count = 6;
+  ASSERT_SYMEQ(bulk, &count, "(0 (x (1 \"two words\") ()) 9)");
+  PASS();
+}
+
+/* Each has one bad link: backward, out of range, from an atom, to a node
+ * that is already linked, and none at all to the last node */
+static const mptest_sym_node bulk_bad_nodes[5][3] = {
+    {{MPTEST_SYM_EXPR, 1, MPTEST__SYM_NONE, 0, MN_NULL, 0},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, 2, 1, MN_NULL, 0},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, 1, 2, MN_NULL, 0}},
+    {{MPTEST_SYM_EXPR, 1, MPTEST__SYM_NONE, 0, MN_NULL, 0},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, 2, 1, MN_NULL, 0},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, 3, 2, MN_NULL, 0}},
+    {{MPTEST_SYM_EXPR, 1, MPTEST__SYM_NONE, 0, MN_NULL, 0},
+     {MPTEST_SYM_STR, 2, MPTEST__SYM_NONE, 0, "x", 1},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, MPTEST__SYM_NONE, 2, MN_NULL, 0}},
+    {{MPTEST_SYM_EXPR, 1, 2, 0, MN_NULL, 0},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, 2, 1, MN_NULL, 0},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, MPTEST__SYM_NONE, 2, MN_NULL, 0}},
+    {{MPTEST_SYM_EXPR, 1, MPTEST__SYM_NONE, 0, MN_NULL, 0},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, MPTEST__SYM_NONE, 1, MN_NULL, 0},
+     {MPTEST_SYM_NUM, MPTEST__SYM_NONE, MPTEST__SYM_NONE, 2, MN_NULL, 0}}};
+
+/* Record what building `bulk_bad_nodes[*which]` returned, and whether it was
+ * rolled back so that the next tree takes the place of the first bad one */
+int bulk_bad_to_sym(sym_build* build, int* which)
+{
+  sym_build b;
+  mn_int32 next;
+  SYM_PUT_EXPR(build, &b);
+  SYM_PUT_NUM(&b, 0);
+  next = b.prev_child_ref + 1;
+  SYM_PUT_NUM(&b, mptest_sym_build_bulk(&b, bulk_bad_nodes[*which], 3));
+  SYM_PUT_NUM(&b, b.prev_child_ref == next);
+  return SYM_OK;
+}
+
+TEST(t_sym_bulk_invalid)
+{
+  int which;
+  for (which = 0; which < 5; which++) {
+    /* SYM_INVALID is 8 */
+    ASSERT_SYMEQ(bulk_bad, &which, "(0 8 1)");
+  }
+  PASS();
+}
+
+/* Too big to print in full, so only the two differences are shown */
+TEST(t_sym_diff_SHOULD_FAIL)
+{
+  int count = 104;
+  ASSERT_SYMEQ(
+      letters, &count,
+      "(a b c d e f g h i j k l m n o p q r s t u v w x y z "
+      "a b c d e f g h i j k l m n o p Q r s t u v w x y z "
+      "a b c d e f g h i j k l n o p q r s t u v w x y z "
+      "a b c d e f g h i j k l m n o p q r s t u v w x y z)");
+  PASS();
+}
+
+TEST(t_sym_snapshot)
+{
+  int count = 52, depth = 3;
+  MPTEST_ENABLE_UPDATE_SNAPSHOTS();
+  ASSERT_SYM_SNAPSHOT(letters, &count, "t_sym_snapshot.sym");
+  ASSERT_SYM_SNAPSHOT(nested, &depth, "t_sym_snapshot_nested.sym");
+  MPTEST_DISABLE_UPDATE_SNAPSHOTS();
+  ASSERT_SYM_SNAPSHOT(letters, &count, "t_sym_snapshot.sym");
+  ASSERT_SYM_SNAPSHOT(nested, &depth, "t_sym_snapshot_nested.sym");
+  PASS();
+}
+
+TEST(t_sym_snapshot_SHOULD_FAIL)
+{
+  int count = 51;
+  ASSERT_SYM_SNAPSHOT(letters, &count, "t_sym_snapshot.sym");
+  PASS();
+}
+
+int bytes_to_sym(sym_build* build, const char* str)
+{
+  sym_build b;
+  SYM_PUT_EXPR(build, &b);
+  SYM_PUT_STR(&b, str);
+  SYM_PUT_STRN(&b, "\"\\\n", 3);
+  return SYM_OK;
+}
+
+/* The text written next to a snapshot parses back into the same sym, even
+ * with bytes outside of ASCII */
+TEST(t_sym_snapshot_text)
+{
+  const char* str = "caf\xC3\xA9 \xFF";
+  char text[64];
+  size_t size;
+  FILE* f;
+  MPTEST_ENABLE_UPDATE_SNAPSHOTS();
+  ASSERT_SYM_SNAPSHOT(bytes, str, "t_sym_snapshot_text.sym");
+  MPTEST_DISABLE_UPDATE_SNAPSHOTS();
+  f = fopen("t_sym_snapshot_text.sym.txt", "rb");
+  ASSERT(f);
+  size = fread(text, 1, sizeof(text) - 1, f);
+  fclose(f);
+  text[size] = '\0';
+  ASSERT_SYMEQ(bytes, str, text);
+  PASS();
+}
+
+#define NONE 0xFFFFFFFFUL
+
+/* Snapshots of three trees that are well-formed apart from their links: a
+ * number with a child, a tree linked twice and a tree linked from nowhere.
+ * Each tree is four words: type, first child, next sibling and data. */
+static const unsigned long corrupt_trees[3][12] = {
+    {0, 1, NONE, 0, 2, 2, NONE, 0, 2, NONE, NONE, 0},
+    {0, 1, NONE, 0, 0, 2, 2, 0, 2, NONE, NONE, 0},
+    {0, 1, NONE, 0, 2, NONE, NONE, 0, 2, NONE, NONE, 0}};
+
+static int corrupt_case;
+
+TEST(t_sym_snapshot_corrupt_SHOULD_FAIL)
+{
+  unsigned char data[8 + 4 * 15];
+  unsigned long word;
+  int count = 0, i;
+  FILE* f;
+  for (i = 0; i < 8; i++) {
+    data[i] = (unsigned char)"mpsym\0\0\1"[i];
+  }
+  for (i = 0; i < 15; i++) {
+    /* Tree, atom and text counts, then the trees */
+    word = i == 0 ? 3 : i < 3 ? 0 : corrupt_trees[corrupt_case][i - 3];
+    data[8 + i * 4] = (unsigned char)(word & 0xFF);
+    data[8 + i * 4 + 1] = (unsigned char)((word >> 8) & 0xFF);
+    data[8 + i * 4 + 2] = (unsigned char)((word >> 16) & 0xFF);
+    data[8 + i * 4 + 3] = (unsigned char)((word >> 24) & 0xFF);
+  }
+  f = fopen("t_sym_snapshot_corrupt.sym", "wb");
+  ASSERT(f);
+  ASSERT_EQ(fwrite(data, 1, sizeof(data), f), sizeof(data));
+  fclose(f);
+  ASSERT_SYM_SNAPSHOT(letters, &count, "t_sym_snapshot_corrupt.sym");
+  PASS();
+}
+
+#undef NONE
+
+#if MPTEST_USE_COVERAGE
+static mptest__coverage_guard maze_guards[4];
+
+/* Stands in for code built with -fsanitize-coverage=trace-pc-guard. Blind
+ * fuzzing needs ~1M iterations to get through, guided fuzzing far fewer. */
+static mptest__result fuzz_maze(void)
+{
+  if (RAND_PARAM(16) == 3) {
+    __sanitizer_cov_trace_pc_guard(&maze_guards[0]);
+    if (RAND_PARAM(16) == 1) {
+      __sanitizer_cov_trace_pc_guard(&maze_guards[1]);
+      if (RAND_PARAM(16) == 4) {
+        __sanitizer_cov_trace_pc_guard(&maze_guards[2]);
+        if (RAND_PARAM(16) == 1) {
+          __sanitizer_cov_trace_pc_guard(&maze_guards[3]);
+          ASSERT_NEQ(RAND_PARAM(16), 5);
+        }
+      }
+    }
+  }
+  PASS();
+}
+
+TEST(t_fuzz_maze) { return fuzz_maze(); }
+
+TEST(t_fuzz_guided_SHOULD_FAIL) { return fuzz_maze(); }
+#endif
+
 TEST(t_fuzz_error_SHOULD_FAIL)
 {
   ASSERT_GTE(RAND_PARAM(1000), 5);
   PASS();
 }
 
+/* Fails at two different assertions, so its failures fill two buckets */
+TEST(t_fuzz_buckets_SHOULD_FAIL)
+{
+  mptest_rand n = RAND_PARAM(100);
+  ASSERT_GTE(n, 5);
+  ASSERT_LT(n, 90);
+  PASS();
+}
+
+#if defined(MPTEST_FUZZ_TARGET_TEST)
+/* Built as the fuzz target of one test by -DMPTEST_FUZZ_TARGET=<test> */
+MPTEST_FUZZ_TARGET(MPTEST_FUZZ_TARGET_TEST)
+#else
 int main(int argc, const char* const* argv)
 {
   MPTEST_MAIN_BEGIN_ARGS(argc, argv);
   RUN_TEST(t_pass);
   RUN_SUITE(s_pass);
   FUZZ_TEST(t_fuzz);
+  FUZZ_TEST(t_fuzz_fill);
+  FUZZ_TEST(t_fuzz_wide);
   RUN_TEST(t_assert_catch);
   RUN_TEST(t_assert_catch_SHOULD_FAIL);
   RUN_TEST(t_enable_disable_leakchecking);
   MPTEST_ENABLE_LEAK_CHECKING();
   RUN_TEST(t_leak_malloc_SHOULD_FAIL);
   RUN_TEST(t_leak_realloc_SHOULD_FAIL);
+  MPTEST_ENABLE_QUARANTINE(1024);
+  RUN_TEST(t_leak_use_after_free_SHOULD_FAIL);
+  MPTEST_DISABLE_QUARANTINE();
+  RUN_TEST(t_leak_free_invalid_SHOULD_FAIL);
+  RUN_TEST(t_leak_double_free_SHOULD_FAIL);
+#if MPTEST_USE_THREADS && !defined(_WIN32)
+  RUN_TEST(t_leak_threads);
+  RUN_TEST(t_leak_threads_SHOULD_FAIL);
+#endif
   MPTEST_DISABLE_LEAK_CHECKING();
   RUN_TEST(t_enable_disable_faultchecking);
   MPTEST_ENABLE_LEAK_CHECKING();
@@ -234,9 +807,56 @@ int main(int argc, const char* const* argv)
   RUN_TEST(t_oom_initial);
   RUN_TEST(t_fail_SHOULD_FAIL);
   RUN_TEST(t_oom_bad_SHOULD_FAIL);
+  MPTEST_SET_FAULT_CLASSES("malloc,realloc");
+  RUN_TEST(t_fault_class);
+  MPTEST_SET_FAULT_CLASSES("malloc,read");
+  RUN_TEST(t_fault_class_SHOULD_FAIL);
+  MPTEST_SET_FAULT_CLASSES(NULL);
+  MPTEST_SET_FAULT_SITE_LIMIT(1);
+  RUN_TEST(t_fault_site_loop);
+  RUN_TEST(t_fault_site_SHOULD_FAIL);
+  MPTEST_SET_FAULT_SITE_LIMIT(0);
+  MPTEST_SET_FAULT_SEED(1);
+  MPTEST_SET_FAULT_SAMPLE(5, 0);
+  RUN_TEST(t_fault_site_loop);
+  MPTEST_SET_FAULT_SAMPLE(2, 0);
+  RUN_TEST(t_fault_sample_SHOULD_FAIL);
+  MPTEST_SET_FAULT_SAMPLE(0, 0);
+  RUN_TEST(t_fault_pair);
+  MPTEST_ENABLE_FAULT_PAIRS();
+  RUN_TEST(t_fault_pair_SHOULD_FAIL);
+  MPTEST_DISABLE_FAULT_PAIRS();
+  MPTEST_SET_FAULT_INDEX("malloc:1,malloc:2");
+  RUN_TEST(t_fault_pair_SHOULD_FAIL);
+  MPTEST_SET_FAULT_INDEX(NULL);
+#if MPTEST_USE_DYN_ALLOC
+  /* Record the failure found by a class sweep, then a site-limited one, in
+   * set mode, and replay it */
+  mptest__fault_set(&mptest__state_g, MPTEST__FAULT_MODE_SET);
+  for (fault_replay_limit = 0; fault_replay_limit < 2; fault_replay_limit++) {
+    MPTEST_SET_FAULT_SITE_LIMIT(fault_replay_limit);
+    mptest__fault_record_file(&mptest__state_g, "t_fault_replay.txt");
+    RUN_TEST(t_fault_replay_SHOULD_FAIL);
+    mptest__fault_record_file(&mptest__state_g, NULL);
+    fault_replay_swept = fault_replay_allocs;
+    fault_replay_allocs = -1;
+    mptest__fault_replay_file(&mptest__state_g, "t_fault_replay.txt");
+    RUN_TEST(t_fault_replay_SHOULD_FAIL);
+    mptest__fault_replay_file(&mptest__state_g, NULL);
+    RUN_TEST(t_fault_replay_same);
+  }
+  remove("t_fault_replay.txt");
+  MPTEST_SET_FAULT_SITE_LIMIT(0);
+  MPTEST_ENABLE_FAULT_CHECKING();
+#endif
+#if MPTEST_USE_IO
+  RUN_TEST(t_io);
+  RUN_TEST(t_io_SHOULD_FAIL);
+#endif
   MPTEST_DISABLE_FAULT_CHECKING();
   MPTEST_DISABLE_LEAK_CHECKING();
   RUN_TEST(t_sym_num);
+  RUN_TEST(t_sym_pool);
   RUN_TEST(t_sym_atom_s);
   RUN_TEST(t_sym_expr);
   RUN_TEST(t_sym_char);
@@ -244,8 +864,67 @@ int main(int argc, const char* const* argv)
   RUN_TEST(t_sym_zero);
   RUN_TEST(t_sym_unmatched_SHOULD_FAIL);
   RUN_TEST(t_sym_eq);
+  RUN_TEST(t_sym_eq_reused);
   RUN_TEST(t_sym_ineq_SHOULD_FAIL);
+  RUN_TEST(t_sym_atoms);
+  RUN_TEST(t_sym_nested);
+  RUN_TEST(t_sym_nested_SHOULD_FAIL);
+  RUN_TEST(t_sym_diff_SHOULD_FAIL);
+  RUN_TEST(t_sym_bulk);
+  RUN_TEST(t_sym_bulk_invalid);
+  RUN_TEST(t_sym_snapshot);
+  RUN_TEST(t_sym_snapshot_SHOULD_FAIL);
+  RUN_TEST(t_sym_snapshot_text);
+  for (corrupt_case = 0; corrupt_case < 3; corrupt_case++) {
+    RUN_TEST(t_sym_snapshot_corrupt_SHOULD_FAIL);
+  }
+  remove("t_sym_snapshot.sym");
+  remove("t_sym_snapshot.sym.txt");
+  remove("t_sym_snapshot_nested.sym");
+  remove("t_sym_snapshot_nested.sym.txt");
+  remove("t_sym_snapshot_text.sym");
+  remove("t_sym_snapshot_text.sym.txt");
+  remove("t_sym_snapshot_corrupt.sym");
+  RUN_TEST(t_sym_deep);
+  FUZZ_TEST(t_fuzz_error_SHOULD_FAIL);
+  MPTEST_SET_FUZZ_ITERATIONS(20);
+  FUZZ_TEST(t_fuzz);
+  MPTEST_SET_FUZZ_ITERATIONS(0);
+  MPTEST_SET_FUZZ_TIME(10);
+  MPTEST_ENABLE_FUZZ_UNTIL_FAILURE();
+  FUZZ_TEST(t_fuzz_error_SHOULD_FAIL);
+  MPTEST_DISABLE_FUZZ_UNTIL_FAILURE();
+  MPTEST_SET_FUZZ_TIME(0);
+  MPTEST_ENABLE_FUZZ_KEEP_GOING();
+  FUZZ_TEST(t_fuzz_buckets_SHOULD_FAIL);
+#if MPTEST_USE_FORK
+  MPTEST_SET_FUZZ_WORKERS(4);
+  FUZZ_TEST(t_fuzz_buckets_SHOULD_FAIL);
+  MPTEST_SET_FUZZ_WORKERS(1);
+#endif
+  MPTEST_DISABLE_FUZZ_KEEP_GOING();
+#if MPTEST_USE_DYN_ALLOC
+  MPTEST_SET_FUZZ_TAPE("0");
+  FUZZ_TEST(t_fuzz_error_SHOULD_FAIL);
+  MPTEST_SET_FUZZ_TAPE(NULL);
+#endif
+#if MPTEST_USE_FORK
+  MPTEST_SET_FUZZ_WORKERS(4);
+  FUZZ_TEST(t_fuzz);
   FUZZ_TEST(t_fuzz_error_SHOULD_FAIL);
+  MPTEST_SET_FUZZ_WORKERS(1);
+#endif
+#if MPTEST_USE_COVERAGE
+  __sanitizer_cov_trace_pc_guard_init(maze_guards, maze_guards + 4);
+  /* The same budget gets through the maze only with guidance */
+  MPTEST_SET_FUZZ_ITERATIONS(5000);
+  FUZZ_TEST(t_fuzz_maze);
+  MPTEST_ENABLE_FUZZ_GUIDED();
+  FUZZ_TEST(t_fuzz_guided_SHOULD_FAIL);
+  MPTEST_DISABLE_FUZZ_GUIDED();
+  MPTEST_SET_FUZZ_ITERATIONS(0);
+#endif
   MPTEST_MAIN_END();
   return 0;
 }
+#endif